@@ -0,0 +1,149 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Accept benchmark.
+ * Many tasks blocked in csp_accept() on the same socket, while connections are made over the loopback interface.
+ * Measures connections/sec and context switches per connection (getrusage) - with broadcast wakeups, every
+ * new connection wakes all the blocked tasks.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_debug.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define BENCH_PORT 10
+
+static csp_socket_t * bench_socket;
+static unsigned int bench_accepted;
+
+CSP_DEFINE_TASK(accept_task) {
+
+	for (;;) {
+		csp_conn_t * conn = csp_accept(bench_socket, CSP_MAX_TIMEOUT);
+		if (conn == NULL) {
+			continue;
+		}
+		csp_packet_t * packet;
+		while ((packet = csp_read(conn, 0)) != NULL) {
+			csp_buffer_free(packet);
+		}
+		csp_close(conn);
+		__atomic_fetch_add(&bench_accepted, 1, __ATOMIC_SEQ_CST);
+	}
+
+	return CSP_TASK_RETURN;
+}
+
+static long bench_context_switches(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+int main(int argc, char * argv[]) {
+
+	unsigned int threads = 32;
+	unsigned int connections = 10000;
+	unsigned int outstanding = 4;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:o:t:h")) != -1) {
+		switch (opt) {
+			case 'c':
+				connections = atoi(optarg);
+				break;
+			case 'o':
+				outstanding = atoi(optarg);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			default:
+				printf("Usage:\n"
+					   " -c <count>    number of connections (default: 10000)\n"
+					   " -o <count>    max connections not yet accepted (default: 4)\n"
+					   " -t <threads>  number of tasks blocked in csp_accept() (default: 32)\n");
+				exit(1);
+				break;
+		}
+	}
+
+	csp_conf_t csp_conf;
+	csp_conf_get_defaults(&csp_conf);
+	csp_conf.address = 1;
+	csp_conf.conn_max = 4 * outstanding;
+	csp_conf.buffers = 4 * outstanding;
+	int error = csp_init(&csp_conf);
+	if (error != CSP_ERR_NONE) {
+		csp_log_error("csp_init() failed, error: %d", error);
+		exit(1);
+	}
+	csp_route_start_task(1000, 0);
+
+	bench_socket = csp_socket(CSP_SO_NONE);
+	csp_bind(bench_socket, BENCH_PORT);
+	csp_listen(bench_socket, outstanding);
+
+	for (unsigned int i = 0; i < threads; ++i) {
+		if (csp_thread_create(accept_task, "ACCEPT", 1000, NULL, 0, NULL) != CSP_ERR_NONE) {
+			csp_log_error("bench: failed to create thread");
+			exit(1);
+		}
+	}
+	// let all tasks block in csp_accept()
+	csp_sleep_ms(100);
+
+	const long switches = bench_context_switches();
+	const uint32_t start = csp_get_ms();
+	for (unsigned int i = 0; i < connections; ++i) {
+		while ((i - __atomic_load_n(&bench_accepted, __ATOMIC_SEQ_CST)) >= outstanding) {
+			csp_sleep_ms(1);
+		}
+		csp_conn_t * conn = csp_connect(CSP_PRIO_NORM, csp_conf.address, BENCH_PORT, 0, CSP_O_NONE);
+		csp_packet_t * packet = csp_buffer_get(1);
+		if ((conn == NULL) || (packet == NULL)) {
+			csp_log_error("bench: out of connections or buffers");
+			exit(1);
+		}
+		packet->data[0] = 0;
+		packet->length = 1;
+		if (!csp_send(conn, packet, 0)) {
+			csp_buffer_free(packet);
+		}
+		csp_close(conn);
+	}
+	while (__atomic_load_n(&bench_accepted, __ATOMIC_SEQ_CST) < connections) {
+		csp_sleep_ms(1);
+	}
+	const uint32_t elapsed = csp_get_ms() - start;
+	const long total_switches = bench_context_switches() - switches;
+
+	printf("threads: %u, connections: %u, connections/sec: %10.0f, context switches/connection: %6.1f\r\n",
+		   threads, connections, (elapsed) ? (connections * 1000.0 / elapsed) : 0,
+		   (connections) ? ((double) total_switches / connections) : 0);
+
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CSP_EXAMPLES_BENCH_H_
+#define CSP_EXAMPLES_BENCH_H_
+
+/*
+ * Helpers shared by the benchmark examples.
+ */
+
+#include <csp/arch/csp_thread.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Set while a timed run is in progress, polled by the benchmark tasks
+static volatile bool bench_running;
+// Number of benchmark tasks done, see bench_task_done()
+static unsigned int bench_stopped;
+
+/* Monotonic time in nS, for measurements finer than csp_get_ms() */
+static inline uint64_t bench_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Called by a benchmark task when it is done */
+static inline void bench_task_done(void) {
+	__atomic_fetch_add(&bench_stopped, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Wait for count benchmark tasks to be done */
+static inline void bench_wait_done(unsigned int count) {
+	while (__atomic_load_n(&bench_stopped, __ATOMIC_SEQ_CST) < count) {
+		csp_sleep_ms(1);
+	}
+}
+
+#endif /* CSP_EXAMPLES_BENCH_H_ */
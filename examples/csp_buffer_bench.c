@@ -0,0 +1,143 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Buffer pool benchmark.
+ * Measures csp_buffer_get()/csp_buffer_free() throughput with an increasing number of threads.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_debug.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "csp_bench.h"
+
+#define MAX_THREADS 16
+
+static unsigned int bench_started;
+static uint64_t bench_count[MAX_THREADS];
+static unsigned int bench_buffers;
+
+CSP_DEFINE_TASK(bench_task) {
+
+	uint64_t * count = param;
+	uint64_t local = 0;
+
+	__atomic_fetch_add(&bench_started, 1, __ATOMIC_SEQ_CST);
+	while (bench_running) {
+		for (unsigned int i = 0; i < 100; ++i) {
+			void * packet = csp_buffer_get(0);
+			if (packet == NULL) {
+				csp_log_error("bench: out of buffers");
+				exit(1);
+			}
+			csp_buffer_free(packet);
+		}
+		local += 100;
+	}
+	*count = local;
+	bench_task_done();
+
+	return CSP_TASK_RETURN;
+}
+
+static int run_bench(unsigned int threads, uint32_t duration_ms) {
+
+	bench_running = true;
+	bench_started = 0;
+	bench_stopped = 0;
+
+	for (unsigned int i = 0; i < threads; ++i) {
+		bench_count[i] = 0;
+		if (csp_thread_create(bench_task, "BENCH", 1000, &bench_count[i], 0, NULL) != CSP_ERR_NONE) {
+			csp_log_error("bench: failed to create thread");
+			return CSP_ERR_NOMEM;
+		}
+	}
+	while (__atomic_load_n(&bench_started, __ATOMIC_SEQ_CST) < threads) {
+		csp_sleep_ms(1);
+	}
+
+	const uint32_t start = csp_get_ms();
+	csp_sleep_ms(duration_ms);
+	bench_running = false;
+	bench_wait_done(threads);
+	const uint32_t elapsed = csp_get_ms() - start;
+
+	uint64_t total = 0;
+	for (unsigned int i = 0; i < threads; ++i) {
+		total += bench_count[i];
+	}
+	printf("threads: %2u, allocs: %10llu, allocs/sec: %12.0f\r\n",
+		   threads, (unsigned long long) total, (elapsed) ? (total * 1000.0 / elapsed) : 0);
+
+	if (csp_buffer_remaining() != (int) bench_buffers) {
+		csp_log_error("bench: buffers leaked, remaining %d != %u", csp_buffer_remaining(), bench_buffers);
+		return CSP_ERR_INVAL;
+	}
+	return CSP_ERR_NONE;
+}
+
+int main(int argc, char * argv[]) {
+
+	uint32_t duration_ms = 1000;
+	unsigned int magazine_size = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:m:h")) != -1) {
+		switch (opt) {
+			case 'd':
+				duration_ms = atoi(optarg);
+				break;
+			case 'm':
+				magazine_size = atoi(optarg);
+				break;
+			default:
+				printf("Usage:\n"
+					   " -d <duration>  duration of each run in mS (default: 1000)\n"
+					   " -m <size>      per-thread buffer magazine size (default: 0, disabled)\n");
+				exit(1);
+				break;
+		}
+	}
+
+	csp_conf_t csp_conf;
+	csp_conf_get_defaults(&csp_conf);
+	csp_conf.buffers = 2 * MAX_THREADS + (MAX_THREADS * magazine_size);
+	csp_conf.buffer_magazine_size = magazine_size;
+	bench_buffers = csp_conf.buffers;
+	int error = csp_init(&csp_conf);
+	if (error != CSP_ERR_NONE) {
+		csp_log_error("csp_init() failed, error: %d", error);
+		exit(1);
+	}
+
+	for (unsigned int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		if (run_bench(threads, duration_ms) != CSP_ERR_NONE) {
+			exit(1);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Buffer pipeline benchmark.
+ * An RX thread allocates buffers and writes the payload, while a router thread (on another core) takes a reference,
+ * reads the payload and frees the buffer. With the default buffer layout, buffer headers share cache lines with the
+ * payload of neighbouring buffers - compare the throughput with a build using --enable-buffer-slab.
+ */
+
+#define _GNU_SOURCE
+#include <csp/csp.h>
+#include <csp/csp_debug.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "csp_bench.h"
+
+#define QUEUE_LENGTH 64
+
+static csp_queue_handle_t bench_queue;
+static unsigned int bench_data_size = 16;
+static int bench_cpu[2] = {0, 1};
+static uint64_t bench_rx_count;
+static uint64_t bench_route_count;
+static uint32_t bench_checksum;
+
+static void bench_pin(int cpu) {
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		csp_log_warn("bench: failed to pin thread to cpu %d", cpu);
+	}
+#else
+	(void) cpu;
+#endif
+}
+
+CSP_DEFINE_TASK(rx_task) {
+
+	bench_pin(bench_cpu[0]);
+
+	uint64_t count = 0;
+	while (bench_running) {
+		csp_packet_t * packet = csp_buffer_get(bench_data_size);
+		if (packet == NULL) {
+			continue;
+		}
+		memset(packet->data, (uint8_t) count, bench_data_size);
+		packet->length = bench_data_size;
+		if (csp_queue_enqueue(bench_queue, &packet, 10) != CSP_QUEUE_OK) {
+			csp_buffer_free(packet);
+			continue;
+		}
+		++count;
+	}
+	bench_rx_count = count;
+
+	// tell router to stop
+	csp_packet_t * stop = NULL;
+	csp_queue_enqueue(bench_queue, &stop, CSP_MAX_TIMEOUT);
+	bench_task_done();
+
+	return CSP_TASK_RETURN;
+}
+
+CSP_DEFINE_TASK(route_task) {
+
+	bench_pin(bench_cpu[1]);
+
+	uint64_t count = 0;
+	uint32_t checksum = 0;
+	while (1) {
+		csp_packet_t * packet;
+		if (csp_queue_dequeue(bench_queue, &packet, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK) {
+			continue;
+		}
+		if (packet == NULL) {
+			break;
+		}
+		// reference like promiscuous mode/RDP, read payload and release both references
+		csp_buffer_ref(packet);
+		for (unsigned int i = 0; i < packet->length; ++i) {
+			checksum += packet->data[i];
+		}
+		csp_buffer_free(packet);
+		csp_buffer_free(packet);
+		++count;
+	}
+	bench_route_count = count;
+	bench_checksum = checksum;
+	bench_task_done();
+
+	return CSP_TASK_RETURN;
+}
+
+int main(int argc, char * argv[]) {
+
+	uint32_t duration_ms = 2000;
+	unsigned int buffers = 2 * QUEUE_LENGTH;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:c:d:s:h")) != -1) {
+		switch (opt) {
+			case 'b':
+				buffers = atoi(optarg);
+				break;
+			case 'c':
+				if (sscanf(optarg, "%d,%d", &bench_cpu[0], &bench_cpu[1]) != 2) {
+					printf("Invalid cpus: %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'd':
+				duration_ms = atoi(optarg);
+				break;
+			case 's':
+				bench_data_size = atoi(optarg);
+				break;
+			default:
+				printf("Usage:\n"
+					   " -b <buffers>   number of buffers (default: %u)\n"
+					   " -c <rx,route>  cpus for RX and router threads (default: 0,1)\n"
+					   " -d <duration>  duration in mS (default: 2000)\n"
+					   " -s <size>      data size (default: 16)\n", 2 * QUEUE_LENGTH);
+				exit(1);
+				break;
+		}
+	}
+
+	csp_conf_t csp_conf;
+	csp_conf_get_defaults(&csp_conf);
+	csp_conf.buffers = buffers;
+	csp_conf.buffer_data_size = bench_data_size;
+	int error = csp_init(&csp_conf);
+	if (error != CSP_ERR_NONE) {
+		csp_log_error("csp_init() failed, error: %d", error);
+		exit(1);
+	}
+
+	bench_queue = csp_queue_create(QUEUE_LENGTH, sizeof(csp_packet_t *));
+	if (bench_queue == NULL) {
+		csp_log_error("bench: failed to create queue");
+		exit(1);
+	}
+
+	bench_running = true;
+	if ((csp_thread_create(route_task, "ROUTE", 1000, NULL, 0, NULL) != CSP_ERR_NONE) ||
+		(csp_thread_create(rx_task, "RX", 1000, NULL, 0, NULL) != CSP_ERR_NONE)) {
+		csp_log_error("bench: failed to create threads");
+		exit(1);
+	}
+
+	const uint32_t start = csp_get_ms();
+	csp_sleep_ms(duration_ms);
+	bench_running = false;
+	bench_wait_done(2);
+	const uint32_t elapsed = csp_get_ms() - start;
+
+	printf("layout: %s, data size: %u, cpus: %d,%d, packets: %llu, packets/sec: %.0f (checksum %u)\r\n",
+		   CSP_USE_BUFFER_SLAB ? "slab" : "inline",
+		   bench_data_size, bench_cpu[0], bench_cpu[1],
+		   (unsigned long long) bench_route_count, (elapsed) ? (bench_route_count * 1000.0 / elapsed) : 0, (unsigned int) bench_checksum);
+
+	if ((bench_rx_count != bench_route_count) || (csp_buffer_remaining() != (int) buffers)) {
+		csp_log_error("bench: packets lost or buffers leaked, rx %llu, routed %llu, remaining %d != %u",
+					  (unsigned long long) bench_rx_count, (unsigned long long) bench_route_count, csp_buffer_remaining(), buffers);
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Queue benchmark.
+ * Measures csp_queue throughput (SPSC and MPSC) and wakeup latency (ping-pong between two threads).
+ * Build with and without --enable-queue-lockfree to compare the queue backends.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_debug.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "csp_bench.h"
+
+#define MAX_PRODUCERS 8
+
+static csp_queue_handle_t bench_queue;
+static csp_queue_handle_t bench_pong;
+static unsigned int bench_items;
+
+CSP_DEFINE_TASK(producer_task) {
+
+	for (uintptr_t i = 1; i <= bench_items; ++i) {
+		if (csp_queue_enqueue(bench_queue, &i, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK) {
+			csp_log_error("bench: enqueue failed");
+			exit(1);
+		}
+	}
+	bench_task_done();
+
+	return CSP_TASK_RETURN;
+}
+
+static int run_throughput(unsigned int producers, unsigned int queue_length) {
+
+	bench_queue = csp_queue_create(queue_length, sizeof(uintptr_t));
+	if (bench_queue == NULL) {
+		csp_log_error("bench: failed to create queue");
+		return CSP_ERR_NOMEM;
+	}
+	bench_stopped = 0;
+
+	const uint64_t start = bench_now_ns();
+	for (unsigned int i = 0; i < producers; ++i) {
+		if (csp_thread_create(producer_task, "PROD", 1000, NULL, 0, NULL) != CSP_ERR_NONE) {
+			csp_log_error("bench: failed to create thread");
+			return CSP_ERR_NOMEM;
+		}
+	}
+
+	const uint64_t total = (uint64_t) producers * bench_items;
+	uintptr_t item;
+	for (uint64_t i = 0; i < total; ++i) {
+		if (csp_queue_dequeue(bench_queue, &item, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK) {
+			csp_log_error("bench: dequeue failed");
+			return CSP_ERR_TIMEDOUT;
+		}
+	}
+	const uint64_t elapsed = bench_now_ns() - start;
+
+	bench_wait_done(producers);
+	csp_queue_remove(bench_queue);
+
+	printf("producers: %u, items: %10llu, ops/sec: %12.0f\r\n",
+		   producers, (unsigned long long) total, (elapsed) ? (total * 1e9 / elapsed) : 0);
+	return CSP_ERR_NONE;
+}
+
+CSP_DEFINE_TASK(pong_task) {
+
+	uintptr_t item;
+	for (unsigned int i = 0; i < bench_items; ++i) {
+		if ((csp_queue_dequeue(bench_queue, &item, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK) ||
+			(csp_queue_enqueue(bench_pong, &item, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK)) {
+			csp_log_error("bench: pong failed");
+			exit(1);
+		}
+	}
+	bench_task_done();
+
+	return CSP_TASK_RETURN;
+}
+
+static int run_latency(void) {
+
+	bench_queue = csp_queue_create(1, sizeof(uintptr_t));
+	bench_pong = csp_queue_create(1, sizeof(uintptr_t));
+	if ((bench_queue == NULL) || (bench_pong == NULL)) {
+		csp_log_error("bench: failed to create queue");
+		return CSP_ERR_NOMEM;
+	}
+	bench_stopped = 0;
+	if (csp_thread_create(pong_task, "PONG", 1000, NULL, 0, NULL) != CSP_ERR_NONE) {
+		csp_log_error("bench: failed to create thread");
+		return CSP_ERR_NOMEM;
+	}
+
+	const uint64_t start = bench_now_ns();
+	for (uintptr_t i = 0; i < bench_items; ++i) {
+		uintptr_t item = i;
+		if ((csp_queue_enqueue(bench_queue, &item, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK) ||
+			(csp_queue_dequeue(bench_pong, &item, CSP_MAX_TIMEOUT) != CSP_QUEUE_OK) || (item != i)) {
+			csp_log_error("bench: ping failed");
+			return CSP_ERR_TIMEDOUT;
+		}
+	}
+	const uint64_t elapsed = bench_now_ns() - start;
+
+	bench_wait_done(1);
+	csp_queue_remove(bench_queue);
+	csp_queue_remove(bench_pong);
+
+	// each round trip is two wakeups
+	printf("round trips: %u, wakeup latency: %8.0f nS\r\n",
+		   bench_items, (bench_items) ? (elapsed / (2.0 * bench_items)) : 0);
+	return CSP_ERR_NONE;
+}
+
+int main(int argc, char * argv[]) {
+
+	unsigned int queue_length = 256;
+	bench_items = 1000000;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:q:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				bench_items = atoi(optarg);
+				break;
+			case 'q':
+				queue_length = atoi(optarg);
+				break;
+			default:
+				printf("Usage:\n"
+					   " -n <items>   items per producer, and round trips (default: 1000000)\n"
+					   " -q <length>  queue length for throughput runs (default: 256)\n");
+				exit(1);
+				break;
+		}
+	}
+
+	for (unsigned int producers = 1; producers <= MAX_PRODUCERS; producers *= 2) {
+		if (run_throughput(producers, queue_length) != CSP_ERR_NONE) {
+			exit(1);
+		}
+	}
+
+	bench_items /= 10;
+	if (run_latency() != CSP_ERR_NONE) {
+		exit(1);
+	}
+
+	return 0;
+}
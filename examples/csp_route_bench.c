@@ -0,0 +1,203 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Router scaling benchmark.
+ * Producer tasks inject packets on an input interface (as a driver would), each with its own flow (source port),
+ * which the router(s) forward to another node through an output interface that counts and frees them - or deliver
+ * locally over loopback to a connection-less socket per flow (-l).
+ * Run with 1, 2, 4, ... router shards (-s) to see forwarding throughput scale with cores.
+ * With -c, the input interface forwards transit packets directly from the producers (cut-through), bypassing the router.
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_debug.h>
+#include <csp/csp_interface.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "csp_bench.h"
+
+#define BENCH_ADDRESS 1
+#define BENCH_REMOTE 5
+#define BENCH_PORT 10
+#define BENCH_IN_FLIGHT 160
+
+static unsigned int bench_local;
+static uint32_t bench_sent;
+static uint32_t bench_received;
+
+static int bench_sink_tx(const csp_route_t * ifroute, csp_packet_t * packet) {
+
+	__atomic_fetch_add(&bench_received, 1, __ATOMIC_RELAXED);
+	csp_buffer_free(packet);
+	return CSP_ERR_NONE;
+}
+
+static csp_iface_t bench_if_in = {
+	.name = "IN",
+};
+
+static csp_iface_t bench_if_out = {
+	.name = "OUT",
+	.nexthop = bench_sink_tx,
+};
+
+CSP_DEFINE_TASK(producer_task) {
+
+	const unsigned int flow = (uintptr_t) param;
+
+	while (bench_running) {
+		// limit packets in flight, so buffers and queues never run out
+		if ((__atomic_load_n(&bench_sent, __ATOMIC_RELAXED) - __atomic_load_n(&bench_received, __ATOMIC_RELAXED)) >= BENCH_IN_FLIGHT) {
+			csp_sleep_ms(0);
+			continue;
+		}
+		csp_packet_t * packet = csp_buffer_get(16);
+		if (packet == NULL) {
+			csp_sleep_ms(0);
+			continue;
+		}
+		// unique payload, so packets are not discarded as duplicates (dedup)
+		const uint32_t seq = __atomic_fetch_add(&bench_sent, 1, __ATOMIC_RELAXED);
+		memset(packet->data, 0, 16);
+		memcpy(packet->data, &seq, sizeof(seq));
+		packet->id.pri = CSP_PRIO_NORM;
+		packet->id.flags = 0;
+		packet->id.src = BENCH_REMOTE + 1;
+		packet->id.dst = (bench_local) ? BENCH_ADDRESS : BENCH_REMOTE;
+		packet->id.dport = BENCH_PORT + ((bench_local) ? flow : 0);
+		packet->id.sport = 32 + flow;
+		packet->length = 16;
+		csp_qfifo_write(packet, &bench_if_in, NULL);
+	}
+
+	return CSP_TASK_RETURN;
+}
+
+CSP_DEFINE_TASK(consumer_task) {
+
+	csp_socket_t * socket = (csp_socket_t *) param;
+
+	for (;;) {
+		csp_packet_t * packet = csp_recvfrom(socket, 100);
+		if (packet != NULL) {
+			__atomic_fetch_add(&bench_received, 1, __ATOMIC_RELAXED);
+			csp_buffer_free(packet);
+		}
+	}
+
+	return CSP_TASK_RETURN;
+}
+
+int main(int argc, char * argv[]) {
+
+	unsigned int shards = 1;
+	unsigned int producers = 4;
+	unsigned int seconds = 3;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:p:t:lch")) != -1) {
+		switch (opt) {
+			case 's':
+				shards = atoi(optarg);
+				break;
+			case 'p':
+				producers = atoi(optarg);
+				break;
+			case 't':
+				seconds = atoi(optarg);
+				break;
+			case 'l':
+				bench_local = 1;
+				break;
+			case 'c':
+				bench_if_in.cut_through = 1;
+				break;
+			default:
+				printf("Usage:\n"
+					   " -s <count>    number of router shards/tasks (default: 1)\n"
+					   " -p <count>    number of producers/flows (default: 4)\n"
+					   " -t <seconds>  duration (default: 3)\n"
+					   " -l            deliver locally (connection-less socket per flow), instead of forwarding\n"
+					   " -c            cut-through forwarding on the input interface, bypassing the router\n");
+				exit(1);
+				break;
+		}
+	}
+
+	csp_conf_t csp_conf;
+	csp_conf_get_defaults(&csp_conf);
+	csp_conf.address = BENCH_ADDRESS;
+	csp_conf.route_shards = shards;
+	csp_conf.buffers = 200;
+	csp_conf.fifo_length = 200;
+	csp_conf.conn_queue_length = 200;
+	int error = csp_init(&csp_conf);
+	if (error != CSP_ERR_NONE) {
+		csp_log_error("csp_init() failed, error: %d", error);
+		exit(1);
+	}
+
+	csp_iflist_add(&bench_if_in);
+	csp_iflist_add(&bench_if_out);
+	csp_route_set(BENCH_REMOTE, &bench_if_out, CSP_NO_VIA_ADDRESS);
+
+	if (bench_local) {
+		for (unsigned int i = 0; i < producers; ++i) {
+			csp_socket_t * socket = csp_socket(CSP_SO_CONN_LESS);
+			if ((socket == NULL) || (csp_bind(socket, BENCH_PORT + i) != CSP_ERR_NONE) ||
+				(csp_thread_create(consumer_task, "CONSUMER", 1000, socket, 0, NULL) != CSP_ERR_NONE)) {
+				csp_log_error("bench: failed to create consumer %u", i);
+				exit(1);
+			}
+		}
+	}
+
+	csp_route_start_task(1000, 0);
+
+	bench_running = true;
+	for (unsigned int i = 0; i < producers; ++i) {
+		if (csp_thread_create(producer_task, "PRODUCER", 1000, (void *) (uintptr_t) i, 0, NULL) != CSP_ERR_NONE) {
+			csp_log_error("bench: failed to create producer %u", i);
+			exit(1);
+		}
+	}
+
+	const uint32_t start = csp_get_ms();
+	csp_sleep_ms(seconds * 1000);
+	const uint32_t received = __atomic_load_n(&bench_received, __ATOMIC_RELAXED);
+	const uint32_t elapsed = csp_get_ms() - start;
+	bench_running = false;
+
+	csp_route_stats_t stats;
+	csp_route_get_stats(&stats);
+	printf("%s, shards: %u, producers: %u, packets/sec: %10.0f, packets/wakeup: %4.1f, dropped: %"PRIu32"\r\n",
+		   (bench_local) ? "local" : ((bench_if_in.cut_through) ? "cut-through" : "forward"), shards, producers,
+		   (elapsed) ? (received * 1000.0 / elapsed) : 0,
+		   (stats.wakeups) ? ((double) stats.packets / stats.wakeups) : 0,
+		   bench_if_in.drop);
+
+	return 0;
+}
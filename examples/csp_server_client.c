@@ -129,7 +129,7 @@ CSP_DEFINE_TASK(task_client) {
 		}
 
 		/* 3. Copy data to packet */
-		snprintf((char *) packet->data, csp_buffer_data_size(), "Hello World (%u)", ++count);
+		snprintf((char *) packet->data, csp_buffer_packet_data_size(packet), "Hello World (%u)", ++count);
 
 		/* 4. Set packet length */
 		packet->length = (strlen((char *) packet->data) + 1); /* include the 0 termination */
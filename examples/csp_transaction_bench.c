@@ -0,0 +1,149 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Local transaction benchmark.
+ * A client does csp_transaction() request/response to a server task on the same node, over the loopback interface.
+ * Measures the round-trip latency - by default with the loopback fast path (csp_if_lo.cut_through), delivering packets
+ * directly in the sending task, or through the router task (-r).
+ */
+
+#include <csp/csp.h>
+#include <csp/csp_debug.h>
+#include <csp/interfaces/csp_if_lo.h>
+#include <csp/arch/csp_thread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "csp_bench.h"
+
+#define BENCH_PORT 10
+
+CSP_DEFINE_TASK(server_task) {
+
+	csp_socket_t * socket = (csp_socket_t *) param;
+
+	for (;;) {
+		csp_conn_t * conn = csp_accept(socket, CSP_MAX_TIMEOUT);
+		if (conn == NULL) {
+			continue;
+		}
+		csp_packet_t * packet;
+		while ((packet = csp_read(conn, 0)) != NULL) {
+			// echo request
+			if (!csp_send(conn, packet, 0)) {
+				csp_buffer_free(packet);
+			}
+		}
+		csp_close(conn);
+	}
+
+	return CSP_TASK_RETURN;
+}
+
+int main(int argc, char * argv[]) {
+
+	unsigned int transactions = 10000;
+	unsigned int size = 16;
+	int opt;
+	csp_if_lo.cut_through = 1;
+	while ((opt = getopt(argc, argv, "n:s:rh")) != -1) {
+		switch (opt) {
+			case 'n':
+				transactions = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg);
+				break;
+			case 'r':
+				csp_if_lo.cut_through = 0;
+				break;
+			default:
+				printf("Usage:\n"
+					   " -n <count>    number of transactions (default: 10000)\n"
+					   " -s <bytes>    request/response size, min 4 (default: 16)\n"
+					   " -r            route local packets through the router task, instead of the loopback fast path\n");
+				exit(1);
+				break;
+		}
+	}
+	if (size < sizeof(uint32_t)) {
+		size = sizeof(uint32_t);
+	}
+
+	csp_conf_t csp_conf;
+	csp_conf_get_defaults(&csp_conf);
+	csp_conf.address = 1;
+	csp_conf.buffer_data_size = (size > csp_conf.buffer_data_size) ? size : csp_conf.buffer_data_size;
+	int error = csp_init(&csp_conf);
+	if (error != CSP_ERR_NONE) {
+		csp_log_error("csp_init() failed, error: %d", error);
+		exit(1);
+	}
+	csp_route_start_task(1000, 0);
+
+	csp_socket_t * socket = csp_socket(CSP_SO_NONE);
+	if ((socket == NULL) || (csp_bind(socket, BENCH_PORT) != CSP_ERR_NONE) || (csp_listen(socket, 10) != CSP_ERR_NONE) ||
+		(csp_thread_create(server_task, "SERVER", 1000, socket, 0, NULL) != CSP_ERR_NONE)) {
+		csp_log_error("bench: failed to create server");
+		exit(1);
+	}
+
+	uint8_t * request = calloc(2, size);
+	if (request == NULL) {
+		exit(1);
+	}
+	uint8_t * reply = request + size;
+
+	double min = 0;
+	double max = 0;
+	double total = 0;
+	unsigned int failed = 0;
+	for (uint32_t i = 0; i < transactions; ++i) {
+		// unique payload, so requests are not discarded as duplicates (dedup)
+		memcpy(request, &i, sizeof(i));
+		const uint64_t start = bench_now_ns();
+		const int result = csp_transaction(CSP_PRIO_NORM, csp_conf.address, BENCH_PORT, 1000, request, size, reply, size);
+		const double latency = (bench_now_ns() - start) / 1000.0;
+		if ((result != (int) size) || (memcmp(request, reply, size) != 0)) {
+			++failed;
+			continue;
+		}
+		if ((latency < min) || (min == 0)) {
+			min = latency;
+		}
+		if (latency > max) {
+			max = latency;
+		}
+		total += latency;
+	}
+	const unsigned int completed = transactions - failed;
+
+	printf("%s, transactions: %u, size: %u, latency us avg: %8.1f, min: %8.1f, max: %8.1f, failed: %u\r\n",
+		   (csp_if_lo.cut_through) ? "fast path" : "router", transactions, size,
+		   (completed) ? (total / completed) : 0, min, max, failed);
+
+	free(request);
+
+	return 0;
+}
@@ -54,6 +54,39 @@ void * csp_calloc(size_t nmemb, size_t size);
 */
 void csp_free(void * ptr);
 
+/**
+   @defgroup CSP_MALLOC_POOL Pool memory options.
+   Options for csp_malloc_pool(), also used for reporting the obtained options.
+   @{
+*/
+/** Back memory by huge pages. POSIX: explicit huge pages (MAP_HUGETLB) if available. */
+#define CSP_MALLOC_POOL_HUGEPAGES	0x01
+/** Back memory by transparent huge pages (reported only), used when explicit huge pages aren't available. */
+#define CSP_MALLOC_POOL_THP		0x02
+/** Touch all pages at allocation, so they are mapped before use. */
+#define CSP_MALLOC_POOL_PREFAULT	0x04
+/** Lock pages in memory, so they are never paged out. */
+#define CSP_MALLOC_POOL_LOCK		0x08
+/** @} */
+
+/**
+   Allocate (large) chunk of memory for a pool.
+   The memory is allocated once at init and kept while running. Options not supported by the platform are ignored.
+   @param[in] size size of memory chunk (bytes).
+   @param[in] options requested options, see @ref CSP_MALLOC_POOL.
+   @param[out] obtained options actually obtained, see @ref CSP_MALLOC_POOL.
+   @return Pointer to allocated memory, or NULL on failure.
+*/
+void * csp_malloc_pool(size_t size, unsigned int options, unsigned int * obtained);
+
+/**
+   Free memory allocated by csp_malloc_pool().
+   @param[in] ptr memory to free. NULL pointer is ignored.
+   @param[in] size size of memory chunk (bytes), same as passed to csp_malloc_pool().
+   @param[in] obtained options obtained by csp_malloc_pool().
+*/
+void csp_free_pool(void * ptr, size_t size, unsigned int obtained);
+
 #ifdef __cplusplus
 }
 #endif
@@ -64,6 +64,24 @@ typedef void * csp_queue_handle_t;
 */
 csp_queue_handle_t csp_queue_create(int length, size_t item_size);
 
+/**
+   Max number of priorities in a queue.
+*/
+#define CSP_QUEUE_PRIO_MAX 32
+
+/**
+   Create queue with priorities.
+   Elements are enqueued at a priority, and dequeued highest priority (lowest number) first - FIFO within each priority.
+   Each priority has room for \a length elements, and all priorities share a single wait object, so a dequeue
+   waits once and takes the first element of the highest priority holding elements. All dequeue functions,
+   csp_queue_size() and csp_queue_fd() work on the queue as a whole, and csp_queue_enqueue() / csp_queue_enqueue_n() enqueue at priority 0.
+   @param[in] length max length of each priority, number of elements.
+   @param[in] item_size size of queue elements (bytes).
+   @param[in] prios number of priorities, 1 - #CSP_QUEUE_PRIO_MAX.
+   @return Create queue on success, otherwise NULL.
+*/
+csp_queue_handle_t csp_queue_create_prio(int length, size_t item_size, unsigned int prios);
+
 /**
    Remove/delete queue.
    @param[in] queue queue.
@@ -88,6 +106,50 @@ int csp_queue_enqueue(csp_queue_handle_t handle, const void *value, uint32_t tim
 */
 int csp_queue_enqueue_isr(csp_queue_handle_t handle, const void * value, CSP_BASE_TYPE * pxTaskWoken);
 
+/**
+   Enqueue (back) value at priority.
+   @param[in] handle queue, created with csp_queue_create_prio().
+   @param[in] value value to add (by copy)
+   @param[in] prio priority, 0 is highest.
+   @param[in] timeout timeout, time to wait for free space at the priority
+   @return #CSP_QUEUE_OK on success, otherwise a queue error code.
+*/
+int csp_queue_enqueue_prio(csp_queue_handle_t handle, const void * value, unsigned int prio, uint32_t timeout);
+
+/**
+   Enqueue (back) value at priority from ISR.
+   @param[in] handle queue, created with csp_queue_create_prio().
+   @param[in] value value to add (by copy)
+   @param[in] prio priority, 0 is highest.
+   @param[out] pxTaskWoken Valid reference if called from ISR, otherwise NULL!
+   @return #CSP_QUEUE_OK on success, otherwise a queue error code.
+*/
+int csp_queue_enqueue_prio_isr(csp_queue_handle_t handle, const void * value, unsigned int prio, CSP_BASE_TYPE * pxTaskWoken);
+
+/**
+   Enqueue (back) multiple values.
+   Waits for free space, and then enqueues as many values as there is room for - on POSIX and Windows under a single lock and with a single wakeup of waiting tasks.
+   On FreeRTOS, one value is enqueued per call.
+   @param[in] handle queue.
+   @param[in] values values to add (by copy), array of \a count elements.
+   @param[in] count number of values.
+   @param[in] timeout timeout, time to wait for free space (for the first value)
+   @return number of values enqueued, 0 if the queue stayed full.
+*/
+int csp_queue_enqueue_n(csp_queue_handle_t handle, const void * values, unsigned int count, uint32_t timeout);
+
+/**
+   Enqueue (back) multiple values at priority.
+   Same as csp_queue_enqueue_n(), but at priority \a prio.
+   @param[in] handle queue, created with csp_queue_create_prio().
+   @param[in] values values to add (by copy), array of \a count elements.
+   @param[in] count number of values.
+   @param[in] prio priority, 0 is highest.
+   @param[in] timeout timeout, time to wait for free space at the priority (for the first value)
+   @return number of values enqueued, 0 if the queue stayed full.
+*/
+int csp_queue_enqueue_prio_n(csp_queue_handle_t handle, const void * values, unsigned int count, unsigned int prio, uint32_t timeout);
+
 /**
    Dequeue value (front).
    @param[in] handle queue.
@@ -106,6 +168,18 @@ int csp_queue_dequeue(csp_queue_handle_t handle, void *buf, uint32_t timeout);
 */
 int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, CSP_BASE_TYPE * pxTaskWoken);
 
+/**
+   Dequeue multiple values (front).
+   Waits for an element, and then dequeues up to \a count elements - on POSIX and Windows under a single lock and with a single wakeup of waiting tasks.
+   On FreeRTOS, one element is dequeued per call.
+   @param[in] handle queue.
+   @param[out] buf extracted elements (by copy), room for \a count elements.
+   @param[in] count max number of elements to extract.
+   @param[in] timeout timeout, time to wait for element in queue.
+   @return number of elements extracted, 0 if the queue stayed empty.
+*/
+int csp_queue_dequeue_n(csp_queue_handle_t handle, void * buf, unsigned int count, uint32_t timeout);
+
 /**
    Queue size.
    @param[in] handle queue.
@@ -120,6 +194,15 @@ int csp_queue_size(csp_queue_handle_t handle);
 */
 int csp_queue_size_isr(csp_queue_handle_t handle);
 
+/**
+   Return file descriptor for waiting on the queue with poll()/select()/epoll (Linux only).
+   The descriptor is created on the first call, and is readable while the queue contains elements - it may occasionally be readable
+   while the queue is empty, so dequeue with timeout 0. The descriptor is owned by the queue and closed when the queue is removed.
+   @param[in] handle queue.
+   @return file descriptor, or -1 if not supported.
+*/
+int csp_queue_fd(csp_queue_handle_t handle);
+
 #ifdef __cplusplus
 }
 #endif
@@ -59,28 +59,55 @@ extern "C" {
 #define PTHREAD_QUEUE_OK CSP_QUEUE_OK
 /** @{ */
 
+/**
+   Max number of priorities.
+*/
+#define PTHREAD_QUEUE_PRIO_MAX 32
+
+/**
+   Priority level of a queue.
+*/
+typedef struct pthread_queue_level_s {
+    //! Items/elements at this priority.
+    int items;
+    //! Insert point.
+    int in;
+    //! Extract point.
+    int out;
+} pthread_queue_level_t;
+
 /**
    Queue handle.
 */
 typedef struct pthread_queue_s {
-    //! Memory area.
+    //! Memory area (a ring per priority).
     void * buffer;
-    //! Memory size.
+    //! Memory size (per priority).
     int size;
     //! Item/element size.
     int item_size;
-    //! Items/elements in queue.
+    //! Items/elements in queue (all priorities).
     int items;
-    //! Insert point.
-    int in;
-    //! Extract point.
-    int out;
+    //! Number of priorities.
+    unsigned int prios;
+    //! Bitmap of priorities with items/elements.
+    uint32_t nonempty;
     //! Lock.
     pthread_mutex_t mutex;
     //! Wait because queue is full (insert).
     pthread_cond_t cond_full;
     //! Wait because queue is empty (extract).
     pthread_cond_t cond_empty;
+    //! Number of threads waiting for room (insert).
+    int full_waiters;
+    //! Number of threads waiting for elements (extract).
+    int empty_waiters;
+    //! Readiness file descriptor (eventfd), -1 until requested.
+    int fd;
+    //! Readiness file descriptor is signalled.
+    int fd_signalled;
+    //! Priority levels.
+    pthread_queue_level_t levels[];
 } pthread_queue_t;
 
 /**
@@ -88,6 +115,11 @@ typedef struct pthread_queue_s {
 */
 pthread_queue_t * pthread_queue_create(int length, size_t item_size);
 
+/**
+   Create queue with priorities, \a length elements per priority.
+*/
+pthread_queue_t * pthread_queue_create_prio(int length, size_t item_size, unsigned int prios);
+
 /**
    Delete queue.
 */
@@ -98,16 +130,41 @@ void pthread_queue_delete(pthread_queue_t * q);
 */
 int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t timeout);
 
+/**
+   Enqueue/insert element at priority (0 is highest).
+*/
+int pthread_queue_enqueue_prio(pthread_queue_t * queue, const void * value, unsigned int prio, uint32_t timeout);
+
+/**
+   Enqueue/insert multiple elements, returns number of elements inserted.
+*/
+int pthread_queue_enqueue_n(pthread_queue_t * queue, const void * values, unsigned int count, uint32_t timeout);
+
+/**
+   Enqueue/insert multiple elements at priority (0 is highest), returns number of elements inserted.
+*/
+int pthread_queue_enqueue_prio_n(pthread_queue_t * queue, const void * values, unsigned int count, unsigned int prio, uint32_t timeout);
+
 /**
    Dequeue/extract element.
 */
 int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout);
 
+/**
+   Dequeue/extract multiple elements, returns number of elements extracted.
+*/
+int pthread_queue_dequeue_n(pthread_queue_t * queue, void * buf, unsigned int count, uint32_t timeout);
+
 /**
    Return number of elements in the queue.
 */
 int pthread_queue_items(pthread_queue_t * queue);
 
+/**
+   Return file descriptor (eventfd), readable while the queue contains elements.
+*/
+int pthread_queue_fd(pthread_queue_t * queue);
+
 #ifdef __cplusplus
 }
 #endif
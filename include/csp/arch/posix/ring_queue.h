@@ -0,0 +1,146 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk) 
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _RING_QUEUE_H_
+#define _RING_QUEUE_H_
+
+/**
+   @file
+
+   Lock-free bounded queue (ring), using futexes for blocking (Linux only).
+
+   Multiple producers and consumers are supported (bounded MPMC queue by Dmitry Vyukov): each slot has a sequence number,
+   telling whether it is ready for the next enqueue or dequeue, so producers and consumers only contend on their own position.
+   Blocked producers/consumers wait on an event count (futex), which is only signalled when someone is waiting.
+
+   A queue with priorities has a ring per priority, sharing the event counts; dequeue takes from the highest priority
+   ring holding an element.
+*/
+
+#include <csp/arch/csp_queue.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   Max number of priorities.
+*/
+#define RING_QUEUE_PRIO_MAX 32
+
+/**
+   Ring (one per priority).
+*/
+typedef struct ring_queue_ring_s {
+    //! Next position to dequeue (own cache line).
+    uint64_t head __attribute__((aligned(64)));
+    //! Next position to enqueue (own cache line).
+    uint64_t tail __attribute__((aligned(64)));
+    //! Slots.
+    char * slots;
+} ring_queue_ring_t;
+
+/**
+   Queue handle.
+*/
+typedef struct ring_queue_s {
+    //! Event count, bumped on enqueue when consumers are waiting (futex).
+    uint32_t not_empty __attribute__((aligned(64)));
+    //! Number of waiting consumers.
+    uint32_t empty_waiters;
+    //! Event count, bumped on dequeue when producers are waiting (futex).
+    uint32_t not_full;
+    //! Number of waiting producers.
+    uint32_t full_waiters;
+    //! Readiness file descriptor (eventfd), -1 until requested.
+    int fd;
+    //! Readiness file descriptor is signalled.
+    uint32_t fd_signalled;
+    //! Number of slots (per priority).
+    uint32_t size;
+    //! Item/element size.
+    uint32_t item_size;
+    //! Slot size (sequence number + item).
+    uint32_t slot_size;
+    //! Number of priorities.
+    uint32_t prios;
+    //! Rings, highest priority first.
+    ring_queue_ring_t rings[];
+} ring_queue_t;
+
+/**
+   Create queue.
+*/
+ring_queue_t * ring_queue_create(int length, size_t item_size);
+
+/**
+   Create queue with priorities, \a length elements per priority.
+*/
+ring_queue_t * ring_queue_create_prio(int length, size_t item_size, unsigned int prios);
+
+/**
+   Delete queue.
+*/
+void ring_queue_delete(ring_queue_t * q);
+
+/**
+   Enqueue/insert element.
+*/
+int ring_queue_enqueue(ring_queue_t * queue, const void * value, uint32_t timeout);
+
+/**
+   Enqueue/insert element at priority (0 is highest).
+*/
+int ring_queue_enqueue_prio(ring_queue_t * queue, const void * value, unsigned int prio, uint32_t timeout);
+
+/**
+   Enqueue/insert multiple elements, returns number of elements inserted.
+*/
+int ring_queue_enqueue_n(ring_queue_t * queue, const void * values, unsigned int count, uint32_t timeout);
+
+/**
+   Enqueue/insert multiple elements at priority (0 is highest), returns number of elements inserted.
+*/
+int ring_queue_enqueue_prio_n(ring_queue_t * queue, const void * values, unsigned int count, unsigned int prio, uint32_t timeout);
+
+/**
+   Dequeue/extract element.
+*/
+int ring_queue_dequeue(ring_queue_t * queue, void * buf, uint32_t timeout);
+
+/**
+   Dequeue/extract multiple elements, returns number of elements extracted.
+*/
+int ring_queue_dequeue_n(ring_queue_t * queue, void * buf, unsigned int count, uint32_t timeout);
+
+/**
+   Return number of elements in the queue.
+*/
+int ring_queue_items(ring_queue_t * queue);
+
+/**
+   Return file descriptor (eventfd), readable while the queue contains elements.
+*/
+int ring_queue_fd(ring_queue_t * queue);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
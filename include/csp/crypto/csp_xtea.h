@@ -32,6 +32,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 extern "C" {
 #endif
 
+/**
+   Number of bytes of the nonce, that is appended to the encrypted CSP message.
+*/
+#define CSP_XTEA_NONCE_LENGTH	4
+
 /**
    Set XTEA key
    @param[in] key XTEA key
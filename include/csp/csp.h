@@ -34,6 +34,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/csp_iflist.h>
 #include <csp/csp_sfp.h>
 #include <csp/csp_promisc.h>
+#include <csp/csp_poll.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -54,10 +55,19 @@ typedef struct csp_conf_s {
 	uint8_t conn_max;		/**< Max number of connections. A fixed connection array is allocated by csp_init() */
 	uint8_t conn_queue_length;	/**< Max queue length (max queued Rx messages). */
 	uint8_t fifo_length;		/**< Length of incoming message queue, used for handover to router task. */
+	uint8_t route_shards;		/**< Number of router tasks started by csp_route_start_task(), max #CSP_ROUTE_SHARDS_MAX. Incoming packets are steered to a task by a hash of (src, dst, sport, dport), so packets of a connection are handled by one task. 0 or 1 for a single router task */
+	uint8_t route_batch;		/**< Max packets routed per call to csp_route_work() (router wakeup), max #CSP_ROUTE_BATCH_MAX. 0 or 1 routes a single packet per call */
 	uint8_t port_max_bind;		/**< Max/highest port for use with csp_bind() */
 	uint8_t rdp_max_window;		/**< Max RDP window size */
 	uint16_t buffers;		/**< Number of CSP buffers */
 	uint16_t buffer_data_size;	/**< Data size of a CSP buffer. Total size will be sizeof(#csp_packet_t) + data_size. */
+	const csp_buffer_class_t * buffer_classes; /**< Buffer size classes, sorted by increasing data size. If NULL, a single class is created from buffers and buffer_data_size */
+	uint8_t buffer_class_count;	/**< Number of buffer size classes, max #CSP_BUFFER_CLASS_MAX */
+	uint16_t buffer_magazine_size;	/**< Number of free buffers cached per thread, 0 disables caching. Max #CSP_BUFFER_MAGAZINE_MAX, only supported on POSIX and Mac OS X. */
+	uint16_t buffer_headroom;	/**< Bytes reserved in front of each packet for lower layer headers, see csp_buffer_push() */
+	uint16_t buffer_tailroom;	/**< Bytes reserved after the data of each packet for trailers (CRC32, HMAC, ...), see csp_buffer_put() */
+	uint16_t buffer_reserve[CSP_PRIORITIES]; /**< Free buffers reserved for higher priorities, i.e. buffer_reserve[prio] buffers are left free when allocating at priority prio, see csp_buffer_get_prio() */
+	uint8_t buffer_memory;		/**< Buffer pool memory options (huge pages, prefault, lock), see #CSP_MALLOC_POOL_HUGEPAGES etc. and csp_buffer_memory() */
 	uint32_t conn_dfl_so;		/**< Default connection options. Options will always be or'ed onto new connections, see csp_connect() */
 } csp_conf_t;
 
@@ -72,10 +82,21 @@ static inline void csp_conf_get_defaults(csp_conf_t * conf) {
 	conf->conn_max = 10;
 	conf->conn_queue_length = 10;
 	conf->fifo_length = 25;
+	conf->route_shards = 1;
+	conf->route_batch = 8;
 	conf->port_max_bind = 24;
 	conf->rdp_max_window = 20;
 	conf->buffers = 10;
 	conf->buffer_data_size = 256;
+	conf->buffer_classes = NULL;
+	conf->buffer_class_count = 0;
+	conf->buffer_magazine_size = 0;
+	conf->buffer_headroom = 0;
+	conf->buffer_tailroom = 0;
+	conf->buffer_memory = 0;
+	for (unsigned int i = 0; i < CSP_PRIORITIES; ++i) {
+		conf->buffer_reserve[i] = 0;
+	}
 	conf->conn_dfl_so = CSP_O_NONE;
 }
 
@@ -129,6 +150,18 @@ csp_conn_t *csp_accept(csp_socket_t *socket, uint32_t timeout);
 */
 csp_packet_t *csp_read(csp_conn_t *conn, uint32_t timeout);
 
+/**
+   Read multiple packets from a connection.
+   This fuction will wait on the connection's RX queue for the specified timeout, and then return up to \a count packets already received,
+   taking the queue lock only once (on POSIX).
+   @param[in] conn connection
+   @param[out] packets returned packets, must be freed by the caller.
+   @param[in] count max number of packets to read (size of \a packets).
+   @param[in] timeout timeout in mS to wait for the first packet, use #CSP_MAX_TIMEOUT for infinite timeout.
+   @return Number of packets read, 0 in case of failure or timeout.
+*/
+int csp_read_n(csp_conn_t *conn, csp_packet_t ** packets, unsigned int count, uint32_t timeout);
+
 /**
    Send packet on a connection.
    @param[in] conn connection
@@ -284,6 +317,60 @@ int csp_conn_src(csp_conn_t *conn);
 */
 int csp_conn_flags(csp_conn_t *conn);
 
+/**
+   Set active queue management (CoDel) of the connection's RX queue.
+   Packets are time stamped when queued, and packets that have been queued for too long are dropped by csp_read() and
+   csp_read_n(), so a slow reader gets recent packets (e.g. telemetry) instead of a full queue of old ones.
+   Packets queued before CoDel is enabled are not time stamped - enable it right after csp_connect() or csp_accept().
+   @param[in] conn connection
+   @param[in] conf parameters, NULL or target 0 disables CoDel (default)
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOTSUP for RDP connections (received packets are already acknowledged), otherwise an error code.
+*/
+int csp_conn_set_codel(csp_conn_t *conn, const csp_codel_conf_t *conf);
+
+/**
+   Return number of packets dropped by active queue management (CoDel) on the connection's RX queue.
+   @param[in] conn connection
+   @return dropped packets, see csp_conn_set_codel()
+*/
+uint32_t csp_conn_codel_drops(csp_conn_t *conn);
+
+/**
+   Set the time-to-live of packets sent on the connection.
+   csp_send() sets the deadline of packets without one (see csp_buffer_set_deadline()) to \a ttl mS from now, so packets
+   still queued (router, interface, RDP retransmission, receiver's connection RX queue on loopback) when it passes are
+   discarded. As RDP must deliver all data in order, an RDP connection is reset if a packet expires before it is acknowledged.
+   @param[in] conn connection
+   @param[in] ttl time-to-live (mS), 0 for none (default)
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_conn_set_ttl(csp_conn_t *conn, uint32_t ttl);
+
+/**
+   Return number of packets discarded past their deadline on the connection - sending, reading or retransmitting (RDP).
+   @param[in] conn connection
+   @return discarded packets, see csp_conn_set_ttl() and csp_buffer_set_deadline()
+*/
+uint32_t csp_conn_expired_drops(csp_conn_t *conn);
+
+/**
+   Return file descriptor for waiting on packets with poll()/select()/epoll (Linux only).
+   The descriptor is readable when the connection has received packets, which are then read with csp_read() with timeout 0.
+   It belongs to the connection's RX queue: don't close it, and remove it from any poll set before calling csp_close().
+   @param[in] conn connection
+   @return file descriptor on success, otherwise an error code (#CSP_ERR_NOTSUP if not supported).
+*/
+int csp_conn_fd(csp_conn_t *conn);
+
+/**
+   Return file descriptor for waiting on a socket with poll()/select()/epoll (Linux only).
+   The descriptor is readable when there are new connections for csp_accept(), or packets for csp_recvfrom() on a connection-less socket -
+   call these with timeout 0. The socket must be listening (see csp_listen()) or connection-less. Don't close the descriptor.
+   @param[in] socket socket
+   @return file descriptor on success, otherwise an error code (#CSP_ERR_NOTSUP if not supported).
+*/
+int csp_socket_fd(csp_socket_t *socket);
+
 /**
    Set socket to listen for incoming connections.
    @param[in] socket socket
@@ -301,8 +388,8 @@ int csp_listen(csp_socket_t *socket, size_t backlog);
 int csp_bind(csp_socket_t *socket, uint8_t port);
 
 /**
-   Start the router task.
-   The router task calls csp_route_work() to do the actual work.
+   Start the router task(s).
+   The router task calls csp_route_work() to do the actual work - with csp_conf_t.route_shards > 1, a task is started per shard, calling csp_route_work_shard().
    @param[in] task_stack_size stack size for the task, see csp_thread_create() for details on the stack size parameter.
    @param[in] task_priority priority for the task, see csp_thread_create() for details on the stack size parameter.
    @return #CSP_ERR_NONE on success, otherwise an error code.
@@ -312,20 +399,48 @@ int csp_route_start_task(unsigned int task_stack_size, unsigned int task_priorit
 /**
    Route packet from the incoming router queue and check RDP timeouts.
    In order for incoming packets to routed and RDP timeouts to be checked, this function must be called reguarly.
+   Up to csp_conf_t.route_batch packets are routed per call, checking RDP timeouts once - packets to the same connection are enqueued together.
+   RDP timeouts are scheduled per connection, so only expired timeouts are handled, and the call returns when the next is due.
    If the router task is started by calling csp_route_start_task(), there function should not be called.
-   @param[in] timeout timeout in mS to wait for an incoming packet.
+   @param[in] timeout timeout in mS to wait for an incoming packet, limited to the next RDP timeout. The router task uses #CSP_MAX_TIMEOUT.
    @return #CSP_ERR_NONE on success, otherwise an error code.
 */
 int csp_route_work(uint32_t timeout);
 
+/**
+   Route packets from the incoming router queue of a shard and check RDP timeouts of its connections.
+   Same as csp_route_work(), which routes shard 0. With csp_conf_t.route_shards > 1, this function must be called for every shard -
+   each shard by a single task.
+   @param[in] shard router shard, 0 to csp_conf_t.route_shards - 1.
+   @param[in] timeout timeout in mS to wait for an incoming packet.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_route_work_shard(unsigned int shard, uint32_t timeout);
+
+/**
+   Router statistics, see csp_route_get_stats().
+*/
+typedef struct {
+	uint32_t wakeups;	/**< Number of router wakeups (csp_route_work() calls) with packets */
+	uint32_t packets;	/**< Number of packets routed - packets per wakeup is packets / wakeups */
+	uint32_t max_batch;	/**< Max packets routed in a single wakeup */
+} csp_route_stats_t;
+
+/**
+   Get router statistics.
+   @param[out] stats statistics since start.
+*/
+void csp_route_get_stats(csp_route_stats_t * stats);
+
 /**
    Start the bridge task.
    The bridge will copy packets between interfaces, i.e. packets received on A will be sent on B, and vice versa.
+   The bridge reads the router input queue, so it requires a single router shard (csp_conf_t.route_shards <= 1).
    @param[in] task_stack_size stack size for the task, see csp_thread_create() for details on the stack size parameter.
    @param[in] task_priority priority for the task, see csp_thread_create() for details on the stack size parameter.
    @param[in] if_a interface/side A
    @param[in] if_b interface/side B
-   @return #CSP_ERR_NONE on success, otherwise an error code.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL with more than one router shard, otherwise an error code.
 */
 int csp_bridge_start(unsigned int task_stack_size, unsigned int task_priority, csp_iface_t * if_a, csp_iface_t * if_b);
 
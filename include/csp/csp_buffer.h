@@ -32,14 +32,90 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 extern "C" {
 #endif
 
+/**
+   Max number of buffers cached per thread, see csp_conf_t.buffer_magazine_size.
+*/
+#ifndef CSP_BUFFER_MAGAZINE_MAX
+#define CSP_BUFFER_MAGAZINE_MAX 32
+#endif
+
+/**
+   Max number of buffer size classes, see csp_conf_t.buffer_classes.
+*/
+#ifndef CSP_BUFFER_CLASS_MAX
+#define CSP_BUFFER_CLASS_MAX 4
+#endif
+
+/**
+   Buffer size class.
+   Buffers of different data sizes can be allocated by csp_init(), so small packets (e.g. RDP control packets)
+   don't use the same amount of memory as large packets.
+   @see csp_conf_t.buffer_classes
+*/
+typedef struct {
+	uint16_t data_size;	/**< Data size of buffers in this class. */
+	uint16_t buffers;	/**< Number of buffers in this class. */
+} csp_buffer_class_t;
+
 /**
    Get free buffer (from task context).
+   The buffer is taken from the smallest size class that can hold \a data_size plus the headers and trailers added when sending
+   (SFP, RDP, XTEA, HMAC, CRC32) not covered by #csp_conf_t.buffer_tailroom - or the largest class, if only that can hold \a data_size. If that class is empty, the next larger class is tried.
 
    @param[in] data_size minimum data size of requested buffer.
    @return Buffer (pointer to #csp_packet_t) or NULL if no buffers available or size too big.
 */
 void * csp_buffer_get(size_t data_size);
 
+/**
+   Get free buffer, waiting if no buffers are available (from task context).
+   Waiting tasks are served in FIFO order: buffers freed by csp_buffer_free() (task context) are handed directly to the first
+   waiting task, and a task can't get a buffer ahead of tasks already waiting. Buffers freed by csp_buffer_free_isr() wake the first
+   waiting task, which hands them over from task context.
+
+   @param[in] data_size minimum data size of requested buffer.
+   @param[in] timeout max time to wait for a buffer (mS), 0 doesn't wait.
+   @return Buffer (pointer to #csp_packet_t) or NULL on timeout or size too big.
+*/
+void * csp_buffer_get_timeout(size_t data_size, uint32_t timeout);
+
+/**
+   Get free buffer for a given priority, waiting if no buffers are available (from task context).
+   Priority reservations (csp_conf_t.buffer_reserve) are respected, i.e. the allocation fails (or waits) if it would leave fewer
+   than csp_conf_t.buffer_reserve[\a prio] free buffers for higher priorities. csp_buffer_get() and csp_buffer_get_timeout() allocate
+   at #CSP_PRIO_NORM, csp_buffer_get_isr() ignores reservations.
+
+   @param[in] data_size minimum data size of requested buffer.
+   @param[in] prio priority, see #csp_prio_t.
+   @param[in] timeout max time to wait for a buffer (mS), 0 doesn't wait.
+   @return Buffer (pointer to #csp_packet_t) or NULL on timeout or size too big.
+*/
+void * csp_buffer_get_prio(size_t data_size, uint8_t prio, uint32_t timeout);
+
+/**
+   Return number of allocations refused by priority reservations.
+   @param[in] prio priority, see #csp_prio_t.
+   @return number of allocations at \a prio refused, because the remaining buffers were reserved for higher priorities.
+*/
+uint32_t csp_buffer_limited(uint8_t prio);
+
+/**
+   Low watermark callback, see csp_buffer_set_watermark().
+   @param[in] low true if the number of free buffers dropped to the watermark, false if it rose above the watermark again.
+   @param[in] remaining number of free buffers.
+*/
+typedef void (*csp_buffer_watermark_callback_t)(bool low, int remaining);
+
+/**
+   Set low watermark callback.
+   The callback is called (from the task getting or freeing a buffer) when the number of free buffers drops to \a low, and again
+   when it rises above \a low. Buffers cached in per-thread magazines are not counted as free.
+
+   @param[in] low watermark, number of free buffers.
+   @param[in] callback callback, NULL disables the callback.
+*/
+void csp_buffer_set_watermark(int low, csp_buffer_watermark_callback_t callback);
+
 /**
    Get free buffer (from ISR context).
 
@@ -50,19 +126,90 @@ void * csp_buffer_get_isr(size_t data_size);
 
 /**
    Free buffer (from task context).
+   If \a buffer is the first segment of a chain, the entire chain is freed.
    @param[in] buffer buffer to free. NULL is handled gracefully.
 */
 void csp_buffer_free(void *buffer);
 
+/**
+   Get multiple buffers.
+   The buffers are taken from the pool in batches, i.e. with fewer synchronization operations than calling csp_buffer_get() \a count times.
+   @param[in] data_size minimum data size of the buffers.
+   @param[out] buffers allocated buffers.
+   @param[in] count number of buffers to get.
+   @return number of buffers allocated, less than \a count if the pool ran out of buffers.
+*/
+unsigned int csp_buffer_get_n(size_t data_size, void * buffers[], unsigned int count);
+
+/**
+   Free multiple buffers.
+   Same as calling csp_buffer_free() for each buffer, but buffers are returned to the pool in batches.
+   @param[in] buffers buffers to free. NULL entries are ignored.
+   @param[in] count number of buffers.
+*/
+void csp_buffer_free_n(void * buffers[], unsigned int count);
+
 /**
    Free buffer (from ISR context).
+   If \a buffer is the first segment of a chain, the entire chain is freed. If tasks are waiting for a buffer (see csp_buffer_get_timeout()),
+   the first is woken.
    @param[in] buffer buffer to free. NULL is handled gracefully.
 */
 void csp_buffer_free_isr(void *buffer);
 
+/**
+   Take a reference to a buffer.
+   The buffer is shared until all references are released with csp_buffer_free(). A shared buffer must not be modified, use
+   csp_buffer_unshare() to get a private copy before modifying it.
+   @param[in] buffer buffer to reference.
+   @return \a buffer, or NULL if \a buffer isn't a valid (allocated) buffer.
+*/
+void * csp_buffer_ref(void *buffer);
+
+/**
+   Set the time a packet expires.
+   The deadline is kept with the buffer (not sent), and a packet past its deadline is discarded instead of being routed,
+   transmitted, (re)transmitted by RDP or returned by csp_read() - see csp_conn_set_ttl() for setting it per connection.
+   Clones get the same deadline.
+   @param[in] buffer packet.
+   @param[in] deadline time (mS, see csp_get_ms()) the packet expires, 0 for no deadline (default).
+*/
+void csp_buffer_set_deadline(void *buffer, uint32_t deadline);
+
+/**
+   Return the time a packet expires.
+   @param[in] buffer packet.
+   @return deadline (mS), 0 if none - see csp_buffer_set_deadline().
+*/
+uint32_t csp_buffer_deadline(const void *buffer);
+
+/**
+   Check if a packet has expired.
+   @param[in] buffer packet.
+   @param[in] now current time (mS), see csp_get_ms().
+   @return true if the packet has a deadline, which has passed.
+*/
+bool csp_buffer_expired(const void *buffer, uint32_t now);
+
+/**
+   Return number of references to a buffer.
+   @param[in] buffer buffer.
+   @return number of references, 0 if the buffer is free.
+*/
+unsigned int csp_buffer_refcount(const void *buffer);
+
+/**
+   Get a private (writable) buffer - copy-on-write.
+   If \a buffer is shared, a copy is made and the reference to \a buffer is released, otherwise \a buffer is returned.
+   @param[in] buffer buffer.
+   @return private buffer, or NULL if the copy failed - in which case the reference to \a buffer is kept.
+*/
+void * csp_buffer_unshare(void *buffer);
+
 /**
    Clone an existing buffer.
-   The existing \a buffer content is copied to the new buffer.
+   The existing \a buffer content (header and \a length bytes of data) is copied to the new buffer, which is allocated from the same size class (or larger).
+   If \a buffer is a chain, all segments are cloned.
    @param[in] buffer buffer to clone.
    @return cloned buffer on success, or NULL on failure.
 */
@@ -70,24 +217,141 @@ void * csp_buffer_clone(void *buffer);
 
 /**
    Return number of remaining/free buffers.
-   The number of buffers is set by csp_init().
+   The number of buffers is set by csp_init(). Buffers cached in per-thread magazines are counted as free.
    @return number of remaining/free buffers
 */
 int csp_buffer_remaining(void);
 
 /**
-   Return the size of a CSP buffer.
-   @return size of a CSP buffer, sizeof(#csp_packet_t) + data_size.
+   Return number of remaining/free buffers, which can hold \a data_size.
+   @param[in] data_size minimum data size.
+   @return number of remaining/free buffers
+*/
+int csp_buffer_remaining_size(size_t data_size);
+
+/**
+   Return the memory options obtained for the buffer pool.
+   Options are requested with csp_conf_t.buffer_memory, but may not all be available.
+   @return obtained options, see #CSP_MALLOC_POOL_HUGEPAGES etc.
+*/
+unsigned int csp_buffer_memory(void);
+
+/**
+   Return the size of the largest CSP buffer.
+   @return size of the largest CSP buffer, sizeof(#csp_packet_t) + data_size.
 */
 size_t csp_buffer_size(void);
 
 /**
-   Return the data size of a CSP buffer.
+   Return the data size of the largest CSP buffer.
    The data size is set by csp_init().
-   @return data size of a CSP buffer
+   @return data size of the largest CSP buffer
 */
 size_t csp_buffer_data_size(void);
 
+/**
+   Return the data size of a specific buffer.
+   Use this to check how much data can be added to a packet, e.g. before appending a trailer.
+   @param[in] packet buffer (pointer to #csp_packet_t).
+   @return data size of the buffer, or 0 if \a packet isn't a CSP buffer.
+*/
+size_t csp_buffer_packet_data_size(const void * packet);
+
+/**
+   Append a segment to a chained packet.
+   Chained packets can carry more data than fits in a single buffer. The first segment holds the CSP header (id), and the
+   total data is the data of all segments (in order), see csp_buffer_chain_length(). The chain takes ownership of
+   \a segment, which is freed when the first segment is freed. Interfaces not supporting chains (#csp_iface_t.chain_tx),
+   RDP, CRC32, HMAC and XTEA get a linearized copy of the packet, see csp_buffer_chain_linearize().
+
+   @param[in] packet first segment (or any segment) of the chain.
+   @param[in] segment segment to append, may itself be a chain.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_buffer_chain_append(csp_packet_t * packet, csp_packet_t * segment);
+
+/**
+   Return next segment in a chained packet.
+   @param[in] packet segment.
+   @return next segment, or NULL if \a packet is the last segment.
+*/
+csp_packet_t * csp_buffer_chain_next(const csp_packet_t * packet);
+
+/**
+   Return total data length of a chained packet.
+   @param[in] packet first segment.
+   @return sum of length of all segments.
+*/
+size_t csp_buffer_chain_length(const csp_packet_t * packet);
+
+/**
+   Copy data from a chained packet.
+   @param[in] packet first segment.
+   @param[in] offset offset (in total data) to start copying from.
+   @param[out] dst destination.
+   @param[in] length max number of bytes to copy.
+   @return number of bytes copied.
+*/
+size_t csp_buffer_chain_copy(const csp_packet_t * packet, size_t offset, void * dst, size_t length);
+
+/**
+   Copy a chained packet to a single buffer.
+   @param[in] packet first segment.
+   @return new buffer (not chained), or NULL if no buffer is large enough for the total data.
+*/
+csp_packet_t * csp_buffer_chain_linearize(const csp_packet_t * packet);
+
+/**
+   Add data in front of the packet identifier (csp_packet_t.id), e.g. a lower layer header.
+   Pushed data ends at csp_packet_t.id, so a frame can be sent from the returned pointer without copying. The headroom is
+   #csp_conf_t.buffer_headroom plus the padding and csp_packet_t.length - read the length before pushing, it is restored
+   when all pushed data is pulled again. Pushed data is not part of csp_packet_t.length, and is lost if the packet is cloned.
+   A packet shared by reference (see csp_buffer_ref()) can't be pushed, as all references would see the changes.
+   @param[in] packet packet.
+   @param[in] len number of bytes to add.
+   @return pointer to the start of the added data (also start of previously pushed data), or NULL if there isn't enough headroom or the packet is shared.
+*/
+void * csp_buffer_push(csp_packet_t * packet, size_t len);
+
+/**
+   Remove data pushed in front of the packet, see csp_buffer_push().
+   @param[in] packet packet.
+   @param[in] len number of bytes to remove.
+   @return pointer to the start of the remaining pushed data (csp_packet_t.id if all is removed), or NULL if \a len exceeds the pushed data.
+*/
+void * csp_buffer_pull(csp_packet_t * packet, size_t len);
+
+/**
+   Return number of bytes available in front of the packet, see csp_buffer_push().
+   @param[in] packet packet.
+   @return available headroom.
+*/
+size_t csp_buffer_headroom(const csp_packet_t * packet);
+
+/**
+   Add data at the end of the packet data, e.g. a trailer.
+   The packet data can extend into the tailroom reserved by #csp_conf_t.buffer_tailroom.
+   @param[in] packet packet.
+   @param[in] len number of bytes to add, csp_packet_t.length is incremented by \a len.
+   @return pointer to the added data, or NULL if there isn't enough room.
+*/
+void * csp_buffer_put(csp_packet_t * packet, size_t len);
+
+/**
+   Remove data from the end of the packet data, e.g. a trailer.
+   @param[in] packet packet.
+   @param[in] len number of bytes to remove, csp_packet_t.length is decremented by \a len.
+   @return pointer to the removed data (still valid), or NULL if csp_packet_t.length is less than \a len.
+*/
+void * csp_buffer_trim(csp_packet_t * packet, size_t len);
+
+/**
+   Return number of bytes which can be added to the packet data, see csp_buffer_put().
+   @param[in] packet packet.
+   @return available tailroom, 0 if \a packet isn't a CSP buffer.
+*/
+size_t csp_buffer_tailroom(const csp_packet_t * packet);
+
 #ifdef __cplusplus
 }
 #endif
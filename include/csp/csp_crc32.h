@@ -32,6 +32,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 extern "C" {
 #endif
 
+/**
+   Number of bytes of the CRC32 checksum, that is appended to the CSP message.
+*/
+#define CSP_CRC32_LENGTH	4
+
 /**
    Append CRC32 checksum to packet
    @param[in] packet CSP packet, must be valid.
@@ -56,6 +61,16 @@ int csp_crc32_verify(csp_packet_t * packet, bool include_header);
 */
 uint32_t csp_crc32_memory(const uint8_t * addr, uint32_t length);
 
+/**
+   Update checksum with a given memory area, e.g. for calculating checksum over non-contiguous memory.
+   Start with \a crc = 0, the result of updating with all areas is the same as csp_crc32_memory() on the concatenated areas.
+   @param[in] crc checksum of previous memory area(s)
+   @param[in] addr memory address
+   @param[in] length length of memory to do checksum on
+   @return checksum
+*/
+uint32_t csp_crc32_memory_update(uint32_t crc, const uint8_t * addr, uint32_t length);
+
 #ifdef __cplusplus
 }
 #endif
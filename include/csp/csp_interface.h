@@ -57,16 +57,25 @@ struct csp_iface_s {
     nexthop_t nexthop;         //!< Next hop (Tx) function
     uint16_t mtu;              //!< Maximum Transmission Unit of interface
     uint8_t split_horizon_off; //!< Disable the route-loop prevention
+    uint8_t chain_tx;          //!< Next hop (Tx) function supports chained packets, otherwise packets are linearized, see csp_buffer_chain_append()
+    uint8_t tx_inplace;        //!< Next hop (Tx) function modifies the packet in place (e.g. framing in the padding), so shared packets are copied before transmit
+    uint8_t weight;            //!< Router ingress weight - packets routed per round, when several interfaces have packets queued at the same priority (deficit round robin). 0 is the same as 1
+    uint8_t cut_through;       //!< Forward transit packets (not to this node) directly from csp_qfifo_write() in task context, bypassing the router task, dedup and router queues. On the loopback interface, packets to this node (except RDP) are delivered to the socket/connection in the sending task. Disabled by default
+    csp_codel_conf_t codel;    //!< Active queue management of the packets queued for the router (per priority and shard), disabled by default - set before queuing packets
     uint32_t tx;               //!< Successfully transmitted packets
     uint32_t rx;               //!< Successfully received packets
     uint32_t tx_error;         //!< Transmit errors (packets)
     uint32_t rx_error;         //!< Receive errors, e.g. too large message
     uint32_t drop;             //!< Dropped packets
+    uint32_t ingress_drop;     //!< Dropped packets, router ingress share (or queue) full (also counted in drop), see csp_qfifo_ingress_depth()
+    uint32_t codel_drop;       //!< Dropped packets, queued for too long for the router (also counted in drop), see csp_iface_s.codel
+    uint32_t expired;          //!< Dropped packets, past their deadline when routed (input interface) or transmitted (also counted in drop), see csp_buffer_set_deadline()
     uint32_t autherr;          //!< Authentication errors (packets)
     uint32_t frame;            //!< Frame format errors (packets)
     uint32_t txbytes;          //!< Transmitted bytes
     uint32_t rxbytes;          //!< Received bytes
     uint32_t irq;              //!< Interrupts
+    void * ingress;            //!< Internal, router ingress state - created by csp_iflist_add(), or csp_init() for interfaces added before
     struct csp_iface_s *next;  //!< Internal, interfaces are stored in a linked list
 };
 //doc-end:csp_iface_s
@@ -82,12 +91,28 @@ struct csp_iface_s {
    This function is fire and forget, it returns void, meaning that the \a packet will always be
    either accepted or dropped, so the memory will always be freed.
 
+   With #csp_iface_s.cut_through set, packets to other nodes are forwarded from the calling task (not from ISR), i.e. the
+   route lookup and the next hop (Tx) function of the outgoing interface are called before returning.
+
    @param[in] packet A pointer to the incoming packet
    @param[in] iface A pointer to the incoming interface TX function.
    @param[out] pxTaskWoken Valid reference if called from ISR, otherwise NULL!
 */
 void csp_qfifo_write(csp_packet_t *packet, csp_iface_t *iface, CSP_BASE_TYPE *pxTaskWoken);
 
+/**
+   Number of packets queued for the router by an interface.
+
+   Each interface in the interface list gets a share of the router queue: it may queue as many packets (per priority
+   and router shard) as there is free space left, #csp_conf_t.fifo_length when alone, so a busy interface always leaves
+   room for others - packets over the share are dropped, see #csp_iface_s.ingress_drop. The router serves the
+   interfaces in turn, #csp_iface_s.weight packets at a time.
+
+   @param[in] iface interface
+   @return packets queued, 0 if the interface has no ingress state (not added to the interface list)
+*/
+unsigned int csp_qfifo_ingress_depth(const csp_iface_t *iface);
+
 #ifdef __cplusplus
 }
 #endif
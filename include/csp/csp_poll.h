@@ -0,0 +1,79 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk) 
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CSP_CSP_POLL_H_
+#define _CSP_CSP_POLL_H_
+
+/**
+   @file
+
+   Wait on multiple connections and sockets.
+
+   csp_poll() waits until one or more connections/sockets are ready for I/O, e.g. a single server task can
+   handle many connections and sockets, instead of a task per connection blocking in csp_read() or csp_accept().
+*/
+
+#include <csp/csp_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   @defgroup CSP_POLL_EVENTS CSP poll events.
+   @{
+*/
+#define CSP_POLLIN	0x01	/**< Packet ready for csp_read()/csp_recvfrom(), or connection ready for csp_accept() */
+#define CSP_POLLOUT	0x02	/**< Connection can send without blocking (RDP: transmit window open) */
+#define CSP_POLLERR	0x04	/**< Connection not open, or socket not listening (returned only) */
+#define CSP_POLLHUP	0x08	/**< RDP connection closed by the other end or timed out (returned only) */
+/**@}*/
+
+/**
+   Connection or socket to poll.
+   Set either \a conn or \a socket - entries with neither are ignored.
+*/
+typedef struct csp_pollfd {
+	//! Connection to poll.
+	csp_conn_t * conn;
+	//! Socket to poll, must be listening (see csp_listen()) or connection-less.
+	csp_socket_t * socket;
+	//! Requested events, see @ref CSP_POLL_EVENTS.
+	uint8_t events;
+	//! Returned events, see @ref CSP_POLL_EVENTS.
+	uint8_t revents;
+} csp_pollfd_t;
+
+/**
+   Wait for events on multiple connections and sockets.
+
+   Checks all entries, and waits until at least one of them has a requested event, or an error.
+   Read/accept with timeout 0 afterwards, as another task may get there first.
+   @param[in,out] fds connections and sockets to poll, \a revents is set on return.
+   @param[in] count number of entries in \a fds.
+   @param[in] timeout timeout in mS to wait for an event, use #CSP_MAX_TIMEOUT for infinite timeout.
+   @return number of entries with events (\a revents != 0), 0 on timeout, otherwise an error code.
+*/
+int csp_poll(csp_pollfd_t * fds, unsigned int count, uint32_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
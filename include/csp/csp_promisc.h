@@ -27,7 +27,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
    Promiscuous packet queue.
 
    This function is used to enable promiscuous mode for incoming packets, e.g. router, bridge.
-   If enabled, a copy of all incoming packets are cloned (using csp_buffer_clone()) and placed in a
+   If enabled, a reference to all incoming packets is taken (using csp_buffer_ref()) and placed in a
    FIFO queue, that can be read using csp_promisc_read().
 */
 
@@ -54,10 +54,18 @@ void csp_promisc_disable(void);
 
    Returns the first packet from the promiscuous packet queue.
    @param[in] timeout Timeout in ms to wait for a packet.
-   @return Packet (free with csp_buffer_free() or re-use packet), NULL on error or timeout.
+   @return Packet (free with csp_buffer_free(), call csp_buffer_unshare() before modifying it), NULL on error or timeout.
 */
 csp_packet_t *csp_promisc_read(uint32_t timeout);
 
+/**
+   Return file descriptor for waiting on the promiscuous packet queue with poll()/select()/epoll (Linux only).
+
+   The descriptor is readable when there are packets for csp_promisc_read() - call it with timeout 0. Don't close the descriptor.
+   @return file descriptor on success, otherwise an error code (#CSP_ERR_NOTSUP if not supported).
+*/
+int csp_promisc_fd(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -41,6 +41,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 extern "C" {
 #endif
 
+/**
+   Number of bytes of the SFP header, appended to the data of each packet.
+*/
+#define CSP_SFP_HEADER_LENGTH	8
+
 /**
    Send data over a CSP connection.
 
@@ -54,7 +59,7 @@ extern "C" {
    @param[in] data data to send
    @param[in] datasize size of \a data
    @param[in] mtu maximum transfer unit (bytes), max data chunk to send.
-   @param[in] timeout unused as of CSP version 1.6
+   @param[in] timeout max time to wait for a free buffer for each packet (mS), see csp_buffer_get_timeout().
    @param[in] memcpyfcn memory copy function.
    @return #CSP_ERR_NONE on success, otherwise an error.
 */
@@ -69,7 +74,7 @@ int csp_sfp_send_own_memcpy(csp_conn_t * conn, const void * data, unsigned int d
    @param[in] data data to send
    @param[in] datasize size of \a data
    @param[in] mtu maximum transfer unit (bytes), max data chunk to send.
-   @param[in] timeout unused as of CSP version 1.6
+   @param[in] timeout max time to wait for a free buffer for each packet (mS), see csp_buffer_get_timeout().
    @return #CSP_ERR_NONE on success, otherwise an error.
 */
 static inline int csp_sfp_send(csp_conn_t * conn, const void * data, unsigned int datasize, unsigned int mtu, uint32_t timeout) {
@@ -77,6 +77,14 @@ typedef enum {
 #define CSP_RX_QUEUES			1
 #endif
 
+#ifndef CSP_ROUTE_BATCH_MAX
+#define CSP_ROUTE_BATCH_MAX		16 //!< Max packets routed per router wakeup, see csp_conf_t.route_batch
+#endif
+
+#ifndef CSP_ROUTE_SHARDS_MAX
+#define CSP_ROUTE_SHARDS_MAX		8 //!< Max router tasks (shards), see csp_conf_t.route_shards
+#endif
+
 /**
    @defgroup CSP_HEADER_DEF CSP header definition.
    @{
@@ -246,6 +254,21 @@ typedef struct {
 */
 #define CSP_BUFFER_PACKET_OVERHEAD      (sizeof(csp_packet_t) - sizeof(((csp_packet_t *)0)->data))
 
+/**
+   CoDel (Controlled Delay) active queue management of a queue.
+   Packets are time stamped when queued, and when packets have been queued for longer than \a target for at least
+   \a interval, packets are dropped from the head of the queue - at an increasing rate, until the queuing delay is below
+   \a target again. This keeps the queuing delay low during sustained overload, instead of a full queue.
+   See csp_iface_t.codel (router input queues) and csp_conn_set_codel() (connection RX queue).
+*/
+typedef struct {
+	uint16_t target;	//!< Acceptable queuing delay (mS), 0 disables CoDel (tail-drop only)
+	uint16_t interval;	//!< Time (mS) the queuing delay must stay above \a target before dropping, roughly a round-trip time. 0 uses #CSP_CODEL_INTERVAL
+} csp_codel_conf_t;
+
+/** Default CoDel interval (mS), see #csp_codel_conf_t */
+#define CSP_CODEL_INTERVAL	100
+
 /** Forward declaration of CSP interface, see #csp_iface_s for details. */
 typedef struct csp_iface_s csp_iface_t;
 /** Forward declaration of outgoing CSP route, see #csp_route_s for details. */
@@ -40,6 +40,9 @@ extern "C" {
 
 /**
    Loopback interface.
+   Packets are routed back into CSP through the router queues and task. With #csp_iface_s.cut_through set, packets
+   (except RDP) are delivered directly to the destination socket/connection in the sending task, saving two task
+   switches per packet.
 */
 extern csp_iface_t csp_if_lo;
 
@@ -40,3 +40,21 @@ void * csp_calloc(size_t nmemb, size_t size) {
 void csp_free(void *ptr) {
 	vPortFree(ptr);
 }
+
+void * csp_malloc_pool(size_t size, unsigned int options, unsigned int * obtained) {
+
+	// huge pages and locking not supported
+	void * ptr = csp_malloc(size);
+	if (ptr && (options & CSP_MALLOC_POOL_PREFAULT)) {
+		memset(ptr, 0, size);
+	}
+	if (obtained) {
+		*obtained = (options & CSP_MALLOC_POOL_PREFAULT);
+	}
+	return ptr;
+
+}
+
+void csp_free_pool(void * ptr, size_t size, unsigned int obtained) {
+	csp_free(ptr);
+}
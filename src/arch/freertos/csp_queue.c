@@ -19,42 +19,154 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_malloc.h>
 
 #include <FreeRTOS.h>
 #include <queue.h> // FreeRTOS
 
+/* Queue with priorities: a FreeRTOS queue per priority, and an event queue counting the elements.
+   Tasks wait on the event queue, and then take from the highest priority queue holding elements.
+   A queue without priorities uses the element queue as event queue. */
+typedef struct {
+	QueueHandle_t event;
+	unsigned int prios;
+	QueueHandle_t queue[];
+} csp_freertos_queue_t;
+
 csp_queue_handle_t csp_queue_create(int length, size_t item_size) {
-	return xQueueCreate(length, item_size);
+	return csp_queue_create_prio(length, item_size, 1);
+}
+
+csp_queue_handle_t csp_queue_create_prio(int length, size_t item_size, unsigned int prios) {
+	if ((prios == 0) || (prios > CSP_QUEUE_PRIO_MAX))
+		return NULL;
+	csp_freertos_queue_t * q = csp_calloc(1, sizeof(*q) + (prios * sizeof(QueueHandle_t)));
+	if (q == NULL)
+		return NULL;
+	q->prios = prios;
+	for (unsigned int prio = 0; prio < prios; prio++) {
+		q->queue[prio] = xQueueCreate(length, item_size);
+		if (q->queue[prio] == NULL) {
+			csp_queue_remove(q);
+			return NULL;
+		}
+	}
+	q->event = (prios > 1) ? xQueueCreate(prios * length, 0) : q->queue[0];
+	if (q->event == NULL) {
+		csp_queue_remove(q);
+		return NULL;
+	}
+	return q;
 }
 
 void csp_queue_remove(csp_queue_handle_t queue) {
-	vQueueDelete(queue);
+	csp_freertos_queue_t * q = queue;
+	if (q == NULL)
+		return;
+	if ((q->prios > 1) && (q->event != NULL))
+		vQueueDelete(q->event);
+	for (unsigned int prio = 0; prio < q->prios; prio++) {
+		if (q->queue[prio] != NULL)
+			vQueueDelete(q->queue[prio]);
+	}
+	csp_free(q);
 }
 
 int csp_queue_enqueue(csp_queue_handle_t handle, const void * value, uint32_t timeout) {
+	return csp_queue_enqueue_prio(handle, value, 0, timeout);
+}
+
+int csp_queue_enqueue_isr(csp_queue_handle_t handle, const void * value, CSP_BASE_TYPE * task_woken) {
+	return csp_queue_enqueue_prio_isr(handle, value, 0, task_woken);
+}
+
+int csp_queue_enqueue_prio(csp_queue_handle_t handle, const void * value, unsigned int prio, uint32_t timeout) {
+	csp_freertos_queue_t * q = handle;
+	if (prio >= q->prios)
+		return CSP_QUEUE_ERROR;
 	if (timeout != CSP_MAX_TIMEOUT)
 		timeout = timeout / portTICK_RATE_MS;
-	return xQueueSendToBack(handle, value, timeout);
+	if (xQueueSendToBack(q->queue[prio], value, timeout) != pdTRUE)
+		return CSP_QUEUE_FULL;
+	if (q->prios > 1)
+		xQueueSendToBack(q->event, NULL, 0); // room for all elements
+	return CSP_QUEUE_OK;
 }
 
-int csp_queue_enqueue_isr(csp_queue_handle_t handle, const void * value, CSP_BASE_TYPE * task_woken) {
-	return xQueueSendToBackFromISR(handle, value, task_woken);
+int csp_queue_enqueue_prio_isr(csp_queue_handle_t handle, const void * value, unsigned int prio, CSP_BASE_TYPE * task_woken) {
+	csp_freertos_queue_t * q = handle;
+	if (prio >= q->prios)
+		return CSP_QUEUE_ERROR;
+	if (xQueueSendToBackFromISR(q->queue[prio], value, task_woken) != pdTRUE)
+		return CSP_QUEUE_FULL;
+	if (q->prios > 1)
+		xQueueSendToBackFromISR(q->event, NULL, task_woken);
+	return CSP_QUEUE_OK;
+}
+
+int csp_queue_enqueue_n(csp_queue_handle_t handle, const void * values, unsigned int count, uint32_t timeout) {
+	// FreeRTOS queues move one element per call
+	if (count == 0) {
+		return 0;
+	}
+	return (csp_queue_enqueue(handle, values, timeout) == CSP_QUEUE_OK) ? 1 : 0;
+}
+
+int csp_queue_enqueue_prio_n(csp_queue_handle_t handle, const void * values, unsigned int count, unsigned int prio, uint32_t timeout) {
+	// FreeRTOS queues move one element per call
+	if (count == 0) {
+		return 0;
+	}
+	return (csp_queue_enqueue_prio(handle, values, prio, timeout) == CSP_QUEUE_OK) ? 1 : 0;
 }
 
 int csp_queue_dequeue(csp_queue_handle_t handle, void * buf, uint32_t timeout) {
+	csp_freertos_queue_t * q = handle;
 	if (timeout != CSP_MAX_TIMEOUT)
 		timeout = timeout / portTICK_RATE_MS;
-	return xQueueReceive(handle, buf, timeout);
+	if (q->prios == 1)
+		return xQueueReceive(q->event, buf, timeout);
+	if (xQueueReceive(q->event, NULL, timeout) != pdTRUE)
+		return CSP_QUEUE_ERROR;
+	// an event is only posted after its element, so one of the queues holds an element
+	for (unsigned int prio = 0; prio < q->prios; prio++) {
+		if (xQueueReceive(q->queue[prio], buf, 0) == pdTRUE)
+			return CSP_QUEUE_OK;
+	}
+	return CSP_QUEUE_ERROR;
 }
 
 int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, CSP_BASE_TYPE * task_woken) {
-	return xQueueReceiveFromISR(handle, buf, task_woken);
+	csp_freertos_queue_t * q = handle;
+	if (q->prios == 1)
+		return xQueueReceiveFromISR(q->event, buf, task_woken);
+	if (xQueueReceiveFromISR(q->event, NULL, task_woken) != pdTRUE)
+		return CSP_QUEUE_ERROR;
+	for (unsigned int prio = 0; prio < q->prios; prio++) {
+		if (xQueueReceiveFromISR(q->queue[prio], buf, task_woken) == pdTRUE)
+			return CSP_QUEUE_OK;
+	}
+	return CSP_QUEUE_ERROR;
+}
+
+int csp_queue_dequeue_n(csp_queue_handle_t handle, void * buf, unsigned int count, uint32_t timeout) {
+	// FreeRTOS queues move one element per call
+	if (count == 0) {
+		return 0;
+	}
+	return (csp_queue_dequeue(handle, buf, timeout) == CSP_QUEUE_OK) ? 1 : 0;
 }
 
 int csp_queue_size(csp_queue_handle_t handle) {
-	return uxQueueMessagesWaiting(handle);
+	csp_freertos_queue_t * q = handle;
+	return uxQueueMessagesWaiting(q->event);
 }
 
 int csp_queue_size_isr(csp_queue_handle_t handle) {
-	return uxQueueMessagesWaitingFromISR(handle);
+	csp_freertos_queue_t * q = handle;
+	return uxQueueMessagesWaitingFromISR(q->event);
+}
+
+int csp_queue_fd(csp_queue_handle_t handle) {
+	return -1;
 }
@@ -35,16 +35,27 @@ http://code.google.com/p/c-pthread-queue/
 
 pthread_queue_t * pthread_queue_create(int length, size_t item_size) {
 
-	pthread_queue_t * q = malloc(sizeof(pthread_queue_t));
+	return pthread_queue_create_prio(length, item_size, 1);
+
+}
+
+pthread_queue_t * pthread_queue_create_prio(int length, size_t item_size, unsigned int prios) {
+
+	if ((prios == 0) || (prios > PTHREAD_QUEUE_PRIO_MAX)) {
+		return NULL;
+	}
+
+	pthread_queue_t * q = malloc(sizeof(pthread_queue_t) + (prios * sizeof(pthread_queue_level_t)));
 
 	if (q != NULL) {
-		q->buffer = malloc(length*item_size);
+		q->buffer = malloc(prios*length*item_size);
 		if (q->buffer != NULL) {
 			q->size = length;
 			q->item_size = item_size;
 			q->items = 0;
-			q->in = 0;
-			q->out = 0;
+			q->prios = prios;
+			q->nonempty = 0;
+			memset(q->levels, 0, prios * sizeof(pthread_queue_level_t));
 			if (pthread_mutex_init(&(q->mutex), NULL) || pthread_cond_init(&(q->cond_full), NULL) || pthread_cond_init(&(q->cond_empty), NULL)) {
 				free(q->buffer);
 				free(q);
@@ -72,10 +83,68 @@ void pthread_queue_delete(pthread_queue_t * q) {
 
 }
 
+/* Copy object into the queue at priority - called locked, with room at the priority */
+static inline void put_item(pthread_queue_t * queue, unsigned int prio, const void * value) {
+
+	pthread_queue_level_t * level = &queue->levels[prio];
+	memcpy(queue->buffer+(((prio * queue->size) + level->in) * queue->item_size), value, queue->item_size);
+	level->in = (level->in + 1) % queue->size;
+	level->items++;
+	queue->items++;
+	queue->nonempty |= (1U << prio);
+
+}
+
+/* Copy the first object of the highest priority out of the queue - called locked, with items in the queue */
+static inline void get_item(pthread_queue_t * queue, void * buf) {
+
+	const unsigned int prio = __builtin_ctz(queue->nonempty);
+	pthread_queue_level_t * level = &queue->levels[prio];
+	memcpy(buf, queue->buffer+(((prio * queue->size) + level->out) * queue->item_size), queue->item_size);
+	level->out = (level->out + 1) % queue->size;
+	if (--level->items == 0) {
+		queue->nonempty &= ~(1U << prio);
+	}
+	queue->items--;
+
+}
+
+static void get_deadline(struct timespec * ts, uint32_t timeout) {
+
+	clock_serv_t cclock;
+	mach_timespec_t mts;
+	host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
+	clock_get_time(cclock, &mts);
+	mach_port_deallocate(mach_task_self(), cclock);
+	ts->tv_sec = mts.tv_sec;
+	ts->tv_nsec = mts.tv_nsec;
+
+	uint32_t sec = timeout / 1000;
+	uint32_t nsec = (timeout - 1000 * sec) * 1000000;
+
+	ts->tv_sec += sec;
+
+	if (ts->tv_nsec + nsec > 1000000000)
+		ts->tv_sec++;
+
+	ts->tv_nsec = (ts->tv_nsec + nsec) % 1000000000;
+
+}
+
 int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t timeout) {
 
+	return pthread_queue_enqueue_prio(queue, value, 0, timeout);
+
+}
+
+int pthread_queue_enqueue_prio(pthread_queue_t * queue, const void * value, unsigned int prio, uint32_t timeout) {
+
 	int ret;
 
+	if (prio >= queue->prios) {
+		return PTHREAD_QUEUE_ERROR;
+	}
+
 	/* Calculate timeout */
 	struct timespec ts;
 
@@ -99,7 +168,7 @@ int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t
 
 	/* Get queue lock */
 	pthread_mutex_lock(&(queue->mutex));
-	while (queue->items == queue->size) {
+	while (queue->levels[prio].items == queue->size) {
 		ret = pthread_cond_timedwait(&(queue->cond_full), &(queue->mutex), &ts);
 		if (ret != 0) {
 			pthread_mutex_unlock(&(queue->mutex));
@@ -108,9 +177,7 @@ int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t
 	}
 
 	/* Copy object from input buffer */
-	memcpy(queue->buffer+(queue->in * queue->item_size), value, queue->item_size);
-	queue->items++;
-	queue->in = (queue->in + 1) % queue->size;
+	put_item(queue, prio, value);
 	pthread_mutex_unlock(&(queue->mutex));
 
 	/* Nofify blocked threads */
@@ -120,6 +187,45 @@ int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t
 
 }
 
+int pthread_queue_enqueue_n(pthread_queue_t * queue, const void * values, unsigned int count, uint32_t timeout) {
+
+	return pthread_queue_enqueue_prio_n(queue, values, count, 0, timeout);
+
+}
+
+int pthread_queue_enqueue_prio_n(pthread_queue_t * queue, const void * values, unsigned int count, unsigned int prio, uint32_t timeout) {
+
+	if ((count == 0) || (prio >= queue->prios)) {
+		return 0;
+	}
+
+	/* Calculate timeout */
+	struct timespec ts;
+	get_deadline(&ts, timeout);
+
+	/* Get queue lock */
+	pthread_mutex_lock(&(queue->mutex));
+	while (queue->levels[prio].items == queue->size) {
+		if (pthread_cond_timedwait(&(queue->cond_full), &(queue->mutex), &ts) != 0) {
+			pthread_mutex_unlock(&(queue->mutex));
+			return 0;
+		}
+	}
+
+	/* Copy as many objects as there is room for */
+	unsigned int inserted = 0;
+	for (; (inserted < count) && (queue->levels[prio].items < queue->size); ++inserted) {
+		put_item(queue, prio, (const char *) values + (inserted * queue->item_size));
+	}
+	pthread_mutex_unlock(&(queue->mutex));
+
+	/* Nofify blocked threads */
+	pthread_cond_broadcast(&(queue->cond_empty));
+
+	return inserted;
+
+}
+
 int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout) {
 
 	int ret;
@@ -155,9 +261,7 @@ int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout)
 	}
 
 	/* Copy object to output buffer */
-	memcpy(buf, queue->buffer+(queue->out * queue->item_size), queue->item_size);
-	queue->items--;
-	queue->out = (queue->out + 1) % queue->size;
+	get_item(queue, buf);
 	pthread_mutex_unlock(&(queue->mutex));
 
 	/* Nofify blocked threads */
@@ -167,6 +271,39 @@ int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout)
 
 }
 
+int pthread_queue_dequeue_n(pthread_queue_t * queue, void * buf, unsigned int count, uint32_t timeout) {
+
+	if (count == 0) {
+		return 0;
+	}
+
+	/* Calculate timeout */
+	struct timespec ts;
+	get_deadline(&ts, timeout);
+
+	/* Get queue lock */
+	pthread_mutex_lock(&(queue->mutex));
+	while (queue->items == 0) {
+		if (pthread_cond_timedwait(&(queue->cond_empty), &(queue->mutex), &ts) != 0) {
+			pthread_mutex_unlock(&(queue->mutex));
+			return 0;
+		}
+	}
+
+	/* Copy objects to output buffer */
+	unsigned int extracted = 0;
+	for (; (extracted < count) && (queue->items > 0); ++extracted) {
+		get_item(queue, (char *) buf + (extracted * queue->item_size));
+	}
+	pthread_mutex_unlock(&(queue->mutex));
+
+	/* Nofify blocked threads */
+	pthread_cond_broadcast(&(queue->cond_full));
+
+	return extracted;
+
+}
+
 int pthread_queue_items(pthread_queue_t * queue) {
 
 	pthread_mutex_lock(&(queue->mutex));
@@ -176,3 +313,10 @@ int pthread_queue_items(pthread_queue_t * queue) {
 	return items;
 
 }
+
+int pthread_queue_fd(pthread_queue_t * queue) {
+
+	/* No eventfd on Mac OS X */
+	return -1;
+
+}
@@ -21,6 +21,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_malloc.h>
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 void * csp_malloc(size_t size) {
 	return malloc(size);
@@ -34,3 +38,94 @@ void csp_free(void *ptr) {
 	free(ptr);
 }
 
+
+/* Size of (default) huge pages */
+static size_t csp_hugepage_size(void) {
+
+	size_t size = 2 * 1024 * 1024;
+#if defined(__linux__)
+	FILE * fp = fopen("/proc/meminfo", "r");
+	if (fp) {
+		char line[100];
+		unsigned long kb;
+		while (fgets(line, sizeof(line), fp)) {
+			if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+				size = kb * 1024;
+				break;
+			}
+		}
+		fclose(fp);
+	}
+#endif
+	return size;
+
+}
+
+void * csp_malloc_pool(size_t size, unsigned int options, unsigned int * obtained) {
+
+	unsigned int mode = 0;
+	void * ptr = NULL;
+
+	if (options & CSP_MALLOC_POOL_HUGEPAGES) {
+		const size_t huge = csp_hugepage_size();
+		const size_t huge_size = ((size + huge - 1) / huge) * huge;
+#if defined(MAP_HUGETLB)
+		// explicit huge pages, requires pages reserved by the system (vm.nr_hugepages)
+		ptr = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			mode |= CSP_MALLOC_POOL_HUGEPAGES;
+		} else {
+			ptr = NULL;
+		}
+#endif
+#if defined(MADV_HUGEPAGE)
+		// fall back to huge page aligned memory, advised for transparent huge pages
+		if ((ptr == NULL) && (posix_memalign(&ptr, huge, huge_size) == 0)) {
+			if (madvise(ptr, huge_size, MADV_HUGEPAGE) == 0) {
+				mode |= CSP_MALLOC_POOL_THP;
+			}
+		}
+#endif
+	}
+
+	if (ptr == NULL) {
+		ptr = malloc(size);
+		if (ptr == NULL) {
+			return NULL;
+		}
+	}
+
+	if (options & CSP_MALLOC_POOL_PREFAULT) {
+		memset(ptr, 0, size);
+		mode |= CSP_MALLOC_POOL_PREFAULT;
+	}
+
+	if ((options & CSP_MALLOC_POOL_LOCK) && (mlock(ptr, size) == 0)) {
+		mode |= CSP_MALLOC_POOL_LOCK;
+	}
+
+	if (obtained) {
+		*obtained = mode;
+	}
+	return ptr;
+
+}
+
+void csp_free_pool(void * ptr, size_t size, unsigned int obtained) {
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	if (obtained & CSP_MALLOC_POOL_LOCK) {
+		munlock(ptr, size);
+	}
+
+	if (obtained & CSP_MALLOC_POOL_HUGEPAGES) {
+		const size_t huge = csp_hugepage_size();
+		munmap(ptr, ((size + huge - 1) / huge) * huge);
+	} else {
+		free(ptr);
+	}
+
+}
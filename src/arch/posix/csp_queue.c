@@ -19,12 +19,33 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
 #include <csp/arch/csp_queue.h>
+#include <csp/csp_types.h>
+
+#if (CSP_USE_QUEUE_LOCKFREE)
+#include <csp/arch/posix/ring_queue.h>
+#define pthread_queue_create         ring_queue_create
+#define pthread_queue_create_prio    ring_queue_create_prio
+#define pthread_queue_delete         ring_queue_delete
+#define pthread_queue_enqueue        ring_queue_enqueue
+#define pthread_queue_enqueue_prio   ring_queue_enqueue_prio
+#define pthread_queue_enqueue_n      ring_queue_enqueue_n
+#define pthread_queue_enqueue_prio_n ring_queue_enqueue_prio_n
+#define pthread_queue_dequeue        ring_queue_dequeue
+#define pthread_queue_dequeue_n      ring_queue_dequeue_n
+#define pthread_queue_items          ring_queue_items
+#define pthread_queue_fd             ring_queue_fd
+#else
 #include <csp/arch/posix/pthread_queue.h>
+#endif
 
 csp_queue_handle_t csp_queue_create(int length, size_t item_size) {
 	return pthread_queue_create(length, item_size);
 }
 
+csp_queue_handle_t csp_queue_create_prio(int length, size_t item_size, unsigned int prios) {
+	return pthread_queue_create_prio(length, item_size, prios);
+}
+
 void csp_queue_remove(csp_queue_handle_t queue) {
 	return pthread_queue_delete(queue);
 }
@@ -40,6 +61,25 @@ int csp_queue_enqueue_isr(csp_queue_handle_t handle, const void * value, CSP_BAS
 	return csp_queue_enqueue(handle, value, 0);
 }
 
+int csp_queue_enqueue_prio(csp_queue_handle_t handle, const void * value, unsigned int prio, uint32_t timeout) {
+	return pthread_queue_enqueue_prio(handle, value, prio, timeout);
+}
+
+int csp_queue_enqueue_prio_isr(csp_queue_handle_t handle, const void * value, unsigned int prio, CSP_BASE_TYPE * task_woken) {
+	if (task_woken != NULL) {
+		*task_woken = 0;
+	}
+	return csp_queue_enqueue_prio(handle, value, prio, 0);
+}
+
+int csp_queue_enqueue_n(csp_queue_handle_t handle, const void * values, unsigned int count, uint32_t timeout) {
+	return pthread_queue_enqueue_n(handle, values, count, timeout);
+}
+
+int csp_queue_enqueue_prio_n(csp_queue_handle_t handle, const void * values, unsigned int count, unsigned int prio, uint32_t timeout) {
+	return pthread_queue_enqueue_prio_n(handle, values, count, prio, timeout);
+}
+
 int csp_queue_dequeue(csp_queue_handle_t handle, void *buf, uint32_t timeout) {
 	return pthread_queue_dequeue(handle, buf, timeout);
 }
@@ -51,6 +91,10 @@ int csp_queue_dequeue_isr(csp_queue_handle_t handle, void *buf, CSP_BASE_TYPE *
 	return csp_queue_dequeue(handle, buf, 0);
 }
 
+int csp_queue_dequeue_n(csp_queue_handle_t handle, void * buf, unsigned int count, uint32_t timeout) {
+	return pthread_queue_dequeue_n(handle, buf, count, timeout);
+}
+
 int csp_queue_size(csp_queue_handle_t handle) {
 	return pthread_queue_items(handle);
 }
@@ -58,3 +102,7 @@ int csp_queue_size(csp_queue_handle_t handle) {
 int csp_queue_size_isr(csp_queue_handle_t handle) {
 	return pthread_queue_items(handle);
 }
+
+int csp_queue_fd(csp_queue_handle_t handle) {
+	return pthread_queue_fd(handle);
+}
@@ -25,13 +25,21 @@ http://code.google.com/p/c-pthread-queue/
 
 #include <csp/arch/posix/pthread_queue.h>
 
-#include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include <csp/arch/csp_malloc.h>
 
 static inline int get_deadline(struct timespec *ts, uint32_t timeout_ms)
 {
+	/* No timeout - leave the deadline zero, so the queue is polled without waiting */
+	if (timeout_ms == 0) {
+		ts->tv_sec = 0;
+		ts->tv_nsec = 0;
+		return 0;
+	}
+
 	int ret = clock_gettime(CLOCK_MONOTONIC, ts);
 
 	if (ret < 0) {
@@ -52,6 +60,12 @@ static inline int get_deadline(struct timespec *ts, uint32_t timeout_ms)
 	return ret;
 }
 
+/* Zero deadline (no timeout) - a timed wait on an already expired deadline can still sleep for the timer slack */
+static inline int is_poll(const struct timespec *ts)
+{
+	return (ts != NULL) && (ts->tv_sec == 0) && (ts->tv_nsec == 0);
+}
+
 static inline int init_cond_clock_monotonic(pthread_cond_t * cond)
 {
 
@@ -71,17 +85,32 @@ static inline int init_cond_clock_monotonic(pthread_cond_t * cond)
 }
 
 pthread_queue_t * pthread_queue_create(int length, size_t item_size) {
-	
-	pthread_queue_t * q = csp_malloc(sizeof(pthread_queue_t));
+
+	return pthread_queue_create_prio(length, item_size, 1);
+
+}
+
+pthread_queue_t * pthread_queue_create_prio(int length, size_t item_size, unsigned int prios) {
+
+	if ((prios == 0) || (prios > PTHREAD_QUEUE_PRIO_MAX)) {
+		return NULL;
+	}
+
+	pthread_queue_t * q = csp_malloc(sizeof(pthread_queue_t) + (prios * sizeof(pthread_queue_level_t)));
 	
 	if (q != NULL) {
-		q->buffer = csp_malloc(length*item_size);
+		q->buffer = csp_malloc(prios*length*item_size);
 		if (q->buffer != NULL) {
 			q->size = length;
 			q->item_size = item_size;
 			q->items = 0;
-			q->in = 0;
-			q->out = 0;
+			q->prios = prios;
+			q->nonempty = 0;
+			memset(q->levels, 0, prios * sizeof(pthread_queue_level_t));
+			q->full_waiters = 0;
+			q->empty_waiters = 0;
+			q->fd = -1;
+			q->fd_signalled = 0;
 			if (pthread_mutex_init(&(q->mutex), NULL) || init_cond_clock_monotonic(&(q->cond_full)) || init_cond_clock_monotonic(&(q->cond_empty))) {
 				csp_free(q->buffer);
 				csp_free(q);
@@ -102,27 +131,95 @@ void pthread_queue_delete(pthread_queue_t * q) {
 	if (q == NULL)
 		return;
 
+	if (q->fd >= 0) {
+		close(q->fd);
+	}
 	csp_free(q->buffer);
 	csp_free(q);
 
 	return;
 
 }
-	
 
-static inline int wait_slot_available(pthread_queue_t * queue, struct timespec *ts) {
+/* Copy object into the queue at priority - called locked, with room at the priority */
+static inline void put_item(pthread_queue_t * queue, unsigned int prio, const void * value) {
+
+	pthread_queue_level_t * level = &queue->levels[prio];
+	memcpy(queue->buffer+(((prio * queue->size) + level->in) * queue->item_size), value, queue->item_size);
+	level->in = (level->in + 1) % queue->size;
+	level->items++;
+	queue->items++;
+	queue->nonempty |= (1U << prio);
+
+}
+
+/* Copy the first object of the highest priority out of the queue - called locked, with items in the queue */
+static inline void get_item(pthread_queue_t * queue, void * buf) {
+
+	const unsigned int prio = __builtin_ctz(queue->nonempty);
+	pthread_queue_level_t * level = &queue->levels[prio];
+	memcpy(buf, queue->buffer+(((prio * queue->size) + level->out) * queue->item_size), queue->item_size);
+	level->out = (level->out + 1) % queue->size;
+	if (--level->items == 0) {
+		queue->nonempty &= ~(1U << prio);
+	}
+	queue->items--;
+
+}
+
+/* Make the readiness descriptor (if any) follow the queue state - called locked */
+static inline void update_fd(pthread_queue_t * queue) {
+
+	if (queue->fd < 0) {
+		return;
+	}
+
+	uint64_t value = 1;
+	if ((queue->items > 0) && !queue->fd_signalled) {
+		queue->fd_signalled = (write(queue->fd, &value, sizeof(value)) == sizeof(value));
+	} else if ((queue->items == 0) && queue->fd_signalled) {
+		queue->fd_signalled = (read(queue->fd, &value, sizeof(value)) != sizeof(value));
+	}
+
+}
+
+/* Wake up to count waiters - called after unlocking, with the number of waiters seen while locked */
+static inline void notify_waiters(pthread_cond_t * cond, int waiters, unsigned int count) {
+
+	if (waiters <= 0) {
+		return;
+	}
+
+	if (count >= (unsigned int) waiters) {
+		pthread_cond_broadcast(cond);
+	} else {
+		while (count--) {
+			pthread_cond_signal(cond);
+		}
+	}
+
+}
+
+static inline int wait_slot_available(pthread_queue_t * queue, unsigned int prio, struct timespec *ts) {
 
 	int ret;
 
-	while (queue->items == queue->size) {
+	while (queue->levels[prio].items == queue->size) {
+
+		if (is_poll(ts)) {
+			return PTHREAD_QUEUE_FULL;
+		}
 
+		queue->full_waiters++;
 		if (ts != NULL) {
 			ret = pthread_cond_timedwait(&(queue->cond_full), &(queue->mutex), ts);
 		} else {
 			ret = pthread_cond_wait(&(queue->cond_full), &(queue->mutex));
 		}
+		queue->full_waiters--;
 
-		if (ret != 0 && errno != EINTR) {
+		/* A wakeup may coincide with the timeout, so only give up if there still is no room */
+		if ((ret != 0) && (queue->levels[prio].items == queue->size)) {
 			return PTHREAD_QUEUE_FULL; //Timeout
 		}
 	}
@@ -133,7 +230,18 @@ static inline int wait_slot_available(pthread_queue_t * queue, struct timespec *
 
 int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t timeout) {
 
+	return pthread_queue_enqueue_prio(queue, value, 0, timeout);
+
+}
+
+int pthread_queue_enqueue_prio(pthread_queue_t * queue, const void * value, unsigned int prio, uint32_t timeout) {
+
 	int ret;
+
+	if (prio >= queue->prios) {
+		return PTHREAD_QUEUE_ERROR;
+	}
+
 	struct timespec ts;
 	struct timespec *pts = NULL;
 
@@ -150,38 +258,90 @@ int pthread_queue_enqueue(pthread_queue_t * queue, const void * value, uint32_t
 	/* Get queue lock */
 	pthread_mutex_lock(&(queue->mutex));
 
-	ret = wait_slot_available(queue, pts);
+	ret = wait_slot_available(queue, prio, pts);
 	if (ret == PTHREAD_QUEUE_OK) {
 		/* Copy object from input buffer */
-		memcpy(queue->buffer+(queue->in * queue->item_size), value, queue->item_size);
-		queue->items++;
-		queue->in = (queue->in + 1) % queue->size;
+		put_item(queue, prio, value);
 	}
+	update_fd(queue);
+	const int waiters = queue->empty_waiters;
 
 	pthread_mutex_unlock(&(queue->mutex));
 
 	if (ret == PTHREAD_QUEUE_OK) {
-		/* Nofify blocked threads */
-		pthread_cond_broadcast(&(queue->cond_empty));
+		/* Nofify a blocked thread */
+		notify_waiters(&(queue->cond_empty), waiters, 1);
 	}
 
 	return ret;
 
 }
 
+int pthread_queue_enqueue_n(pthread_queue_t * queue, const void * values, unsigned int count, uint32_t timeout) {
+
+	return pthread_queue_enqueue_prio_n(queue, values, count, 0, timeout);
+
+}
+
+int pthread_queue_enqueue_prio_n(pthread_queue_t * queue, const void * values, unsigned int count, unsigned int prio, uint32_t timeout) {
+
+	struct timespec ts;
+	struct timespec *pts = NULL;
+
+	if ((count == 0) || (prio >= queue->prios)) {
+		return 0;
+	}
+
+	/* Calculate timeout */
+	if (timeout != CSP_MAX_TIMEOUT) {
+		if (get_deadline(&ts, timeout) != 0) {
+			return 0;
+		}
+		pts = &ts;
+	}
+
+	/* Get queue lock */
+	pthread_mutex_lock(&(queue->mutex));
+
+	unsigned int inserted = 0;
+	if (wait_slot_available(queue, prio, pts) == PTHREAD_QUEUE_OK) {
+		/* Copy as many objects as there is room for */
+		for (; (inserted < count) && (queue->levels[prio].items < queue->size); ++inserted) {
+			put_item(queue, prio, (const char *) values + (inserted * queue->item_size));
+		}
+	}
+	update_fd(queue);
+	const int waiters = queue->empty_waiters;
+
+	pthread_mutex_unlock(&(queue->mutex));
+
+	/* Nofify blocked threads, one per object */
+	notify_waiters(&(queue->cond_empty), waiters, inserted);
+
+	return inserted;
+
+}
+
 static inline int wait_item_available(pthread_queue_t * queue, struct timespec *ts) {
 
 	int ret;
 
 	while (queue->items == 0) {
 
+		if (is_poll(ts)) {
+			return PTHREAD_QUEUE_EMPTY;
+		}
+
+		queue->empty_waiters++;
 		if (ts != NULL) {
 			ret = pthread_cond_timedwait(&(queue->cond_empty), &(queue->mutex), ts);
 		} else {
 			ret = pthread_cond_wait(&(queue->cond_empty), &(queue->mutex));
 		}
+		queue->empty_waiters--;
 
-		if (ret != 0 && errno != EINTR) {
+		/* A wakeup may coincide with the timeout, so only give up if there still is nothing to get */
+		if ((ret != 0) && (queue->items == 0)) {
 			return PTHREAD_QUEUE_EMPTY; //Timeout
 		}
 	}
@@ -212,22 +372,61 @@ int pthread_queue_dequeue(pthread_queue_t * queue, void * buf, uint32_t timeout)
 	ret = wait_item_available(queue, pts);
 	if (ret == PTHREAD_QUEUE_OK) {
 		/* Coby object to output buffer */
-		memcpy(buf, queue->buffer+(queue->out * queue->item_size), queue->item_size);
-		queue->items--;
-		queue->out = (queue->out + 1) % queue->size;
+		get_item(queue, buf);
 	}
+	update_fd(queue);
+	const int waiters = queue->full_waiters;
 
 	pthread_mutex_unlock(&(queue->mutex));
 
 	if (ret == PTHREAD_QUEUE_OK) {
-		/* Nofify blocked threads */
-		pthread_cond_broadcast(&(queue->cond_full));
+		/* Nofify a blocked thread - all with priorities, as they may wait for room at different priorities */
+		notify_waiters(&(queue->cond_full), waiters, (queue->prios > 1) ? waiters : 1);
 	}
 
 	return ret;
 
 }
 
+int pthread_queue_dequeue_n(pthread_queue_t * queue, void * buf, unsigned int count, uint32_t timeout) {
+
+	struct timespec ts;
+	struct timespec *pts = NULL;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	/* Calculate timeout */
+	if (timeout != CSP_MAX_TIMEOUT) {
+		if (get_deadline(&ts, timeout) != 0) {
+			return 0;
+		}
+		pts = &ts;
+	}
+
+	/* Get queue lock */
+	pthread_mutex_lock(&(queue->mutex));
+
+	unsigned int extracted = 0;
+	if (wait_item_available(queue, pts) == PTHREAD_QUEUE_OK) {
+		/* Copy objects to output buffer */
+		for (; (extracted < count) && (queue->items > 0); ++extracted) {
+			get_item(queue, (char *) buf + (extracted * queue->item_size));
+		}
+	}
+	update_fd(queue);
+	const int waiters = queue->full_waiters;
+
+	pthread_mutex_unlock(&(queue->mutex));
+
+	/* Nofify blocked threads, one per free slot - all with priorities */
+	notify_waiters(&(queue->cond_full), waiters, (queue->prios > 1) ? (unsigned int) waiters : extracted);
+
+	return extracted;
+
+}
+
 int pthread_queue_items(pthread_queue_t * queue) {
 
 	pthread_mutex_lock(&(queue->mutex));
@@ -237,3 +436,18 @@ int pthread_queue_items(pthread_queue_t * queue) {
 	return items;
 	
 }
+
+int pthread_queue_fd(pthread_queue_t * queue) {
+
+	pthread_mutex_lock(&(queue->mutex));
+	if (queue->fd < 0) {
+		queue->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		queue->fd_signalled = 0;
+		update_fd(queue);
+	}
+	int fd = queue->fd;
+	pthread_mutex_unlock(&(queue->mutex));
+
+	return fd;
+
+}
@@ -0,0 +1,380 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk) 
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <csp/csp_types.h>
+
+#if (CSP_USE_QUEUE_LOCKFREE)
+
+#include <csp/arch/posix/ring_queue.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <csp/arch/csp_malloc.h>
+
+/* Slot: sequence number followed by the item */
+typedef struct {
+	uint64_t seq;
+	char item[];
+} ring_slot_t;
+
+static inline ring_slot_t * ring_slot(ring_queue_t * q, ring_queue_ring_t * r, uint64_t pos) {
+	return (ring_slot_t *) &r->slots[(pos % q->size) * q->slot_size];
+}
+
+static inline uint64_t ring_now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static inline void ring_futex_wait(uint32_t * addr, uint32_t val, uint32_t timeout_ms) {
+	struct timespec ts = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000};
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, (timeout_ms != CSP_MAX_TIMEOUT) ? &ts : NULL, NULL, 0);
+}
+
+/* Signal an event count, waking up to count waiters, if anyone is waiting */
+static inline void ring_signal(uint32_t * event, uint32_t * waiters, int count) {
+	// pairs with the fence in ring_wait(): either the waiter sees the change to the queue, or we see the waiter
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiters, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(event, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+	}
+}
+
+/* Signal the readiness descriptor, after adding elements */
+static inline void ring_fd_set(ring_queue_t * q) {
+	const int fd = __atomic_load_n(&q->fd, __ATOMIC_ACQUIRE);
+	if ((fd >= 0) && !__atomic_exchange_n(&q->fd_signalled, 1, __ATOMIC_SEQ_CST)) {
+		const uint64_t value = 1;
+		if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+			__atomic_store_n(&q->fd_signalled, 0, __ATOMIC_SEQ_CST);
+		}
+	}
+}
+
+/* Reset the readiness descriptor when the queue is empty, after (trying to) remove elements.
+   A racing enqueue may leave the descriptor readable on an empty queue, which the next dequeue clears. */
+static inline void ring_fd_clear(ring_queue_t * q) {
+	const int fd = __atomic_load_n(&q->fd, __ATOMIC_ACQUIRE);
+	if ((fd >= 0) && (ring_queue_items(q) == 0) && __atomic_exchange_n(&q->fd_signalled, 0, __ATOMIC_SEQ_CST)) {
+		uint64_t value;
+		if ((read(fd, &value, sizeof(value)) < 0) || (ring_queue_items(q) > 0)) {
+			// elements added meanwhile - signal again
+			ring_fd_set(q);
+		}
+	}
+}
+
+/* Wake producers after removing count elements - with priorities all of them, as they may wait for room in different rings */
+static inline void ring_signal_not_full(ring_queue_t * q, unsigned int count) {
+	ring_signal(&q->not_full, &q->full_waiters, ((q->prios > 1) || (count > INT_MAX)) ? INT_MAX : (int) count);
+}
+
+static int ring_try_enqueue(ring_queue_t * q, unsigned int prio, const void * value) {
+
+	ring_queue_ring_t * r = &q->rings[prio];
+	uint64_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	ring_slot_t * slot;
+	for (;;) {
+		slot = ring_slot(q, r, pos);
+		const int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return CSP_QUEUE_FULL;
+		} else {
+			pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(slot->item, value, q->item_size);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return CSP_QUEUE_OK;
+
+}
+
+static int ring_try_dequeue_ring(ring_queue_t * q, ring_queue_ring_t * r, void * buf) {
+
+	uint64_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	ring_slot_t * slot;
+	for (;;) {
+		slot = ring_slot(q, r, pos);
+		const int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return CSP_QUEUE_ERROR;
+		} else {
+			pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(buf, slot->item, q->item_size);
+	__atomic_store_n(&slot->seq, pos + q->size, __ATOMIC_RELEASE);
+	return CSP_QUEUE_OK;
+
+}
+
+/* Dequeue from the highest priority ring holding an element */
+static int ring_try_dequeue(ring_queue_t * q, void * buf) {
+
+	for (uint32_t prio = 0; prio < q->prios; ++prio) {
+		if (ring_try_dequeue_ring(q, &q->rings[prio], buf) == CSP_QUEUE_OK) {
+			return CSP_QUEUE_OK;
+		}
+	}
+	return CSP_QUEUE_ERROR;
+
+}
+
+/* Try operation, waiting on event count until it succeeds or times out */
+static int ring_wait(ring_queue_t * q, int (*op)(ring_queue_t *, unsigned int, void *), unsigned int prio, void * arg, uint32_t * event, uint32_t * waiters, uint32_t timeout) {
+
+	const uint64_t deadline = (timeout != CSP_MAX_TIMEOUT) ? (ring_now_ms() + timeout) : 0;
+	for (;;) {
+		__atomic_add_fetch(waiters, 1, __ATOMIC_RELAXED);
+		const uint32_t key = __atomic_load_n(event, __ATOMIC_ACQUIRE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (op(q, prio, arg) == CSP_QUEUE_OK) {
+			__atomic_sub_fetch(waiters, 1, __ATOMIC_RELAXED);
+			return CSP_QUEUE_OK;
+		}
+		uint32_t wait_ms = CSP_MAX_TIMEOUT;
+		if (timeout != CSP_MAX_TIMEOUT) {
+			const uint64_t now = ring_now_ms();
+			if (now >= deadline) {
+				__atomic_sub_fetch(waiters, 1, __ATOMIC_RELAXED);
+				return CSP_QUEUE_ERROR;
+			}
+			wait_ms = deadline - now;
+		}
+		ring_futex_wait(event, key, wait_ms);
+		__atomic_sub_fetch(waiters, 1, __ATOMIC_RELAXED);
+	}
+
+}
+
+static int ring_op_enqueue(ring_queue_t * q, unsigned int prio, void * value) {
+	return ring_try_enqueue(q, prio, value);
+}
+
+static int ring_op_dequeue(ring_queue_t * q, unsigned int prio, void * buf) {
+	(void) prio;
+	return ring_try_dequeue(q, buf);
+}
+
+ring_queue_t * ring_queue_create(int length, size_t item_size) {
+
+	return ring_queue_create_prio(length, item_size, 1);
+
+}
+
+ring_queue_t * ring_queue_create_prio(int length, size_t item_size, unsigned int prios) {
+
+	if ((length <= 0) || (item_size == 0) || (prios == 0) || (prios > RING_QUEUE_PRIO_MAX)) {
+		return NULL;
+	}
+
+	ring_queue_t * q = NULL;
+	const size_t q_size = sizeof(*q) + (prios * sizeof(ring_queue_ring_t));
+	if (posix_memalign((void **) &q, 64, q_size) != 0) {
+		return NULL;
+	}
+	memset(q, 0, q_size);
+	q->fd = -1;
+
+	q->size = length;
+	q->item_size = item_size;
+	q->slot_size = (sizeof(ring_slot_t) + item_size + (sizeof(uint64_t) - 1)) & ~(sizeof(uint64_t) - 1);
+	q->prios = prios;
+	for (uint32_t prio = 0; prio < prios; ++prio) {
+		ring_queue_ring_t * r = &q->rings[prio];
+		r->slots = csp_malloc((size_t) q->size * q->slot_size);
+		if (r->slots == NULL) {
+			ring_queue_delete(q);
+			return NULL;
+		}
+		for (uint32_t i = 0; i < q->size; ++i) {
+			ring_slot(q, r, i)->seq = i;
+		}
+	}
+
+	return q;
+
+}
+
+void ring_queue_delete(ring_queue_t * q) {
+
+	if (q == NULL)
+		return;
+
+	if (q->fd >= 0) {
+		close(q->fd);
+	}
+	for (uint32_t prio = 0; prio < q->prios; ++prio) {
+		csp_free(q->rings[prio].slots);
+	}
+	free(q);
+
+}
+
+int ring_queue_enqueue(ring_queue_t * queue, const void * value, uint32_t timeout) {
+
+	return ring_queue_enqueue_prio(queue, value, 0, timeout);
+
+}
+
+int ring_queue_enqueue_prio(ring_queue_t * queue, const void * value, unsigned int prio, uint32_t timeout) {
+
+	if (prio >= queue->prios) {
+		return CSP_QUEUE_ERROR;
+	}
+
+	int ret = ring_try_enqueue(queue, prio, value);
+	if ((ret != CSP_QUEUE_OK) && timeout) {
+		ret = ring_wait(queue, ring_op_enqueue, prio, (void *) value, &queue->not_full, &queue->full_waiters, timeout);
+	}
+	if (ret == CSP_QUEUE_OK) {
+		ring_fd_set(queue);
+		ring_signal(&queue->not_empty, &queue->empty_waiters, 1);
+	}
+	return ret;
+
+}
+
+int ring_queue_dequeue(ring_queue_t * queue, void * buf, uint32_t timeout) {
+
+	int ret = ring_try_dequeue(queue, buf);
+	if ((ret != CSP_QUEUE_OK) && timeout) {
+		ret = ring_wait(queue, ring_op_dequeue, 0, buf, &queue->not_empty, &queue->empty_waiters, timeout);
+	}
+	ring_fd_clear(queue);
+	if (ret == CSP_QUEUE_OK) {
+		ring_signal_not_full(queue, 1);
+	}
+	return ret;
+
+}
+
+int ring_queue_enqueue_n(ring_queue_t * queue, const void * values, unsigned int count, uint32_t timeout) {
+
+	return ring_queue_enqueue_prio_n(queue, values, count, 0, timeout);
+
+}
+
+int ring_queue_enqueue_prio_n(ring_queue_t * queue, const void * values, unsigned int count, unsigned int prio, uint32_t timeout) {
+
+	if ((count == 0) || (prio >= queue->prios)) {
+		return 0;
+	}
+
+	int ret = ring_try_enqueue(queue, prio, values);
+	if ((ret != CSP_QUEUE_OK) && timeout) {
+		ret = ring_wait(queue, ring_op_enqueue, prio, (void *) values, &queue->not_full, &queue->full_waiters, timeout);
+	}
+	if (ret != CSP_QUEUE_OK) {
+		return 0;
+	}
+
+	unsigned int inserted = 1;
+	for (; (inserted < count) && (ring_try_enqueue(queue, prio, (const char *) values + (inserted * queue->item_size)) == CSP_QUEUE_OK); ++inserted);
+	ring_fd_set(queue);
+	// a consumer per element, futex wakes no more than are waiting
+	ring_signal(&queue->not_empty, &queue->empty_waiters, (inserted > INT_MAX) ? INT_MAX : (int) inserted);
+
+	return inserted;
+
+}
+
+int ring_queue_dequeue_n(ring_queue_t * queue, void * buf, unsigned int count, uint32_t timeout) {
+
+	if (count == 0) {
+		return 0;
+	}
+
+	int ret = ring_try_dequeue(queue, buf);
+	if ((ret != CSP_QUEUE_OK) && timeout) {
+		ret = ring_wait(queue, ring_op_dequeue, 0, buf, &queue->not_empty, &queue->empty_waiters, timeout);
+	}
+	if (ret != CSP_QUEUE_OK) {
+		ring_fd_clear(queue);
+		return 0;
+	}
+
+	unsigned int extracted = 1;
+	for (; (extracted < count) && (ring_try_dequeue(queue, (char *) buf + (extracted * queue->item_size)) == CSP_QUEUE_OK); ++extracted);
+	ring_fd_clear(queue);
+	ring_signal_not_full(queue, extracted);
+
+	return extracted;
+
+}
+
+int ring_queue_items(ring_queue_t * queue) {
+
+	int total = 0;
+	for (uint32_t prio = 0; prio < queue->prios; ++prio) {
+		const uint64_t head = __atomic_load_n(&queue->rings[prio].head, __ATOMIC_ACQUIRE);
+		const uint64_t tail = __atomic_load_n(&queue->rings[prio].tail, __ATOMIC_ACQUIRE);
+		// positions are read separately, so clamp a racing result
+		const int64_t items = (int64_t)(tail - head);
+		if (items > 0) {
+			total += (items > queue->size) ? (int) queue->size : (int) items;
+		}
+	}
+	return total;
+
+}
+
+int ring_queue_fd(ring_queue_t * queue) {
+
+	int fd = __atomic_load_n(&queue->fd, __ATOMIC_ACQUIRE);
+	if (fd < 0) {
+		int new_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (new_fd < 0) {
+			return -1;
+		}
+		if (__atomic_compare_exchange_n(&queue->fd, &fd, new_fd, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			fd = new_fd;
+			if (ring_queue_items(queue) > 0) {
+				ring_fd_set(queue);
+			}
+		} else {
+			// created by another thread
+			close(new_fd);
+		}
+	}
+	return fd;
+
+}
+
+#endif // CSP_USE_QUEUE_LOCKFREE
@@ -25,6 +25,10 @@ csp_queue_handle_t csp_queue_create(int length, size_t item_size) {
 	return windows_queue_create(length, item_size);
 }
 
+csp_queue_handle_t csp_queue_create_prio(int length, size_t item_size, unsigned int prios) {
+	return windows_queue_create_prio(length, item_size, prios);
+}
+
 void csp_queue_remove(csp_queue_handle_t queue) {
 	windows_queue_delete(queue);
 }
@@ -39,6 +43,24 @@ int csp_queue_enqueue_isr(csp_queue_handle_t handle, const void * value, CSP_BAS
 	return windows_queue_enqueue(handle, value, 0);
 }
 
+int csp_queue_enqueue_prio(csp_queue_handle_t handle, const void * value, unsigned int prio, uint32_t timeout) {
+	return windows_queue_enqueue_prio(handle, value, prio, timeout);
+}
+
+int csp_queue_enqueue_prio_isr(csp_queue_handle_t handle, const void * value, unsigned int prio, CSP_BASE_TYPE * task_woken) {
+	if( task_woken != NULL )
+		*task_woken = 0;
+	return windows_queue_enqueue_prio(handle, value, prio, 0);
+}
+
+int csp_queue_enqueue_n(csp_queue_handle_t handle, const void * values, unsigned int count, uint32_t timeout) {
+	return windows_queue_enqueue_n(handle, values, count, timeout);
+}
+
+int csp_queue_enqueue_prio_n(csp_queue_handle_t handle, const void * values, unsigned int count, unsigned int prio, uint32_t timeout) {
+	return windows_queue_enqueue_prio_n(handle, values, count, prio, timeout);
+}
+
 int csp_queue_dequeue(csp_queue_handle_t handle, void *buf, uint32_t timeout) {
 	return windows_queue_dequeue(handle, buf, timeout);
 }
@@ -50,6 +72,10 @@ int csp_queue_dequeue_isr(csp_queue_handle_t handle, void * buf, CSP_BASE_TYPE *
 	return windows_queue_dequeue(handle, buf, 0);
 }
 
+int csp_queue_dequeue_n(csp_queue_handle_t handle, void * buf, unsigned int count, uint32_t timeout) {
+	return windows_queue_dequeue_n(handle, buf, count, timeout);
+}
+
 int csp_queue_size(csp_queue_handle_t handle) {
 	return windows_queue_items(handle);
 }
@@ -57,3 +83,7 @@ int csp_queue_size(csp_queue_handle_t handle) {
 int csp_queue_size_isr(csp_queue_handle_t handle) {
 	return windows_queue_items(handle);
 }
+
+int csp_queue_fd(csp_queue_handle_t handle) {
+	return -1;
+}
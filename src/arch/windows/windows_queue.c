@@ -22,39 +22,73 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <Windows.h>
 #include <synchapi.h>
 
+typedef struct {
+    int items;
+    int head_idx;
+} windows_queue_level_t;
+
 struct windows_queue_s {
     void * buffer;
     int size;
     int item_size;
     int items;
-    int head_idx;
+    unsigned int prios;
     CRITICAL_SECTION mutex;
     CONDITION_VARIABLE cond_full;
     CONDITION_VARIABLE cond_empty;
+    windows_queue_level_t levels[];
 };
 
-static int queueFull(windows_queue_t * queue) {
-	return queue->items == queue->size;
+static int queueFull(windows_queue_t * queue, unsigned int prio) {
+	return queue->levels[prio].items == queue->size;
 }
 
 static int queueEmpty(windows_queue_t * queue) {
 	return queue->items == 0;
 }
 
+static void queuePut(windows_queue_t * queue, unsigned int prio, const void * value) {
+	windows_queue_level_t * level = &queue->levels[prio];
+	int offset = ((prio * queue->size) + ((level->head_idx+level->items) % queue->size)) * queue->item_size;
+	memcpy((unsigned char*)queue->buffer + offset, value, queue->item_size);
+	level->items++;
+	queue->items++;
+}
+
+static void queueGet(windows_queue_t * queue, void * buf) {
+	unsigned int prio = 0;
+	while(queue->levels[prio].items == 0)
+		prio++;
+	windows_queue_level_t * level = &queue->levels[prio];
+	memcpy(buf, (unsigned char*)queue->buffer+(((prio * queue->size) + level->head_idx) * queue->item_size), queue->item_size);
+	level->items--;
+	level->head_idx = (level->head_idx + 1) % queue->size;
+	queue->items--;
+}
+
 windows_queue_t * windows_queue_create(int length, size_t item_size) {
+	return windows_queue_create_prio(length, item_size, 1);
+}
 
-	windows_queue_t *queue = (windows_queue_t*)malloc(sizeof(windows_queue_t));
+windows_queue_t * windows_queue_create_prio(int length, size_t item_size, unsigned int prios) {
+
+	windows_queue_t *queue = NULL;
+	if((prios == 0) || (prios > CSP_QUEUE_PRIO_MAX))
+		goto queue_malloc_failed;
+
+	queue = (windows_queue_t*)malloc(sizeof(windows_queue_t) + (prios * sizeof(windows_queue_level_t)));
 	if(queue == NULL)
 		goto queue_malloc_failed;
 
-	queue->buffer = malloc(length*item_size);
+	queue->buffer = malloc(prios*length*item_size);
 	if(queue->buffer == NULL)
 		goto buffer_malloc_failed;
 
 	queue->size = length;
 	queue->item_size = item_size;
 	queue->items = 0;
-	queue->head_idx = 0;
+	queue->prios = prios;
+	memset(queue->levels, 0, prios * sizeof(windows_queue_level_t));
 
 	InitializeCriticalSection(&(queue->mutex));
 	InitializeConditionVariable(&(queue->cond_full));
@@ -78,25 +112,54 @@ void windows_queue_delete(windows_queue_t * q) {
 }
 
 int windows_queue_enqueue(windows_queue_t * queue, const void * value, int timeout) {
+	return windows_queue_enqueue_prio(queue, value, 0, timeout);
+}
+
+int windows_queue_enqueue_prio(windows_queue_t * queue, const void * value, unsigned int prio, int timeout) {
 
-	int offset;
+	if(prio >= queue->prios)
+		return WINDOWS_QUEUE_ERROR;
 	EnterCriticalSection(&(queue->mutex));
-	while(queueFull(queue)) {
+	while(queueFull(queue, prio)) {
 		int ret = SleepConditionVariableCS(&(queue->cond_full), &(queue->mutex), timeout);
 		if( !ret ) {
 			LeaveCriticalSection(&(queue->mutex));
 			return ret == WAIT_TIMEOUT ? WINDOWS_QUEUE_FULL : WINDOWS_QUEUE_ERROR;
 		}
 	}
-	offset = ((queue->head_idx+queue->items) % queue->size) * queue->item_size;
-	memcpy((unsigned char*)queue->buffer + offset, value, queue->item_size);
-	queue->items++;
+	queuePut(queue, prio, value);
 
 	LeaveCriticalSection(&(queue->mutex));
 	WakeAllConditionVariable(&(queue->cond_empty));
 	return WINDOWS_QUEUE_OK;
 }
 
+int windows_queue_enqueue_n(windows_queue_t * queue, const void * values, unsigned int count, int timeout) {
+	return windows_queue_enqueue_prio_n(queue, values, count, 0, timeout);
+}
+
+int windows_queue_enqueue_prio_n(windows_queue_t * queue, const void * values, unsigned int count, unsigned int prio, int timeout) {
+
+	unsigned int inserted = 0;
+	if ((count == 0) || (prio >= queue->prios)) {
+		return 0;
+	}
+	EnterCriticalSection(&(queue->mutex));
+	while(queueFull(queue, prio)) {
+		if( !SleepConditionVariableCS(&(queue->cond_full), &(queue->mutex), timeout) ) {
+			LeaveCriticalSection(&(queue->mutex));
+			return 0;
+		}
+	}
+	for(; (inserted < count) && !queueFull(queue, prio); ++inserted) {
+		queuePut(queue, prio, (const unsigned char*)values + (inserted * queue->item_size));
+	}
+
+	LeaveCriticalSection(&(queue->mutex));
+	WakeAllConditionVariable(&(queue->cond_empty));
+	return inserted;
+}
+
 int windows_queue_dequeue(windows_queue_t * queue, void * buf, int timeout) {
 
 	EnterCriticalSection(&(queue->mutex));
@@ -107,15 +170,35 @@ int windows_queue_dequeue(windows_queue_t * queue, void * buf, int timeout) {
 			return ret == WAIT_TIMEOUT ? WINDOWS_QUEUE_EMPTY : WINDOWS_QUEUE_ERROR;
 		}
 	}
-	memcpy(buf, (unsigned char*)queue->buffer+(queue->head_idx%queue->size*queue->item_size), queue->item_size);
-	queue->items--;
-	queue->head_idx = (queue->head_idx + 1) % queue->size;
+	queueGet(queue, buf);
 
 	LeaveCriticalSection(&(queue->mutex));
 	WakeAllConditionVariable(&(queue->cond_full));
 	return WINDOWS_QUEUE_OK;
 }
 
+int windows_queue_dequeue_n(windows_queue_t * queue, void * buf, unsigned int count, int timeout) {
+
+	unsigned int extracted = 0;
+	if (count == 0) {
+		return 0;
+	}
+	EnterCriticalSection(&(queue->mutex));
+	while(queueEmpty(queue)) {
+		if( !SleepConditionVariableCS(&(queue->cond_empty), &(queue->mutex), timeout) ) {
+			LeaveCriticalSection(&(queue->mutex));
+			return 0;
+		}
+	}
+	for(; (extracted < count) && !queueEmpty(queue); ++extracted) {
+		queueGet(queue, (unsigned char*)buf + (extracted * queue->item_size));
+	}
+
+	LeaveCriticalSection(&(queue->mutex));
+	WakeAllConditionVariable(&(queue->cond_full));
+	return extracted;
+}
+
 int windows_queue_items(windows_queue_t * queue) {
 
 	int items;
@@ -35,9 +35,14 @@ extern "C" {
 typedef struct windows_queue_s windows_queue_t;
 
 windows_queue_t * windows_queue_create(int length, size_t item_size);
+windows_queue_t * windows_queue_create_prio(int length, size_t item_size, unsigned int prios);
 void windows_queue_delete(windows_queue_t * q);
 int windows_queue_enqueue(windows_queue_t * queue, const void * value, int timeout);
+int windows_queue_enqueue_prio(windows_queue_t * queue, const void * value, unsigned int prio, int timeout);
+int windows_queue_enqueue_n(windows_queue_t * queue, const void * values, unsigned int count, int timeout);
+int windows_queue_enqueue_prio_n(windows_queue_t * queue, const void * values, unsigned int count, unsigned int prio, int timeout);
 int windows_queue_dequeue(windows_queue_t * queue, void * buf, int timeout);
+int windows_queue_dequeue_n(windows_queue_t * queue, void * buf, unsigned int count, int timeout);
 int windows_queue_items(windows_queue_t * queue);
 
 #ifdef __cplusplus
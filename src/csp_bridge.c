@@ -79,6 +79,12 @@ static CSP_DEFINE_TASK(csp_bridge) {
 
 int csp_bridge_start(unsigned int task_stack_size, unsigned int task_priority, csp_iface_t * if_a, csp_iface_t * if_b) {
 
+	/* The bridge only reads the first shard, packets hashed to other shards would never be bridged */
+	if (csp_qfifo_shards() != 1) {
+		csp_log_error("Bridge requires a single router shard, route_shards: %u", csp_qfifo_shards());
+		return CSP_ERR_INVAL;
+	}
+
 	/* Set static references to A/B side of bridge */
 	bif_a.iface = if_a;
 	bif_b.iface = if_b;
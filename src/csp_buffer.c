@@ -21,25 +21,108 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/csp_buffer.h>
 
 #include <csp/csp_debug.h>
+#include <csp/csp_crc32.h>
+#include <csp/crypto/csp_hmac.h>
+#include <csp/crypto/csp_xtea.h>
 #include <csp/arch/csp_queue.h>
 #include <csp/arch/csp_malloc.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_time.h>
 #include "csp_init.h"
+#include "csp_skbf.h"
+#include "transport/csp_transport.h"
+
+#if (CSP_POSIX || CSP_MACOSX)
+#include <pthread.h>
+#define CSP_BUFFER_USE_MAGAZINE 1
+#endif
 
 #ifndef CSP_BUFFER_ALIGN
 #define CSP_BUFFER_ALIGN	(sizeof(int *))
 #endif
 
-/** Internal buffer header */
+// Max buffers moved to/from the pool in one operation by csp_buffer_get_n()/csp_buffer_free_n()
+#define CSP_BUFFER_BATCH_MAX	32
+
+#ifndef CSP_BUFFER_CACHELINE
+#define CSP_BUFFER_CACHELINE	64
+#endif
+
+/** Internal buffer header (slab: stored in a separate array, not in front of the packet) */
 typedef struct csp_skbf_s {
-	unsigned int refcount;
+	uint16_t refcount;
+	uint16_t head; // bytes pushed in front of csp_packet_t.id, see csp_buffer_push()
+	uint32_t next; // free: index + 1 of next free buffer (lock-free pool), allocated: next segment in chain (see csp_buffer_chain_link())
+	uint32_t deadline; // time (mS) the packet expires, 0 for none, see csp_buffer_set_deadline()
+	uint32_t queued; // time (mS) the packet was queued, see csp_skbf_set_queued()
+	uint32_t sent; // time (mS) the packet was sent, see csp_skbf_set_sent()
+	uint32_t quarantine; // end (mS) of RDP EACK quarantine, see csp_skbf_set_quarantine()
+	uint16_t length; // csp_packet_t.length while covered by pushed data, see csp_buffer_push()
 	void * skbf_addr;
-	char skbf_data[]; // -> csp_packet_t
+#if (CSP_USE_BUFFER_SLAB) == 0
+	char skbf_data[]; // -> headroom + csp_packet_t
+#endif
 } csp_skbf_t;
 
-// Queue of free CSP buffers
-static csp_queue_handle_t csp_buffers;
+/** Pool of buffers with the same data size (size class) */
+typedef struct {
+	char * start; // first buffer in pool
+	char * end; // end of pool
+	unsigned int skbf_size; // size of each buffer in the pool, including csp_skbf_t (slab: excluding csp_skbf_t, multiple of cache line)
+#if (CSP_USE_BUFFER_SLAB)
+	csp_skbf_t * meta; // buffer headers, meta[index] belongs to buffer at start + (index * skbf_size)
+#endif
+	uint16_t data_size;
+	uint16_t count;
+#if (CSP_USE_BUFFER_LOCKFREE)
+	// Head of free buffers: low 32 bits is index + 1 of first free buffer (0 = empty), high 32 bits is an ABA tag
+	uint64_t free_head;
+	// Number of free buffers
+	unsigned int free_count;
+#else
+	// Queue of free buffers
+	csp_queue_handle_t queue;
+#endif
+} csp_buffer_class_pool_t;
+
+// Size classes, sorted by data size
+static csp_buffer_class_pool_t csp_buffer_classes[CSP_BUFFER_CLASS_MAX];
+static unsigned int csp_buffer_class_count;
 // Chunk of memory allocated for CSP buffers
 static char * csp_buffer_pool;
+static size_t csp_buffer_pool_size;
+// Memory options obtained for the chunk, see csp_malloc_pool()
+static unsigned int csp_buffer_pool_memory;
+
+/** Task waiting for a buffer, see csp_buffer_get_timeout() */
+typedef struct csp_buffer_waiter_s {
+	size_t data_size;
+	uint8_t prio;
+	csp_skbf_t * buf; // buffer handed over by csp_buffer_wait_dispatch()
+	csp_bin_sem_handle_t sem;
+	struct csp_buffer_waiter_s * next;
+} csp_buffer_waiter_t;
+
+// FIFO of waiting tasks, protected by csp_buffer_wait_lock
+static csp_buffer_waiter_t * csp_buffer_waiters;
+static csp_bin_sem_handle_t csp_buffer_wait_lock;
+// Number of waiting tasks, checked without the lock when freeing buffers
+static unsigned int csp_buffer_waiting;
+// Semaphore of the first waiting task, woken by csp_buffer_free_isr() (which can't take csp_buffer_wait_lock)
+static csp_bin_sem_handle_t * csp_buffer_wait_first;
+// Number of csp_buffer_free_isr() calls using csp_buffer_wait_first, a waiter can't remove its semaphore until 0
+static unsigned int csp_buffer_wait_isr;
+
+// Number of allocations refused by priority reservations, see csp_conf_t.buffer_reserve
+static uint32_t csp_buffer_limited_count[CSP_PRIORITIES];
+
+// Low watermark, see csp_buffer_set_watermark()
+static int csp_buffer_watermark_level;
+static csp_buffer_watermark_callback_t csp_buffer_watermark_callback;
+static bool csp_buffer_watermark_low;
+// Headroom reserved in front of each csp_packet_t (aligned) and tailroom reserved after data
+static unsigned int csp_buffer_headroom_size;
+static unsigned int csp_buffer_tailroom_size;
 
 // Ensure the csp_packet is correctly aligned (as it is not packed)
 CSP_STATIC_ASSERT(CSP_HEADER_LENGTH == sizeof(csp_id_t), csp_header_length);
@@ -48,177 +131,1486 @@ CSP_STATIC_ASSERT(offsetof(csp_packet_t, length) == 10, length_field_misaligned)
 CSP_STATIC_ASSERT(offsetof(csp_packet_t, id) == 12, csp_id_field_misaligned);
 CSP_STATIC_ASSERT(offsetof(csp_packet_t, data) == 16, data_field_misaligned);
 
-int csp_buffer_init(void) {
+#if (CSP_USE_BUFFER_SLAB)
 
-	// calculate total size and ensure correct alignment (int *) for buffers
-	const unsigned int skbfsize = CSP_BUFFER_ALIGN * ((sizeof(csp_skbf_t) + csp_buffer_size() + (CSP_BUFFER_ALIGN - 1)) / CSP_BUFFER_ALIGN);
+static inline csp_skbf_t * csp_buffer_pool_at(const csp_buffer_class_pool_t * cls, uint32_t index) {
+	return &cls->meta[index];
+}
 
-	csp_buffer_pool = csp_malloc(csp_conf.buffers * skbfsize);
-	if (csp_buffer_pool == NULL)
-		goto fail_malloc;
+static inline uint32_t csp_buffer_pool_index(const csp_buffer_class_pool_t * cls, const csp_skbf_t * buf) {
+	return (uint32_t)(buf - cls->meta);
+}
+
+#else
+
+static inline csp_skbf_t * csp_buffer_pool_at(const csp_buffer_class_pool_t * cls, uint32_t index) {
+	return (csp_skbf_t *) &cls->start[index * cls->skbf_size];
+}
+
+static inline uint32_t csp_buffer_pool_index(const csp_buffer_class_pool_t * cls, const csp_skbf_t * buf) {
+	return (uint32_t)(((const char *) buf - cls->start) / cls->skbf_size);
+}
 
-	csp_buffers = csp_queue_create(csp_conf.buffers, sizeof(void *));
-	if (!csp_buffers)
-		goto fail_queue;
+#endif
+
+#if (CSP_USE_BUFFER_LOCKFREE)
+
+/*
+ * Lock-free pool: the free buffers form a stack (Treiber stack), linked by index through csp_skbf_t.next.
+ * The ABA problem is avoided by bumping the tag in the upper half of the head on every update, so a
+ * pop racing with a pop/push of the same buffer will fail the compare-and-swap and retry.
+ * The pool memory is never released while CSP is running, so reading next of a buffer
+ * that has just been taken by another thread is harmless - the CAS will fail.
+ */
 
-	for (unsigned int i = 0; i < csp_conf.buffers; i++) {
-		csp_skbf_t * buf = (void *) &csp_buffer_pool[i * skbfsize];
-		buf->skbf_addr = buf;
-		csp_queue_enqueue(csp_buffers, &buf, 0);
+static csp_skbf_t * csp_buffer_pool_pop(csp_buffer_class_pool_t * cls) {
+
+	uint64_t head = __atomic_load_n(&cls->free_head, __ATOMIC_ACQUIRE);
+	for (;;) {
+		const uint32_t first = (uint32_t) head;
+		if (first == 0) {
+			return NULL;
+		}
+		csp_skbf_t * buf = csp_buffer_pool_at(cls, first - 1);
+		const uint32_t next = __atomic_load_n(&buf->next, __ATOMIC_RELAXED);
+		const uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+		if (__atomic_compare_exchange_n(&cls->free_head, &head, new_head, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+			__atomic_fetch_sub(&cls->free_count, 1, __ATOMIC_RELAXED);
+			return buf;
+		}
 	}
 
-	return CSP_ERR_NONE;
+}
 
-fail_queue:
-	csp_buffer_free_resources();
-fail_malloc:
-	return CSP_ERR_NOMEM;
+static void csp_buffer_pool_push(csp_buffer_class_pool_t * cls, csp_skbf_t * buf) {
+
+	const uint32_t first = csp_buffer_pool_index(cls, buf) + 1;
+	uint64_t head = __atomic_load_n(&cls->free_head, __ATOMIC_RELAXED);
+	uint64_t new_head;
+	do {
+		__atomic_store_n(&buf->next, (uint32_t) head, __ATOMIC_RELAXED);
+		new_head = (((head >> 32) + 1) << 32) | first;
+	} while (!__atomic_compare_exchange_n(&cls->free_head, &head, new_head, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	__atomic_fetch_add(&cls->free_count, 1, __ATOMIC_RELAXED);
 
 }
 
-void csp_buffer_free_resources(void) {
+/* Pop up to max buffers with a single compare-and-swap */
+static unsigned int csp_buffer_pool_pop_n(csp_buffer_class_pool_t * cls, csp_skbf_t ** bufs, unsigned int max) {
 
-	if (csp_buffers) {
-		csp_queue_remove(csp_buffers);
-		csp_buffers = NULL;
+	uint64_t head = __atomic_load_n(&cls->free_head, __ATOMIC_ACQUIRE);
+	for (;;) {
+		uint32_t next = (uint32_t) head;
+		unsigned int count = 0;
+		for (; (count < max) && next && (next <= cls->count); ++count) {
+			bufs[count] = csp_buffer_pool_at(cls, next - 1);
+			next = __atomic_load_n(&bufs[count]->next, __ATOMIC_RELAXED);
+		}
+		if (count == 0) {
+			return 0;
+		}
+		// an invalid index means the stack changed while walking it, so the CAS fails
+		const uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+		if (__atomic_compare_exchange_n(&cls->free_head, &head, new_head, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+			__atomic_fetch_sub(&cls->free_count, count, __ATOMIC_RELAXED);
+			return count;
+		}
 	}
-	csp_free(csp_buffer_pool);
-	csp_buffer_pool = NULL;
 
 }
 
-void *csp_buffer_get_isr(size_t _data_size) {
+/* Push buffers with a single compare-and-swap */
+static void csp_buffer_pool_push_n(csp_buffer_class_pool_t * cls, csp_skbf_t * const * bufs, unsigned int count) {
 
-	if (_data_size > csp_conf.buffer_data_size)
-		return NULL;
+	if (count == 0) {
+		return;
+	}
 
-	csp_skbf_t * buffer = NULL;
+	// link the buffers privately, only the last one needs updating in the CAS loop
+	for (unsigned int i = 0; (i + 1) < count; ++i) {
+		__atomic_store_n(&bufs[i]->next, csp_buffer_pool_index(cls, bufs[i + 1]) + 1, __ATOMIC_RELAXED);
+	}
+	csp_skbf_t * last = bufs[count - 1];
+	const uint32_t first = csp_buffer_pool_index(cls, bufs[0]) + 1;
+	uint64_t head = __atomic_load_n(&cls->free_head, __ATOMIC_RELAXED);
+	uint64_t new_head;
+	do {
+		__atomic_store_n(&last->next, (uint32_t) head, __ATOMIC_RELAXED);
+		new_head = (((head >> 32) + 1) << 32) | first;
+	} while (!__atomic_compare_exchange_n(&cls->free_head, &head, new_head, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	__atomic_fetch_add(&cls->free_count, count, __ATOMIC_RELAXED);
+
+}
+
+static inline csp_skbf_t * csp_buffer_pool_pop_isr(csp_buffer_class_pool_t * cls) {
+	return csp_buffer_pool_pop(cls);
+}
+
+static inline void csp_buffer_pool_push_isr(csp_buffer_class_pool_t * cls, csp_skbf_t * buf) {
+	csp_buffer_pool_push(cls, buf);
+}
+
+static inline int csp_buffer_pool_create(csp_buffer_class_pool_t * cls) {
+	cls->free_head = 0;
+	cls->free_count = 0;
+	return CSP_ERR_NONE;
+}
+
+static inline void csp_buffer_pool_remove(csp_buffer_class_pool_t * cls) {
+	cls->free_head = 0;
+	cls->free_count = 0;
+}
+
+static inline int csp_buffer_pool_remaining(const csp_buffer_class_pool_t * cls) {
+	return __atomic_load_n(&cls->free_count, __ATOMIC_RELAXED);
+}
+
+#else
+
+static csp_skbf_t * csp_buffer_pool_pop(csp_buffer_class_pool_t * cls) {
+	csp_skbf_t * buf = NULL;
+	csp_queue_dequeue(cls->queue, &buf, 0);
+	return buf;
+}
+
+static void csp_buffer_pool_push(csp_buffer_class_pool_t * cls, csp_skbf_t * buf) {
+	csp_queue_enqueue(cls->queue, &buf, 0);
+}
+
+static unsigned int csp_buffer_pool_pop_n(csp_buffer_class_pool_t * cls, csp_skbf_t ** bufs, unsigned int max) {
+	unsigned int count = 0;
+	for (int n; (count < max) && ((n = csp_queue_dequeue_n(cls->queue, &bufs[count], max - count, 0)) > 0); count += n);
+	return count;
+}
+
+static void csp_buffer_pool_push_n(csp_buffer_class_pool_t * cls, csp_skbf_t * const * bufs, unsigned int count) {
+	// the queue holds all buffers of the class, so there is always room
+	for (int n; count && ((n = csp_queue_enqueue_n(cls->queue, bufs, count, 0)) > 0); bufs += n, count -= n);
+}
+
+static inline csp_skbf_t * csp_buffer_pool_pop_isr(csp_buffer_class_pool_t * cls) {
+	csp_skbf_t * buf = NULL;
 	CSP_BASE_TYPE task_woken = 0;
-	csp_queue_dequeue_isr(csp_buffers, &buffer, &task_woken);
-	if (buffer == NULL)
-		return NULL;
+	csp_queue_dequeue_isr(cls->queue, &buf, &task_woken);
+	return buf;
+}
 
-	if (buffer != buffer->skbf_addr)
-		return NULL;
+static inline void csp_buffer_pool_push_isr(csp_buffer_class_pool_t * cls, csp_skbf_t * buf) {
+	CSP_BASE_TYPE task_woken = 0;
+	csp_queue_enqueue_isr(cls->queue, &buf, &task_woken);
+}
 
-	buffer->refcount = 1;
-	return buffer->skbf_data;
+static inline int csp_buffer_pool_create(csp_buffer_class_pool_t * cls) {
+	cls->queue = csp_queue_create(cls->count, sizeof(void *));
+	return (cls->queue) ? CSP_ERR_NONE : CSP_ERR_NOMEM;
+}
 
+static inline void csp_buffer_pool_remove(csp_buffer_class_pool_t * cls) {
+	if (cls->queue) {
+		csp_queue_remove(cls->queue);
+		cls->queue = NULL;
+	}
 }
 
-void *csp_buffer_get(size_t _data_size) {
+static inline int csp_buffer_pool_remaining(const csp_buffer_class_pool_t * cls) {
+	return csp_queue_size(cls->queue);
+}
 
-	if (_data_size > csp_conf.buffer_data_size) {
-		csp_log_error("GET: Attempt to allocate too large data size %u > max %u", (unsigned int) _data_size, (unsigned int) csp_conf.buffer_data_size);
-		return NULL;
+#endif // CSP_USE_BUFFER_LOCKFREE
+
+#if (CSP_BUFFER_USE_MAGAZINE)
+
+/*
+ * Per-thread magazines: each thread caches up to csp_conf.buffer_magazine_size free buffers (per size class), so
+ * buffers allocated and freed on the same thread don't touch the global pool.
+ * An empty magazine is refilled with half a magazine from the global pool, and a full magazine
+ * is flushed down to half, so a thread alternating get/free doesn't hit the global pool on every call.
+ * Magazines are registered in a list, so csp_buffer_remaining() can include cached buffers, and flushed
+ * when the thread exits.
+ * Priority reservations are kept in the global pool, where any thread can use them: a refill never takes more
+ * than the reservation allows, while buffers already cached by a thread are used by it without a check.
+ */
+
+typedef struct {
+	unsigned int count; // number of cached buffers, only written by owning thread
+	csp_skbf_t * buf[CSP_BUFFER_MAGAZINE_MAX];
+} csp_buffer_magazine_class_t;
+
+typedef struct csp_buffer_magazine_s {
+	unsigned int generation; // pool generation the cached buffers belong to
+	bool registered;
+	struct csp_buffer_magazine_s * next;
+	csp_buffer_magazine_class_t cls[CSP_BUFFER_CLASS_MAX];
+} csp_buffer_magazine_t;
+
+static __thread csp_buffer_magazine_t csp_buffer_magazine;
+// Bumped by csp_buffer_init(), invalidating magazines from a previous initialization
+static unsigned int csp_buffer_generation;
+// List of all registered magazines
+static csp_buffer_magazine_t * csp_buffer_magazines;
+static pthread_mutex_t csp_buffer_magazines_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t csp_buffer_magazine_key;
+static pthread_once_t csp_buffer_magazine_once = PTHREAD_ONCE_INIT;
+
+static void csp_buffer_magazine_exit(void * arg) {
+
+	csp_buffer_magazine_t * mag = arg;
+
+	pthread_mutex_lock(&csp_buffer_magazines_lock);
+	if (mag->generation == csp_buffer_generation) {
+		for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+			csp_buffer_magazine_class_t * mc = &mag->cls[i];
+			csp_buffer_pool_push_n(&csp_buffer_classes[i], mc->buf, mc->count);
+			mc->count = 0;
+		}
 	}
+	for (csp_buffer_magazine_t ** p = &csp_buffer_magazines; *p; p = &(*p)->next) {
+		if (*p == mag) {
+			*p = mag->next;
+			break;
+		}
+	}
+	mag->registered = false;
+	pthread_mutex_unlock(&csp_buffer_magazines_lock);
 
-	csp_skbf_t * buffer = NULL;
-	csp_queue_dequeue(csp_buffers, &buffer, 0);
-	if (buffer == NULL) {
-		csp_log_error("GET: Out of buffers");
-		return NULL;
+}
+
+static void csp_buffer_magazine_key_create(void) {
+	pthread_key_create(&csp_buffer_magazine_key, csp_buffer_magazine_exit);
+}
+
+static csp_buffer_magazine_t * csp_buffer_magazine_current(void) {
+
+	csp_buffer_magazine_t * mag = &csp_buffer_magazine;
+	const unsigned int generation = __atomic_load_n(&csp_buffer_generation, __ATOMIC_ACQUIRE);
+	if (mag->generation != generation) {
+		// first use from this thread, or CSP has been re-initialized
+		pthread_mutex_lock(&csp_buffer_magazines_lock);
+		if (!mag->registered) {
+			pthread_once(&csp_buffer_magazine_once, csp_buffer_magazine_key_create);
+			pthread_setspecific(csp_buffer_magazine_key, mag);
+			mag->next = csp_buffer_magazines;
+			csp_buffer_magazines = mag;
+			mag->registered = true;
+		}
+		for (unsigned int i = 0; i < CSP_BUFFER_CLASS_MAX; ++i) {
+			mag->cls[i].count = 0;
+		}
+		__atomic_store_n(&mag->generation, generation, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&csp_buffer_magazines_lock);
 	}
+	return mag;
 
-	if (buffer != buffer->skbf_addr) {
-		csp_log_error("GET: Corrupt CSP buffer %p != %p", buffer, buffer->skbf_addr);
-		return NULL;
+}
+
+/* Get buffer from the magazine, refilling it with up to allowed buffers from the pool */
+static csp_skbf_t * csp_buffer_magazine_get(csp_buffer_class_pool_t * cls, unsigned int allowed) {
+
+	csp_buffer_magazine_class_t * mc = &csp_buffer_magazine_current()->cls[cls - csp_buffer_classes];
+	unsigned int count = mc->count;
+	if (count == 0) {
+		const unsigned int refill = (csp_conf.buffer_magazine_size + 1) / 2;
+		count = csp_buffer_pool_pop_n(cls, mc->buf, (allowed < refill) ? allowed : refill);
+		if (count == 0) {
+			return NULL;
+		}
 	}
+	--count;
+	__atomic_store_n(&mc->count, count, __ATOMIC_RELAXED);
+	return mc->buf[count];
 
-	csp_log_buffer("GET: %p", buffer);
+}
+
+static void csp_buffer_magazine_put(csp_buffer_class_pool_t * cls, csp_skbf_t * buf) {
+
+	csp_buffer_magazine_class_t * mc = &csp_buffer_magazine_current()->cls[cls - csp_buffer_classes];
+	unsigned int count = mc->count;
+	if (count >= csp_conf.buffer_magazine_size) {
+		const unsigned int keep = csp_conf.buffer_magazine_size / 2;
+		csp_buffer_pool_push_n(cls, &mc->buf[keep], count - keep);
+		count = keep;
+	}
+	mc->buf[count++] = buf;
+	__atomic_store_n(&mc->count, count, __ATOMIC_RELAXED);
 
-	buffer->refcount = 1;
-	return buffer->skbf_data;
 }
 
-void csp_buffer_free_isr(void *packet) {
+static int csp_buffer_magazine_cached(const csp_buffer_class_pool_t * cls) {
 
-	if (packet == NULL) {
-		// freeing a NULL pointer is OK, e.g. standard free()
-		return;
+	const unsigned int generation = __atomic_load_n(&csp_buffer_generation, __ATOMIC_ACQUIRE);
+	const unsigned int index = cls - csp_buffer_classes;
+	int cached = 0;
+	pthread_mutex_lock(&csp_buffer_magazines_lock);
+	for (csp_buffer_magazine_t * mag = csp_buffer_magazines; mag; mag = mag->next) {
+		if (__atomic_load_n(&mag->generation, __ATOMIC_ACQUIRE) == generation) {
+			cached += __atomic_load_n(&mag->cls[index].count, __ATOMIC_RELAXED);
+		}
 	}
+	pthread_mutex_unlock(&csp_buffer_magazines_lock);
+	return cached;
+
+}
 
-	csp_skbf_t * buf = (void*)(((uint8_t*)packet) - sizeof(csp_skbf_t));
+static void csp_buffer_magazine_invalidate(void) {
+	pthread_mutex_lock(&csp_buffer_magazines_lock);
+	__atomic_add_fetch(&csp_buffer_generation, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&csp_buffer_magazines_lock);
+}
 
-	if (((uintptr_t) buf % CSP_BUFFER_ALIGN) > 0) {
-		return;
+#endif // CSP_BUFFER_USE_MAGAZINE
+
+/* Get buffer from the cache, taking at most allowed buffers from the pool (see csp_buffer_reserve_check()) */
+static inline csp_skbf_t * csp_buffer_cache_get(csp_buffer_class_pool_t * cls, unsigned int allowed) {
+#if (CSP_BUFFER_USE_MAGAZINE)
+	if (csp_conf.buffer_magazine_size) {
+		return csp_buffer_magazine_get(cls, allowed);
 	}
+#endif
+	return (allowed) ? csp_buffer_pool_pop(cls) : NULL;
+}
 
-	if (buf->skbf_addr != buf) {
+static inline void csp_buffer_cache_put(csp_buffer_class_pool_t * cls, csp_skbf_t * buf) {
+#if (CSP_BUFFER_USE_MAGAZINE)
+	// buffers go directly to the pool while tasks are waiting, so they can be handed over
+	if (csp_conf.buffer_magazine_size && (__atomic_load_n(&csp_buffer_waiting, __ATOMIC_RELAXED) == 0)) {
+		csp_buffer_magazine_put(cls, buf);
 		return;
 	}
+#endif
+	csp_buffer_pool_push(cls, buf);
+}
 
-	if (buf->refcount == 0) {
-		return;
+static unsigned int csp_buffer_cache_get_n(csp_buffer_class_pool_t * cls, csp_skbf_t ** bufs, unsigned int max) {
+#if (CSP_BUFFER_USE_MAGAZINE)
+	if (csp_conf.buffer_magazine_size) {
+		unsigned int count = 0;
+		for (; (count < max) && ((bufs[count] = csp_buffer_magazine_get(cls, max - count)) != NULL); ++count);
+		return count;
 	}
+#endif
+	return csp_buffer_pool_pop_n(cls, bufs, max);
+}
 
-	if (--(buf->refcount) > 0) {
+static void csp_buffer_cache_put_n(csp_buffer_class_pool_t * cls, csp_skbf_t * const * bufs, unsigned int count) {
+#if (CSP_BUFFER_USE_MAGAZINE)
+	if (csp_conf.buffer_magazine_size && (__atomic_load_n(&csp_buffer_waiting, __ATOMIC_RELAXED) == 0)) {
+		for (unsigned int i = 0; i < count; ++i) {
+			csp_buffer_magazine_put(cls, bufs[i]);
+		}
 		return;
 	}
+#endif
+	csp_buffer_pool_push_n(cls, bufs, count);
+}
 
-	CSP_BASE_TYPE task_woken = 0;
-	csp_queue_enqueue_isr(csp_buffers, &buf, &task_woken);
+static int csp_buffer_class_remaining(const csp_buffer_class_pool_t * cls) {
+#if (CSP_BUFFER_USE_MAGAZINE)
+	if (csp_conf.buffer_magazine_size) {
+		return csp_buffer_pool_remaining(cls) + csp_buffer_magazine_cached(cls);
+	}
+#endif
+	return csp_buffer_pool_remaining(cls);
+}
+
+#if (CSP_USE_BUFFER_SLAB)
+
+/* Find the size class a buffer header belongs to, NULL if the header isn't from the pool */
+static csp_buffer_class_pool_t * csp_buffer_class_of(const csp_skbf_t * buf) {
+	for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+		csp_buffer_class_pool_t * cls = &csp_buffer_classes[i];
+		if ((buf >= cls->meta) && (buf < &cls->meta[cls->count])) {
+			return ((((const char *) buf - (const char *) cls->meta) % sizeof(*buf)) == 0) ? cls : NULL;
+		}
+	}
+	return NULL;
+}
 
+/* Buffer header from packet, located by index in the slab. NULL if the packet isn't from the pool */
+static inline csp_skbf_t * csp_buffer_skbf(const void * packet) {
+	const char * addr = ((const char *) packet) - csp_buffer_headroom_size;
+	for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+		const csp_buffer_class_pool_t * cls = &csp_buffer_classes[i];
+		if ((addr >= cls->start) && (addr < cls->end)) {
+			const size_t offset = addr - cls->start;
+			return ((offset % cls->skbf_size) == 0) ? &cls->meta[offset / cls->skbf_size] : NULL;
+		}
+	}
+	return NULL;
 }
 
-void csp_buffer_free(void *packet) {
+/* Packet from buffer header */
+static inline csp_packet_t * csp_buffer_packet(csp_skbf_t * buf) {
+	const csp_buffer_class_pool_t * cls = csp_buffer_class_of(buf);
+	return (csp_packet_t *) &cls->start[(csp_buffer_pool_index(cls, buf) * cls->skbf_size) + csp_buffer_headroom_size];
+}
 
-	if (packet == NULL) {
-		/* freeing a NULL pointer is OK, e.g. standard free() */
-		return;
+#else
+
+/* Find the size class a buffer belongs to, NULL if the buffer isn't from the pool */
+static csp_buffer_class_pool_t * csp_buffer_class_of(const csp_skbf_t * buf) {
+	const char * addr = (const char *) buf;
+	for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+		csp_buffer_class_pool_t * cls = &csp_buffer_classes[i];
+		if ((addr >= cls->start) && (addr < cls->end)) {
+			return (((addr - cls->start) % cls->skbf_size) == 0) ? cls : NULL;
+		}
 	}
+	return NULL;
+}
 
-	csp_skbf_t * buf = (void*)(((uint8_t*)packet) - sizeof(csp_skbf_t));
+/* Buffer header from packet */
+static inline csp_skbf_t * csp_buffer_skbf(const void * packet) {
+	return (csp_skbf_t *)(((uintptr_t) packet) - csp_buffer_headroom_size - sizeof(csp_skbf_t));
+}
 
-	if (((uintptr_t) buf % CSP_BUFFER_ALIGN) > 0) {
-		csp_log_error("FREE: Unaligned CSP buffer pointer %p", packet);
-		return;
+/* Packet from buffer header */
+static inline csp_packet_t * csp_buffer_packet(csp_skbf_t * buf) {
+	return (csp_packet_t *) &buf->skbf_data[csp_buffer_headroom_size];
+}
+
+#endif
+
+/* Find the smallest size class that can hold data_size */
+static csp_buffer_class_pool_t * csp_buffer_class_find(size_t data_size) {
+	for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+		if (data_size <= csp_buffer_classes[i].data_size) {
+			return &csp_buffer_classes[i];
+		}
 	}
+	return NULL;
+}
 
-	if (buf->skbf_addr != buf) {
-		csp_log_error("FREE: Invalid CSP buffer pointer %p", packet);
-		return;
+/* Worst case data appended to a packet when sent: SFP and RDP headers, XTEA nonce, HMAC and CRC32 */
+#define CSP_BUFFER_SEND_OVERHEAD	(CSP_SFP_HEADER_LENGTH + CSP_RDP_HEADER_LENGTH + CSP_XTEA_NONCE_LENGTH + CSP_HMAC_LENGTH + CSP_CRC32_LENGTH)
+
+/*
+ * Find the size class for allocating data_size. Callers size buffers to the payload, so the class is chosen with room for
+ * the send overhead not already covered by the tailroom (csp_conf_t.buffer_tailroom), if a class is large enough.
+ */
+static csp_buffer_class_pool_t * csp_buffer_class_select(size_t data_size) {
+	const size_t overhead = (csp_buffer_tailroom_size < CSP_BUFFER_SEND_OVERHEAD) ? (CSP_BUFFER_SEND_OVERHEAD - csp_buffer_tailroom_size) : 0;
+	csp_buffer_class_pool_t * cls = csp_buffer_class_find(data_size + overhead);
+	return (cls) ? cls : csp_buffer_class_find(data_size);
+}
+
+/*
+ * Chained packets: the next segment of an allocated buffer is stored in csp_skbf_t.next,
+ * as class << CSP_BUFFER_CHAIN_INDEX_BITS | index + 1 (0 = last segment).
+ */
+#define CSP_BUFFER_CHAIN_INDEX_BITS	24
+#define CSP_BUFFER_CHAIN_INDEX_MASK	((1UL << CSP_BUFFER_CHAIN_INDEX_BITS) - 1)
+
+static inline uint32_t csp_buffer_chain_link(const csp_buffer_class_pool_t * cls, const csp_skbf_t * buf) {
+	return ((uint32_t)(cls - csp_buffer_classes) << CSP_BUFFER_CHAIN_INDEX_BITS) | (csp_buffer_pool_index(cls, buf) + 1);
+}
+
+static inline csp_skbf_t * csp_buffer_chain_get(const csp_skbf_t * buf) {
+	const uint32_t link = __atomic_load_n(&buf->next, __ATOMIC_RELAXED);
+	if (link == 0) {
+		return NULL;
 	}
+	return csp_buffer_pool_at(&csp_buffer_classes[link >> CSP_BUFFER_CHAIN_INDEX_BITS], (link & CSP_BUFFER_CHAIN_INDEX_MASK) - 1);
+}
 
-	if (buf->refcount == 0) {
-		csp_log_error("FREE: Buffer already free %p", buf);
-		return;
+static inline void csp_buffer_chain_set(csp_skbf_t * buf, uint32_t link) {
+	__atomic_store_n(&buf->next, link, __ATOMIC_RELAXED);
+}
+
+int csp_buffer_init(void) {
+
+	// Size classes, default is a single class based on buffers and buffer_data_size
+	csp_buffer_class_t dfl_class = {.data_size = csp_conf.buffer_data_size, .buffers = csp_conf.buffers};
+	const csp_buffer_class_t * classes = &dfl_class;
+	unsigned int class_count = 1;
+	if (csp_conf.buffer_classes && csp_conf.buffer_class_count) {
+		classes = csp_conf.buffer_classes;
+		class_count = csp_conf.buffer_class_count;
 	}
 
-	if (--(buf->refcount) > 0) {
-		csp_log_error("FREE: Buffer %p in use by %u users", buf, buf->refcount);
-		return;
+	if (class_count > CSP_BUFFER_CLASS_MAX) {
+		csp_log_error("Buffer classes %u > max %u", class_count, CSP_BUFFER_CLASS_MAX);
+		return CSP_ERR_INVAL;
+	}
+	for (unsigned int i = 0; i < class_count; ++i) {
+		if ((classes[i].buffers == 0) || ((i > 0) && (classes[i].data_size <= classes[i - 1].data_size))) {
+			csp_log_error("Buffer classes must have buffers and be sorted by increasing data size");
+			return CSP_ERR_INVAL;
+		}
 	}
 
-	csp_log_buffer("FREE: %p", buf);
-	csp_queue_enqueue(csp_buffers, &buf, 0);
+	if (csp_conf.buffer_magazine_size > CSP_BUFFER_MAGAZINE_MAX) {
+		csp_log_error("Buffer magazine size %u > max %u", csp_conf.buffer_magazine_size, CSP_BUFFER_MAGAZINE_MAX);
+		return CSP_ERR_INVAL;
+	}
+#if (CSP_BUFFER_USE_MAGAZINE)
+	csp_buffer_magazine_invalidate();
+#else
+	if (csp_conf.buffer_magazine_size) {
+		csp_log_warn("Buffer magazines not supported on this platform, ignoring buffer_magazine_size");
+		csp_conf.buffer_magazine_size = 0;
+	}
+#endif
+
+	// packet length (uint16_t) must be able to cover data and tailroom
+	if ((classes[class_count - 1].data_size + csp_conf.buffer_tailroom) > UINT16_MAX) {
+		csp_log_error("Buffer data size %u + tailroom %u too large", classes[class_count - 1].data_size, csp_conf.buffer_tailroom);
+		return CSP_ERR_INVAL;
+	}
+
+#if (CSP_USE_BUFFER_SLAB)
+	// headroom is rounded up, to start csp_packet_t on a cache line
+	csp_buffer_headroom_size = CSP_BUFFER_CACHELINE * ((csp_conf.buffer_headroom + (CSP_BUFFER_CACHELINE - 1)) / CSP_BUFFER_CACHELINE);
+#else
+	// headroom is rounded up, to keep csp_packet_t aligned
+	csp_buffer_headroom_size = CSP_BUFFER_ALIGN * ((csp_conf.buffer_headroom + (CSP_BUFFER_ALIGN - 1)) / CSP_BUFFER_ALIGN);
+#endif
+	csp_buffer_tailroom_size = csp_conf.buffer_tailroom;
+
+	// calculate total size and ensure correct alignment (int *) for buffers
+	size_t total = 0;
+	unsigned int buffers = 0;
+	for (unsigned int i = 0; i < class_count; ++i) {
+		csp_buffer_class_pool_t * cls = &csp_buffer_classes[i];
+		cls->data_size = classes[i].data_size;
+		cls->count = classes[i].buffers;
+#if (CSP_USE_BUFFER_SLAB)
+		// buffers are whole cache lines, headers are kept in a separate array
+		cls->skbf_size = CSP_BUFFER_CACHELINE * ((csp_buffer_headroom_size + CSP_BUFFER_PACKET_OVERHEAD + cls->data_size + csp_buffer_tailroom_size + (CSP_BUFFER_CACHELINE - 1)) / CSP_BUFFER_CACHELINE);
+		total += cls->count * (cls->skbf_size + sizeof(csp_skbf_t));
+#else
+		cls->skbf_size = CSP_BUFFER_ALIGN * ((sizeof(csp_skbf_t) + csp_buffer_headroom_size + CSP_BUFFER_PACKET_OVERHEAD + cls->data_size + csp_buffer_tailroom_size + (CSP_BUFFER_ALIGN - 1)) / CSP_BUFFER_ALIGN);
+		total += cls->count * cls->skbf_size;
+#endif
+		buffers += cls->count;
+	}
+	csp_buffer_class_count = class_count;
+
+	// the largest class defines the (max) data size, e.g. used for MTU
+	csp_conf.buffers = buffers;
+	csp_conf.buffer_data_size = csp_buffer_classes[class_count - 1].data_size;
+
+#if (CSP_USE_BUFFER_SLAB)
+	// room for aligning the first buffer to a cache line
+	total += CSP_BUFFER_CACHELINE - 1;
+#endif
+
+	csp_buffer_pool = csp_malloc_pool(total, csp_conf.buffer_memory, &csp_buffer_pool_memory);
+	if (csp_buffer_pool == NULL)
+		goto fail_malloc;
+	csp_buffer_pool_size = total;
+	if (csp_bin_sem_create(&csp_buffer_wait_lock) != CSP_SEMAPHORE_OK) {
+		csp_free_pool(csp_buffer_pool, csp_buffer_pool_size, csp_buffer_pool_memory);
+		csp_buffer_pool = NULL;
+		goto fail_malloc;
+	}
+	csp_buffer_waiters = NULL;
+	csp_buffer_waiting = 0;
+	csp_buffer_wait_first = NULL;
+	csp_buffer_wait_isr = 0;
+	if (csp_conf.buffer_memory) {
+		csp_log_info("Buffer pool: %u bytes, huge pages: %s, prefaulted: %s, locked: %s",
+			     (unsigned int) total,
+			     (csp_buffer_pool_memory & CSP_MALLOC_POOL_HUGEPAGES) ? "yes" : ((csp_buffer_pool_memory & CSP_MALLOC_POOL_THP) ? "transparent" : "no"),
+			     (csp_buffer_pool_memory & CSP_MALLOC_POOL_PREFAULT) ? "yes" : "no",
+			     (csp_buffer_pool_memory & CSP_MALLOC_POOL_LOCK) ? "yes" : "no");
+	}
+
+#if (CSP_USE_BUFFER_SLAB)
+	// buffers first (cache line aligned), followed by the headers of all classes
+	char * pos = (char *)((((uintptr_t) csp_buffer_pool) + (CSP_BUFFER_CACHELINE - 1)) & ~((uintptr_t) CSP_BUFFER_CACHELINE - 1));
+	csp_skbf_t * meta = (csp_skbf_t *)(pos + (total - (CSP_BUFFER_CACHELINE - 1)) - (buffers * sizeof(csp_skbf_t)));
+#else
+	char * pos = csp_buffer_pool;
+#endif
+	for (unsigned int i = 0; i < class_count; ++i) {
+		csp_buffer_class_pool_t * cls = &csp_buffer_classes[i];
+		cls->start = pos;
+		cls->end = pos + (cls->count * cls->skbf_size);
+		pos = cls->end;
+#if (CSP_USE_BUFFER_SLAB)
+		cls->meta = meta;
+		meta += cls->count;
+#endif
+
+		if (csp_buffer_pool_create(cls) != CSP_ERR_NONE)
+			goto fail_queue;
+
+		for (unsigned int j = 0; j < cls->count; j++) {
+			csp_skbf_t * buf = csp_buffer_pool_at(cls, j);
+			buf->refcount = 0;
+			buf->skbf_addr = buf;
+			csp_buffer_pool_push(cls, buf);
+		}
+	}
+
+	return CSP_ERR_NONE;
+
+fail_queue:
+	csp_buffer_free_resources();
+fail_malloc:
+	return CSP_ERR_NOMEM;
 
 }
 
-void *csp_buffer_clone(void *buffer) {
+void csp_buffer_free_resources(void) {
 
-	csp_packet_t *packet = (csp_packet_t *) buffer;
-	if (!packet) {
+#if (CSP_BUFFER_USE_MAGAZINE)
+	csp_buffer_magazine_invalidate();
+#endif
+	for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+		csp_buffer_pool_remove(&csp_buffer_classes[i]);
+	}
+	memset(csp_buffer_classes, 0, sizeof(csp_buffer_classes));
+	csp_buffer_class_count = 0;
+	if (csp_buffer_pool) {
+		csp_bin_sem_remove(&csp_buffer_wait_lock);
+	}
+	csp_free_pool(csp_buffer_pool, csp_buffer_pool_size, csp_buffer_pool_memory);
+	csp_buffer_pool = NULL;
+	csp_buffer_pool_size = 0;
+	csp_buffer_pool_memory = 0;
+
+}
+
+void *csp_buffer_get_isr(size_t _data_size) {
+
+	csp_buffer_class_pool_t * cls = csp_buffer_class_select(_data_size);
+	if (cls == NULL)
+		return NULL;
+
+	csp_skbf_t * buffer = NULL;
+	for (; (buffer == NULL) && (cls < &csp_buffer_classes[csp_buffer_class_count]); ++cls) {
+		buffer = csp_buffer_pool_pop_isr(cls);
+	}
+	if (buffer == NULL)
+		return NULL;
+
+	if (buffer != buffer->skbf_addr)
 		return NULL;
+
+	buffer->refcount = 1;
+	buffer->head = 0;
+	buffer->deadline = 0;
+	csp_buffer_chain_set(buffer, 0);
+	return csp_buffer_packet(buffer);
+
+}
+
+/*
+ * Priority reservations: an allocation at priority prio must leave csp_conf.buffer_reserve[prio] free buffers
+ * (in the classes that can hold the requested size) for higher priorities.
+ * Only the global pool counts, as buffers cached in a thread's magazine can't be used by other threads.
+ * Returns the number of buffers that may be taken from the pool, up to max.
+ */
+static unsigned int csp_buffer_reserve_check(const csp_buffer_class_pool_t * cls, uint8_t prio, unsigned int max) {
+
+	const unsigned int reserve = csp_conf.buffer_reserve[prio];
+	if (reserve == 0) {
+		return max;
 	}
 
-	csp_packet_t *clone = csp_buffer_get(packet->length);
-	if (clone) {
-		memcpy(clone, packet, csp_buffer_size());
+	unsigned int remaining = 0;
+	for (; cls < &csp_buffer_classes[csp_buffer_class_count]; ++cls) {
+		remaining += csp_buffer_pool_remaining(cls);
+	}
+	if (remaining <= reserve) {
+		return 0;
 	}
+	return ((remaining - reserve) < max) ? (remaining - reserve) : max;
 
-	return clone;
+}
 
+/* Publish the first waiting task for csp_buffer_free_isr(). Must be called with csp_buffer_wait_lock taken */
+static inline void csp_buffer_wait_set_first(void) {
+	__atomic_store_n(&csp_buffer_wait_first, (csp_buffer_waiters) ? &csp_buffer_waiters->sem : NULL, __ATOMIC_SEQ_CST);
 }
 
-int csp_buffer_remaining(void) {
-	return csp_queue_size(csp_buffers);
+/* Hand over free buffers to waiting tasks, in FIFO order. Must be called with csp_buffer_wait_lock taken */
+static void csp_buffer_wait_dispatch(void) {
+
+	while (csp_buffer_waiters) {
+		csp_buffer_waiter_t * waiter = csp_buffer_waiters;
+		csp_skbf_t * buf = NULL;
+		csp_buffer_class_pool_t * cls = csp_buffer_class_select(waiter->data_size);
+		if (csp_buffer_reserve_check(cls, waiter->prio, 1)) {
+			for (; (buf == NULL) && (cls < &csp_buffer_classes[csp_buffer_class_count]); ++cls) {
+				buf = csp_buffer_pool_pop(cls);
+			}
+		}
+		if (buf == NULL) {
+			// strict FIFO, later waiters don't overtake the first
+			break;
+		}
+		csp_buffer_waiters = waiter->next;
+		csp_buffer_wait_set_first();
+		__atomic_sub_fetch(&csp_buffer_waiting, 1, __ATOMIC_SEQ_CST);
+		waiter->buf = buf;
+		csp_bin_sem_post(&waiter->sem);
+	}
+
 }
 
-size_t csp_buffer_size(void) {
-	return (csp_conf.buffer_data_size + CSP_BUFFER_PACKET_OVERHEAD);
+/* Wake waiting tasks after buffers have been returned to the pool */
+static inline void csp_buffer_wait_wakeup(void) {
+
+	// pairs with the increment in csp_buffer_get_timeout(): either the waiter sees the returned buffer, or we see the waiter
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&csp_buffer_waiting, __ATOMIC_RELAXED)) {
+		csp_bin_sem_wait(&csp_buffer_wait_lock, CSP_MAX_TIMEOUT);
+		csp_buffer_wait_dispatch();
+		csp_bin_sem_post(&csp_buffer_wait_lock);
+	}
+
 }
 
-size_t csp_buffer_data_size(void) {
-	return csp_conf.buffer_data_size;
+/* Wake the first waiting task after buffers have been returned to the pool from ISR context, it hands them over */
+static inline void csp_buffer_wait_wakeup_isr(void) {
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&csp_buffer_waiting, __ATOMIC_RELAXED)) {
+		__atomic_add_fetch(&csp_buffer_wait_isr, 1, __ATOMIC_SEQ_CST);
+		csp_bin_sem_handle_t * sem = __atomic_load_n(&csp_buffer_wait_first, __ATOMIC_SEQ_CST);
+		if (sem) {
+			CSP_BASE_TYPE task_woken = 0;
+			csp_bin_sem_post_isr(sem, &task_woken);
+		}
+		__atomic_sub_fetch(&csp_buffer_wait_isr, 1, __ATOMIC_SEQ_CST);
+	}
+
+}
+
+/* Notify low watermark callback when crossing the watermark */
+static void csp_buffer_watermark_check(void) {
+
+	const csp_buffer_watermark_callback_t callback = csp_buffer_watermark_callback;
+	if (callback == NULL) {
+		return;
+	}
+
+	int remaining = 0;
+	for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+		remaining += csp_buffer_pool_remaining(&csp_buffer_classes[i]);
+	}
+	bool low = __atomic_load_n(&csp_buffer_watermark_low, __ATOMIC_RELAXED);
+	const bool now_low = (remaining <= csp_buffer_watermark_level);
+	if ((low != now_low) && __atomic_compare_exchange_n(&csp_buffer_watermark_low, &low, now_low, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		callback(now_low, remaining);
+	}
+
+}
+
+/* Initialize a buffer taken from the pool, returns the packet */
+static inline void * csp_buffer_take(csp_skbf_t * buffer) {
+
+	if (buffer != buffer->skbf_addr) {
+		csp_log_error("GET: Corrupt CSP buffer %p != %p", buffer, buffer->skbf_addr);
+		return NULL;
+	}
+
+	csp_log_buffer("GET: %p", buffer);
+
+	buffer->refcount = 1;
+	buffer->head = 0;
+	buffer->deadline = 0;
+	csp_buffer_chain_set(buffer, 0);
+	return csp_buffer_packet(buffer);
+
+}
+
+/* Get buffer from the smallest class with a free buffer, respecting priority reservations */
+static csp_skbf_t * csp_buffer_alloc(csp_buffer_class_pool_t * cls, uint8_t prio) {
+
+	// a magazine refill counts against the reservation like the buffer itself
+	const unsigned int allowed = csp_buffer_reserve_check(cls, prio, CSP_BUFFER_MAGAZINE_MAX);
+
+	csp_skbf_t * buffer = NULL;
+	for (; (buffer == NULL) && (cls < &csp_buffer_classes[csp_buffer_class_count]); ++cls) {
+		buffer = csp_buffer_cache_get(cls, allowed);
+	}
+	if ((buffer == NULL) && (allowed == 0)) {
+		__atomic_fetch_add(&csp_buffer_limited_count[prio], 1, __ATOMIC_RELAXED);
+	}
+	return buffer;
+
+}
+
+void *csp_buffer_get(size_t _data_size) {
+
+	csp_buffer_class_pool_t * cls = csp_buffer_class_select(_data_size);
+	if (cls == NULL) {
+		csp_log_error("GET: Attempt to allocate too large data size %u > max %u", (unsigned int) _data_size, (unsigned int) csp_conf.buffer_data_size);
+		return NULL;
+	}
+
+	csp_skbf_t * buffer = csp_buffer_alloc(cls, CSP_PRIO_NORM);
+	if (buffer == NULL) {
+		csp_log_error("GET: Out of buffers");
+		return NULL;
+	}
+
+	csp_buffer_watermark_check();
+	return csp_buffer_take(buffer);
+}
+
+void * csp_buffer_get_timeout(size_t data_size, uint32_t timeout) {
+	return csp_buffer_get_prio(data_size, CSP_PRIO_NORM, timeout);
+}
+
+void * csp_buffer_get_prio(size_t data_size, uint8_t prio, uint32_t timeout) {
+
+	if (prio >= CSP_PRIORITIES) {
+		prio = CSP_PRIORITIES - 1;
+	}
+
+	csp_buffer_class_pool_t * cls = csp_buffer_class_select(data_size);
+	if (cls == NULL) {
+		csp_log_error("GET: Attempt to allocate too large data size %u > max %u", (unsigned int) data_size, (unsigned int) csp_conf.buffer_data_size);
+		return NULL;
+	}
+
+	// fast path, unless other tasks are already waiting
+	if (__atomic_load_n(&csp_buffer_waiting, __ATOMIC_RELAXED) == 0) {
+		csp_skbf_t * buffer = csp_buffer_alloc(cls, prio);
+		if (buffer) {
+			csp_buffer_watermark_check();
+			return csp_buffer_take(buffer);
+		}
+	}
+
+	if (timeout == 0) {
+		csp_log_error("GET: Out of buffers");
+		return NULL;
+	}
+
+	csp_buffer_waiter_t waiter = {.data_size = data_size, .prio = prio, .buf = NULL, .next = NULL};
+	if (csp_bin_sem_create(&waiter.sem) != CSP_SEMAPHORE_OK) {
+		return NULL;
+	}
+	csp_bin_sem_wait(&waiter.sem, 0); // semaphore is created 'available'
+
+	// queue at the end, and hand over buffers freed meanwhile
+	csp_bin_sem_wait(&csp_buffer_wait_lock, CSP_MAX_TIMEOUT);
+	csp_buffer_waiter_t ** last = &csp_buffer_waiters;
+	while (*last) {
+		last = &(*last)->next;
+	}
+	*last = &waiter;
+	csp_buffer_wait_set_first();
+	__atomic_add_fetch(&csp_buffer_waiting, 1, __ATOMIC_SEQ_CST);
+	csp_buffer_wait_dispatch();
+	csp_bin_sem_post(&csp_buffer_wait_lock);
+
+	const uint32_t start = csp_get_ms();
+	uint32_t remaining = timeout;
+	bool queued = true;
+	while (queued) {
+		const bool timed_out = (csp_bin_sem_wait(&waiter.sem, remaining) != CSP_SEMAPHORE_OK);
+		csp_bin_sem_wait(&csp_buffer_wait_lock, CSP_MAX_TIMEOUT);
+		if (waiter.buf == NULL) {
+			// woken by csp_buffer_free_isr() (or timed out): hand over the buffers returned from ISR context
+			csp_buffer_wait_dispatch();
+		}
+		const uint32_t elapsed = csp_get_ms() - start;
+		if (waiter.buf) {
+			queued = false;
+		} else if (timed_out || ((timeout != CSP_MAX_TIMEOUT) && (elapsed >= timeout))) {
+			// timed out, remove from queue
+			for (last = &csp_buffer_waiters; *last; last = &(*last)->next) {
+				if (*last == &waiter) {
+					*last = waiter.next;
+					csp_buffer_wait_set_first();
+					__atomic_sub_fetch(&csp_buffer_waiting, 1, __ATOMIC_SEQ_CST);
+					break;
+				}
+			}
+			queued = false;
+		} else if (timeout != CSP_MAX_TIMEOUT) {
+			remaining = timeout - elapsed;
+		}
+		csp_bin_sem_post(&csp_buffer_wait_lock);
+	}
+
+	// csp_buffer_free_isr() may still be posting the semaphore
+	while (__atomic_load_n(&csp_buffer_wait_isr, __ATOMIC_SEQ_CST)) {
+	}
+	csp_bin_sem_remove(&waiter.sem);
+
+	if (waiter.buf == NULL) {
+		csp_log_error("GET: Out of buffers, timeout after %"PRIu32" mS", timeout);
+		return NULL;
+	}
+
+	csp_buffer_watermark_check();
+	return csp_buffer_take(waiter.buf);
+
+}
+
+void csp_buffer_set_watermark(int low, csp_buffer_watermark_callback_t callback) {
+	csp_buffer_watermark_level = low;
+	csp_buffer_watermark_low = false;
+	csp_buffer_watermark_callback = callback;
+}
+
+/* Drop a reference, returns remaining references or -1 if the buffer was already free */
+static inline int csp_buffer_release(csp_skbf_t * buf) {
+	uint16_t refcount = __atomic_load_n(&buf->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0) {
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&buf->refcount, &refcount, refcount - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	return refcount - 1;
+}
+
+void csp_buffer_free_isr(void *packet) {
+
+	while (packet) {
+
+		csp_skbf_t * buf = csp_buffer_skbf(packet);
+
+		if (((uintptr_t) buf % CSP_BUFFER_ALIGN) > 0) {
+			break;
+		}
+
+		csp_buffer_class_pool_t * cls = csp_buffer_class_of(buf);
+		if ((cls == NULL) || (buf->skbf_addr != buf)) {
+			break;
+		}
+
+		if (csp_buffer_release(buf) != 0) {
+			break;
+		}
+
+		// free remaining segments of a chain
+		csp_skbf_t * next = csp_buffer_chain_get(buf);
+		packet = (next) ? csp_buffer_packet(next) : NULL;
+
+		csp_buffer_pool_push_isr(cls, buf);
+	}
+
+	csp_buffer_wait_wakeup_isr();
+
+}
+
+/* Drop a reference to a segment, returns the size class if the buffer must be returned to the pool */
+static csp_buffer_class_pool_t * csp_buffer_unref(void *packet, csp_skbf_t ** pbuf) {
+
+	csp_skbf_t * buf = csp_buffer_skbf(packet);
+
+	if (((uintptr_t) buf % CSP_BUFFER_ALIGN) > 0) {
+		csp_log_error("FREE: Unaligned CSP buffer pointer %p", packet);
+		return NULL;
+	}
+
+	csp_buffer_class_pool_t * cls = csp_buffer_class_of(buf);
+	if ((cls == NULL) || (buf->skbf_addr != buf)) {
+		csp_log_error("FREE: Invalid CSP buffer pointer %p", packet);
+		return NULL;
+	}
+
+	const int refcount = csp_buffer_release(buf);
+	if (refcount < 0) {
+		csp_log_error("FREE: Buffer already free %p", buf);
+		return NULL;
+	}
+
+	if (refcount > 0) {
+		csp_log_buffer("FREE: %p still referenced by %d users", buf, refcount);
+		return NULL;
+	}
+
+	csp_log_buffer("FREE: %p", buf);
+	*pbuf = buf;
+	return cls;
+
+}
+
+void csp_buffer_free(void *packet) {
+
+	// freeing a NULL pointer is OK, e.g. standard free()
+	while (packet) {
+
+		csp_skbf_t * buf;
+		csp_buffer_class_pool_t * cls = csp_buffer_unref(packet, &buf);
+		if (cls == NULL) {
+			return;
+		}
+
+		// free remaining segments of a chain
+		csp_skbf_t * next = csp_buffer_chain_get(buf);
+		packet = (next) ? csp_buffer_packet(next) : NULL;
+
+		csp_buffer_cache_put(cls, buf);
+	}
+
+	csp_buffer_wait_wakeup();
+	csp_buffer_watermark_check();
+
+}
+
+unsigned int csp_buffer_get_n(size_t data_size, void * buffers[], unsigned int count) {
+
+	csp_buffer_class_pool_t * cls = csp_buffer_class_select(data_size);
+	if (cls == NULL) {
+		csp_log_error("GET: Attempt to allocate too large data size %u > max %u", (unsigned int) data_size, (unsigned int) csp_conf.buffer_data_size);
+		return 0;
+	}
+
+	// use the smallest classes with free buffers
+	unsigned int got = 0;
+	csp_skbf_t * bufs[CSP_BUFFER_BATCH_MAX];
+	while ((got < count) && (cls < &csp_buffer_classes[csp_buffer_class_count])) {
+		const unsigned int want = csp_buffer_reserve_check(cls, CSP_PRIO_NORM, ((count - got) < CSP_BUFFER_BATCH_MAX) ? (count - got) : CSP_BUFFER_BATCH_MAX);
+		if (want == 0) {
+			__atomic_fetch_add(&csp_buffer_limited_count[CSP_PRIO_NORM], 1, __ATOMIC_RELAXED);
+			break;
+		}
+		const unsigned int n = csp_buffer_cache_get_n(cls, bufs, want);
+		for (unsigned int i = 0; i < n; ++i) {
+			csp_skbf_t * buffer = bufs[i];
+			buffer->refcount = 1;
+			buffer->head = 0;
+			buffer->deadline = 0;
+			csp_buffer_chain_set(buffer, 0);
+			buffers[got++] = csp_buffer_packet(buffer);
+		}
+		if (n < want) {
+			++cls;
+		}
+	}
+
+	if (got < count) {
+		csp_log_error("GET: Out of buffers, got %u of %u", got, count);
+	}
+	csp_buffer_watermark_check();
+	csp_log_buffer("GET: %u buffers", got);
+	return got;
+
+}
+
+void csp_buffer_free_n(void * buffers[], unsigned int count) {
+
+	// buffers to return to the pool, per class
+	csp_skbf_t * bufs[CSP_BUFFER_CLASS_MAX][CSP_BUFFER_BATCH_MAX];
+	unsigned int n[CSP_BUFFER_CLASS_MAX] = {0};
+
+	for (unsigned int i = 0; i < count; ++i) {
+		void * packet = buffers[i];
+		while (packet) {
+			csp_skbf_t * buf;
+			csp_buffer_class_pool_t * cls = csp_buffer_unref(packet, &buf);
+			if (cls == NULL) {
+				break;
+			}
+
+			// free remaining segments of a chain
+			csp_skbf_t * next = csp_buffer_chain_get(buf);
+			packet = (next) ? csp_buffer_packet(next) : NULL;
+
+			const unsigned int index = cls - csp_buffer_classes;
+			bufs[index][n[index]++] = buf;
+			if (n[index] == CSP_BUFFER_BATCH_MAX) {
+				csp_buffer_cache_put_n(cls, bufs[index], n[index]);
+				n[index] = 0;
+			}
+		}
+	}
+
+	for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+		csp_buffer_cache_put_n(&csp_buffer_classes[i], bufs[i], n[i]);
+	}
+
+	csp_buffer_wait_wakeup();
+	csp_buffer_watermark_check();
+
+}
+
+void * csp_buffer_ref(void *packet) {
+
+	if (packet == NULL) {
+		return NULL;
+	}
+
+	csp_skbf_t * buf = csp_buffer_skbf(packet);
+	if ((csp_buffer_class_of(buf) == NULL) || (buf->skbf_addr != buf)) {
+		csp_log_error("REF: Invalid CSP buffer pointer %p", packet);
+		return NULL;
+	}
+
+	uint16_t refcount = __atomic_load_n(&buf->refcount, __ATOMIC_RELAXED);
+	do {
+		if ((refcount == 0) || (refcount == UINT16_MAX)) {
+			csp_log_error("REF: Invalid reference count %u, buffer %p", refcount, packet);
+			return NULL;
+		}
+	} while (!__atomic_compare_exchange_n(&buf->refcount, &refcount, refcount + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return packet;
+
+}
+
+unsigned int csp_buffer_refcount(const void *packet) {
+
+	if (packet == NULL) {
+		return 0;
+	}
+
+	const csp_skbf_t * buf = csp_buffer_skbf(packet);
+	return (buf) ? __atomic_load_n(&buf->refcount, __ATOMIC_ACQUIRE) : 0;
+
+}
+
+void csp_buffer_set_deadline(void *packet, uint32_t deadline) {
+
+	csp_skbf_t * buf = (packet) ? csp_buffer_skbf(packet) : NULL;
+	if (buf) {
+		buf->deadline = deadline;
+	}
+
+}
+
+uint32_t csp_buffer_deadline(const void *packet) {
+
+	const csp_skbf_t * buf = (packet) ? csp_buffer_skbf(packet) : NULL;
+	return (buf) ? buf->deadline : 0;
+
+}
+
+bool csp_buffer_expired(const void *packet, uint32_t now) {
+
+	const uint32_t deadline = csp_buffer_deadline(packet);
+	return (deadline != 0) && ((int32_t) (now - deadline) >= 0);
+
+}
+
+void csp_skbf_set_queued(void *packet, uint32_t now) {
+
+	csp_skbf_t * buf = (packet) ? csp_buffer_skbf(packet) : NULL;
+	if (buf) {
+		buf->queued = now;
+	}
+
+}
+
+uint32_t csp_skbf_queued(const void *packet) {
+
+	const csp_skbf_t * buf = (packet) ? csp_buffer_skbf(packet) : NULL;
+	return (buf) ? buf->queued : 0;
+
+}
+
+void csp_skbf_set_sent(void *packet, uint32_t now) {
+
+	csp_skbf_t * buf = (packet) ? csp_buffer_skbf(packet) : NULL;
+	if (buf) {
+		buf->sent = now;
+	}
+
+}
+
+uint32_t csp_skbf_sent(const void *packet) {
+
+	const csp_skbf_t * buf = (packet) ? csp_buffer_skbf(packet) : NULL;
+	return (buf) ? buf->sent : 0;
+
+}
+
+void csp_skbf_set_quarantine(void *packet, uint32_t until) {
+
+	csp_skbf_t * buf = (packet) ? csp_buffer_skbf(packet) : NULL;
+	if (buf) {
+		buf->quarantine = until;
+	}
+
+}
+
+uint32_t csp_skbf_quarantine(const void *packet) {
+
+	const csp_skbf_t * buf = (packet) ? csp_buffer_skbf(packet) : NULL;
+	return (buf) ? buf->quarantine : 0;
+
+}
+
+void * csp_buffer_unshare(void *packet) {
+
+	if ((packet == NULL) || (csp_buffer_refcount(packet) <= 1)) {
+		return packet;
+	}
+
+	void * copy = csp_buffer_clone(packet);
+	if (copy) {
+		csp_buffer_free(packet);
+	}
+	return copy;
+
+}
+
+/* Clone a single segment */
+static csp_packet_t * csp_buffer_clone_segment(const csp_packet_t * packet) {
+
+	// allocate from the same size class (or the next with a free buffer), as the user may have room reserved for appending data
+	csp_buffer_class_pool_t * cls = csp_buffer_class_of(csp_buffer_skbf(packet));
+	if (cls == NULL) {
+		csp_log_error("CLONE: Invalid CSP buffer pointer %p", packet);
+		return NULL;
+	}
+	csp_skbf_t * buf = csp_buffer_alloc(cls, CSP_PRIO_NORM);
+	if (buf == NULL) {
+		csp_log_error("GET: Out of buffers");
+		return NULL;
+	}
+	csp_buffer_watermark_check();
+
+	csp_packet_t *clone = csp_buffer_take(buf);
+	if (clone) {
+		// only copy the used part of the buffer (data may extend into the tailroom)
+		const size_t size = cls->data_size + csp_buffer_tailroom_size;
+		const size_t length = (packet->length < size) ? packet->length : size;
+		memcpy(clone, packet, CSP_BUFFER_PACKET_OVERHEAD + length);
+		csp_buffer_set_deadline(clone, csp_buffer_deadline(packet));
+	}
+
+	return clone;
+
+}
+
+void *csp_buffer_clone(void *buffer) {
+
+	csp_packet_t *packet = (csp_packet_t *) buffer;
+	if (!packet) {
+		return NULL;
+	}
+
+	csp_packet_t *clone = csp_buffer_clone_segment(packet);
+	for (packet = csp_buffer_chain_next(packet); packet && clone; packet = csp_buffer_chain_next(packet)) {
+		csp_packet_t *segment = csp_buffer_clone_segment(packet);
+		if ((segment == NULL) || (csp_buffer_chain_append(clone, segment) != CSP_ERR_NONE)) {
+			csp_buffer_free(segment);
+			csp_buffer_free(clone);
+			clone = NULL;
+		}
+	}
+
+	return clone;
+
+}
+
+int csp_buffer_chain_append(csp_packet_t * packet, csp_packet_t * segment) {
+
+	if ((packet == NULL) || (segment == NULL) || (packet == segment)) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_skbf_t * seg = csp_buffer_skbf(segment);
+	const csp_buffer_class_pool_t * seg_cls = csp_buffer_class_of(seg);
+	if ((seg_cls == NULL) || (seg->skbf_addr != seg) || (seg->refcount == 0)) {
+		csp_log_error("CHAIN: Invalid CSP buffer pointer %p", segment);
+		return CSP_ERR_INVAL;
+	}
+
+	csp_skbf_t * last = csp_buffer_skbf(packet);
+	if ((csp_buffer_class_of(last) == NULL) || (last->skbf_addr != last)) {
+		csp_log_error("CHAIN: Invalid CSP buffer pointer %p", packet);
+		return CSP_ERR_INVAL;
+	}
+	for (csp_skbf_t * next = csp_buffer_chain_get(last); next; next = csp_buffer_chain_get(next)) {
+		if (next == seg) {
+			return CSP_ERR_INVAL;
+		}
+		last = next;
+	}
+
+	csp_buffer_chain_set(last, csp_buffer_chain_link(seg_cls, seg));
+	return CSP_ERR_NONE;
+
+}
+
+csp_packet_t * csp_buffer_chain_next(const csp_packet_t * packet) {
+
+	if (packet == NULL) {
+		return NULL;
+	}
+
+	const csp_skbf_t * buf = csp_buffer_skbf(packet);
+	csp_skbf_t * next = (buf) ? csp_buffer_chain_get(buf) : NULL;
+	return (next) ? csp_buffer_packet(next) : NULL;
+
+}
+
+size_t csp_buffer_chain_length(const csp_packet_t * packet) {
+
+	size_t length = 0;
+	for (; packet; packet = csp_buffer_chain_next(packet)) {
+		length += packet->length;
+	}
+	return length;
+
+}
+
+size_t csp_buffer_chain_copy(const csp_packet_t * packet, size_t offset, void * dst, size_t length) {
+
+	uint8_t * out = dst;
+	size_t copied = 0;
+	for (; packet && (copied < length); packet = csp_buffer_chain_next(packet)) {
+		if (offset >= packet->length) {
+			offset -= packet->length;
+			continue;
+		}
+		size_t bytes = packet->length - offset;
+		if (bytes > (length - copied)) {
+			bytes = length - copied;
+		}
+		memcpy(&out[copied], &packet->data[offset], bytes);
+		copied += bytes;
+		offset = 0;
+	}
+	return copied;
+
+}
+
+csp_packet_t * csp_buffer_chain_linearize(const csp_packet_t * packet) {
+
+	if (packet == NULL) {
+		return NULL;
+	}
+
+	const size_t length = csp_buffer_chain_length(packet);
+	csp_packet_t * linear = csp_buffer_get(length);
+	if (linear == NULL) {
+		return NULL;
+	}
+
+	memcpy(linear, packet, CSP_BUFFER_PACKET_OVERHEAD);
+	linear->length = csp_buffer_chain_copy(packet, 0, linear->data, length);
+	return linear;
+
+}
+
+int csp_buffer_remaining(void) {
+	int remaining = 0;
+	for (unsigned int i = 0; i < csp_buffer_class_count; ++i) {
+		remaining += csp_buffer_class_remaining(&csp_buffer_classes[i]);
+	}
+	return remaining;
+}
+
+int csp_buffer_remaining_size(size_t data_size) {
+	int remaining = 0;
+	for (csp_buffer_class_pool_t * cls = csp_buffer_class_select(data_size); cls && (cls < &csp_buffer_classes[csp_buffer_class_count]); ++cls) {
+		remaining += csp_buffer_class_remaining(cls);
+	}
+	return remaining;
+}
+
+uint32_t csp_buffer_limited(uint8_t prio) {
+	return (prio < CSP_PRIORITIES) ? __atomic_load_n(&csp_buffer_limited_count[prio], __ATOMIC_RELAXED) : 0;
+}
+
+unsigned int csp_buffer_memory(void) {
+	return csp_buffer_pool_memory;
+}
+
+size_t csp_buffer_size(void) {
+	return (csp_conf.buffer_data_size + CSP_BUFFER_PACKET_OVERHEAD);
+}
+
+size_t csp_buffer_data_size(void) {
+	return csp_conf.buffer_data_size;
+}
+
+size_t csp_buffer_packet_data_size(const void * packet) {
+
+	if (packet == NULL) {
+		return 0;
+	}
+
+	const csp_skbf_t * buf = csp_buffer_skbf(packet);
+	const csp_buffer_class_pool_t * cls = csp_buffer_class_of(buf);
+	return (cls) ? cls->data_size : 0;
+
+}
+
+void * csp_buffer_push(csp_packet_t * packet, size_t len) {
+
+	if (packet == NULL) {
+		return NULL;
+	}
+
+	// pushed data overwrites padding and length, which all references would see
+	csp_skbf_t * buf = csp_buffer_skbf(packet);
+	if ((buf == NULL) || (len > csp_buffer_headroom(packet)) || (__atomic_load_n(&buf->refcount, __ATOMIC_ACQUIRE) > 1)) {
+		return NULL;
+	}
+
+	if ((buf->head == 0) && (len > 0)) {
+		buf->length = packet->length;
+	}
+	buf->head += len;
+	return ((uint8_t *) &packet->id) - buf->head;
+
+}
+
+void * csp_buffer_pull(csp_packet_t * packet, size_t len) {
+
+	if (packet == NULL) {
+		return NULL;
+	}
+
+	csp_skbf_t * buf = csp_buffer_skbf(packet);
+	if ((buf == NULL) || (len > buf->head)) {
+		return NULL;
+	}
+
+	buf->head -= len;
+	if ((buf->head == 0) && (len > 0)) {
+		packet->length = buf->length;
+	}
+	return ((uint8_t *) &packet->id) - buf->head;
+
+}
+
+size_t csp_buffer_headroom(const csp_packet_t * packet) {
+
+	if (packet == NULL) {
+		return 0;
+	}
+
+	// reserved headroom, padding and length - so pushed data is contiguous with the identifier
+	const csp_skbf_t * buf = csp_buffer_skbf(packet);
+	return (buf) ? (csp_buffer_headroom_size + offsetof(csp_packet_t, id) - buf->head) : 0;
+
+}
+
+void * csp_buffer_put(csp_packet_t * packet, size_t len) {
+
+	if (len > csp_buffer_tailroom(packet)) {
+		return NULL;
+	}
+
+	void * tail = &packet->data[packet->length];
+	packet->length += len;
+	return tail;
+
+}
+
+void * csp_buffer_trim(csp_packet_t * packet, size_t len) {
+
+	if ((packet == NULL) || (len > packet->length)) {
+		return NULL;
+	}
+
+	packet->length -= len;
+	return &packet->data[packet->length];
+
+}
+
+size_t csp_buffer_tailroom(const csp_packet_t * packet) {
+
+	const size_t data_size = csp_buffer_packet_data_size(packet);
+	if (data_size == 0) {
+		return 0;
+	}
+
+	const size_t size = data_size + csp_buffer_tailroom_size;
+	return (packet->length < size) ? (size - packet->length) : 0;
+
 }
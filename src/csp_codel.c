@@ -0,0 +1,128 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "csp_codel.h"
+
+/* Time comparison, wrap-around safe */
+#define CSP_CODEL_AFTER_EQ(a, b)	((int32_t) ((a) - (b)) >= 0)
+
+/* Integer square root (floor) - count is small, so no need for Newton iterations or floating point */
+static uint32_t csp_codel_sqrt(uint32_t value) {
+
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	while (bit > value) {
+		bit >>= 2;
+	}
+
+	while (bit) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return root;
+
+}
+
+/* Next drop time - drops get closer as interval / sqrt(count) */
+static uint32_t csp_codel_control_law(uint32_t t, uint32_t interval, uint32_t count) {
+
+	uint32_t next = t + (interval / csp_codel_sqrt(count));
+	return (next) ? next : 1;
+
+}
+
+void csp_codel_reset(csp_codel_t * codel) {
+
+	codel->first_above = 0;
+	codel->drop_next = 0;
+	codel->count = 0;
+	codel->lastcount = 0;
+	codel->dropping = 0;
+
+}
+
+/* Has the queuing delay been above target for at least an interval */
+static bool csp_codel_ok_to_drop(csp_codel_t * codel, uint32_t target, uint32_t interval, const csp_packet_t * packet, uint32_t now, csp_queue_handle_t queue, unsigned int behind) {
+
+	const uint32_t enqueued = csp_skbf_queued(packet);
+
+	/* A queue that is about to run empty is not a standing queue */
+	if (((now - enqueued) < target) || ((behind == 0) && (csp_queue_size(queue) == 0))) {
+		codel->first_above = 0;
+		return false;
+	}
+
+	if (codel->first_above == 0) {
+		codel->first_above = now + interval;
+		if (codel->first_above == 0) {
+			codel->first_above = 1;
+		}
+		return false;
+	}
+
+	return CSP_CODEL_AFTER_EQ(now, codel->first_above);
+
+}
+
+bool csp_codel_drop(csp_codel_t * codel, const csp_codel_conf_t * conf, const csp_packet_t * packet, uint32_t now, csp_queue_handle_t queue, unsigned int behind) {
+
+	const uint32_t interval = (conf->interval) ? conf->interval : CSP_CODEL_INTERVAL;
+	const bool ok_to_drop = csp_codel_ok_to_drop(codel, conf->target, interval, packet, now, queue, behind);
+
+	if (codel->dropping) {
+		if (!ok_to_drop) {
+			/* Delay below target again */
+			codel->dropping = 0;
+			return false;
+		}
+		if (CSP_CODEL_AFTER_EQ(now, codel->drop_next)) {
+			if (codel->count < UINT16_MAX) {
+				codel->count++;
+			}
+			codel->drop_next = csp_codel_control_law(codel->drop_next, interval, codel->count);
+			return true;
+		}
+		return false;
+	}
+
+	if (ok_to_drop) {
+		/* Enter dropping state - if recently left, resume near the previous drop rate */
+		codel->dropping = 1;
+		const uint16_t delta = codel->count - codel->lastcount;
+		if ((delta > 1) && ((now - codel->drop_next) < (16 * interval))) {
+			codel->count = delta;
+		} else {
+			codel->count = 1;
+		}
+		codel->lastcount = codel->count;
+		codel->drop_next = csp_codel_control_law(now, interval, codel->count);
+		return true;
+	}
+
+	return false;
+
+}
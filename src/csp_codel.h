@@ -0,0 +1,76 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CSP_CODEL_H_
+#define CSP_CODEL_H_
+
+#include <csp/csp_types.h>
+#include <csp/arch/csp_queue.h>
+
+#include "csp_skbf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * CoDel state of a queue, see #csp_codel_conf_t.
+ * Only the reader of the queue uses the state, so no locking is needed.
+ */
+typedef struct {
+	uint32_t first_above;	/**< Time the queuing delay can have been above target for an interval, 0 if below target */
+	uint32_t drop_next;	/**< Time of the next drop, while dropping */
+	uint16_t count;		/**< Packets dropped since entering the dropping state */
+	uint16_t lastcount;	/**< count when the dropping state was last left */
+	uint8_t dropping;	/**< In dropping state */
+} csp_codel_t;
+
+/**
+ * Time stamp a packet when queued (kept with the buffer, not in the packet, as it may be shared).
+ * @param packet packet
+ * @param now current time (mS)
+ */
+static inline void csp_codel_stamp(csp_packet_t * packet, uint32_t now) {
+	csp_skbf_set_queued(packet, now);
+}
+
+/**
+ * Reset CoDel state, e.g. when the queue is flushed or (re)configured.
+ * @param codel state
+ */
+void csp_codel_reset(csp_codel_t * codel);
+
+/**
+ * Check if a packet taken from the head of a queue should be dropped.
+ * Called for every packet dequeued, with the packet time stamped by csp_codel_stamp() when queued.
+ * @param codel state of the queue
+ * @param conf queue configuration, target must be non-zero
+ * @param packet packet dequeued
+ * @param now current time (mS)
+ * @param queue the queue, checked for remaining packets when the packet was queued for longer than target
+ * @param behind packets dequeued together with (behind) this packet, i.e. the queue is not about to run empty
+ * @return true if the packet should be dropped (not freed)
+ */
+bool csp_codel_drop(csp_codel_t * codel, const csp_codel_conf_t * conf, const csp_packet_t * packet, uint32_t now, csp_queue_handle_t queue, unsigned int behind);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CSP_CODEL_H_ */
@@ -29,6 +29,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_malloc.h>
 #include <csp/arch/csp_time.h>
 #include "csp_init.h"
+#include "csp_poll.h"
+#include "csp_qfifo.h"
 #include "transport/csp_transport.h"
 
 /* Connection pool */
@@ -43,15 +45,164 @@ static uint8_t sport;
 /* Source port lock */
 static csp_bin_sem_handle_t sport_lock;
 
-void csp_conn_check_timeouts(void) {
 #if (CSP_USE_RDP)
+/* RDP timers per router shard - a min-heap of connections, ordered by their next deadline */
+typedef struct {
+	csp_conn_t ** heap;		// heap[0] has the earliest deadline
+	unsigned int count;
+	bool armed;			// router will check timeouts at 'wake', otherwise it waits for packets only
+	uint32_t wake;
+	csp_bin_sem_handle_t lock;
+} csp_conn_timers_t;
+
+static csp_conn_timers_t conn_timers[CSP_ROUTE_SHARDS_MAX];
+
+/* Return 1 if deadline is before cmp (wrapping mS) */
+static inline int csp_conn_deadline_before(uint32_t deadline, uint32_t cmp) {
+	return (int32_t)(deadline - cmp) < 0;
+}
+
+static inline void csp_conn_timer_set(csp_conn_timers_t * timers, unsigned int index, csp_conn_t * conn) {
+	timers->heap[index] = conn;
+	conn->rdp.timer = index;
+}
+
+static void csp_conn_timer_sift_up(csp_conn_timers_t * timers, unsigned int index) {
+
+	csp_conn_t * conn = timers->heap[index];
+	while (index > 0) {
+		const unsigned int parent = (index - 1) / 2;
+		if (!csp_conn_deadline_before(conn->rdp.deadline, timers->heap[parent]->rdp.deadline)) {
+			break;
+		}
+		csp_conn_timer_set(timers, index, timers->heap[parent]);
+		index = parent;
+	}
+	csp_conn_timer_set(timers, index, conn);
+
+}
+
+static void csp_conn_timer_sift_down(csp_conn_timers_t * timers, unsigned int index) {
+
+	csp_conn_t * conn = timers->heap[index];
+	for (;;) {
+		unsigned int child = (2 * index) + 1;
+		if (child >= timers->count) {
+			break;
+		}
+		if (((child + 1) < timers->count) &&
+		    csp_conn_deadline_before(timers->heap[child + 1]->rdp.deadline, timers->heap[child]->rdp.deadline)) {
+			child++;
+		}
+		if (!csp_conn_deadline_before(timers->heap[child]->rdp.deadline, conn->rdp.deadline)) {
+			break;
+		}
+		csp_conn_timer_set(timers, index, timers->heap[child]);
+		index = child;
+	}
+	csp_conn_timer_set(timers, index, conn);
+
+}
+
+/* Remove connection from heap - must be called with the shard's timer lock */
+static void csp_conn_timer_remove(csp_conn_timers_t * timers, csp_conn_t * conn) {
+
+	const unsigned int index = conn->rdp.timer;
+	conn->rdp.timer = -1;
+
+	timers->count--;
+	if (index < timers->count) {
+		/* Move last into the hole, and restore heap order */
+		csp_conn_t * last = timers->heap[timers->count];
+		csp_conn_timer_set(timers, index, last);
+		csp_conn_timer_sift_up(timers, index);
+		csp_conn_timer_sift_down(timers, last->rdp.timer);
+	}
+
+}
+
+static void csp_conn_unschedule(csp_conn_t * conn) {
+
+	csp_conn_timers_t * timers = &conn_timers[csp_qfifo_shard(conn->idin.ext)];
+
+	csp_bin_sem_wait(&timers->lock, CSP_MAX_TIMEOUT);
+	if (conn->rdp.timer >= 0) {
+		csp_conn_timer_remove(timers, conn);
+	}
+	csp_bin_sem_post(&timers->lock);
+
+}
+
+void csp_conn_schedule(csp_conn_t * conn, uint32_t deadline) {
+
+	const unsigned int shard = csp_qfifo_shard(conn->idin.ext);
+	csp_conn_timers_t * timers = &conn_timers[shard];
+
+	csp_bin_sem_wait(&timers->lock, CSP_MAX_TIMEOUT);
+
+	if (conn->rdp.timer < 0) {
+		conn->rdp.deadline = deadline;
+		csp_conn_timer_set(timers, timers->count++, conn);
+		csp_conn_timer_sift_up(timers, conn->rdp.timer);
+	} else if (csp_conn_deadline_before(deadline, conn->rdp.deadline)) {
+		conn->rdp.deadline = deadline;
+		csp_conn_timer_sift_up(timers, conn->rdp.timer);
+	}
+
+	/* Wake the router, if it sleeps past the new deadline */
+	bool wake = false;
+	if (!timers->armed || csp_conn_deadline_before(deadline, timers->wake)) {
+		timers->armed = true;
+		timers->wake = deadline;
+		wake = true;
+	}
+
+	csp_bin_sem_post(&timers->lock);
+
+	if (wake) {
+		csp_qfifo_wake_up_shard(shard);
+	}
+
+}
+#endif
+
+uint32_t csp_conn_check_timeouts(unsigned int shard) {
+#if (CSP_USE_RDP)
+	csp_conn_timers_t * timers = &conn_timers[shard];
+
+	/* Expired timers only, bounded so a timer rescheduled in the past cannot starve the router */
 	for (int i = 0; i < csp_conf.conn_max; i++) {
-		if (arr_conn[i].state == CONN_OPEN) {
-			if (arr_conn[i].idin.flags & CSP_FRDP) {
-				csp_rdp_check_timeouts(&arr_conn[i]);
-			}
+
+		csp_bin_sem_wait(&timers->lock, CSP_MAX_TIMEOUT);
+
+		if (timers->count == 0) {
+			timers->armed = false;
+			csp_bin_sem_post(&timers->lock);
+			return CSP_MAX_TIMEOUT;
+		}
+
+		csp_conn_t * conn = timers->heap[0];
+		const uint32_t time_now = csp_get_ms();
+		if (csp_conn_deadline_before(time_now, conn->rdp.deadline)) {
+			timers->armed = true;
+			timers->wake = conn->rdp.deadline;
+			csp_bin_sem_post(&timers->lock);
+			return conn->rdp.deadline - time_now;
+		}
+
+		csp_conn_timer_remove(timers, conn);
+		csp_bin_sem_post(&timers->lock);
+
+		/* RDP reschedules the connection, if anything is still pending */
+		if (conn->state == CONN_OPEN) {
+			csp_rdp_check_timeouts(conn);
 		}
 	}
+
+	return 0;
+#else
+	(void) shard;
+	return CSP_MAX_TIMEOUT;
 #endif
 }
 
@@ -77,22 +228,68 @@ int csp_conn_enqueue_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		rxq = CSP_RX_QUEUES - 1;
 	}
 
-	if (csp_queue_enqueue(conn->rx_queue[rxq], &packet, 0) != CSP_QUEUE_OK) {
-		csp_log_error("RX queue %p full with %u items", conn->rx_queue[rxq], csp_queue_size(conn->rx_queue[rxq]));
-		return CSP_ERR_NOMEM;
+	if ((packet != NULL) && conn->codel.target) {
+		csp_codel_stamp(packet, csp_get_ms());
 	}
 
-#if (CSP_USE_QOS)
-	int event = 0;
-	if (csp_queue_enqueue(conn->rx_event, &event, 0) != CSP_QUEUE_OK) {
-		csp_log_error("QOS event queue full");
+	if (csp_queue_enqueue_prio(conn->rx_queue, &packet, rxq, 0) != CSP_QUEUE_OK) {
+		csp_log_error("RX queue %p full with %u items", conn->rx_queue, csp_queue_size(conn->rx_queue));
 		return CSP_ERR_NOMEM;
 	}
-#endif
+
+	csp_poll_notify();
 
 	return CSP_ERR_NONE;
 }
 
+int csp_conn_enqueue_packets(csp_conn_t * conn, csp_packet_t ** packets, unsigned int count) {
+
+	if (!conn || (count == 0))
+		return CSP_ERR_INVAL;
+
+	if (conn->codel.target) {
+		const uint32_t now = csp_get_ms();
+		for (unsigned int i = 0; i < count; i++) {
+			csp_codel_stamp(packets[i], now);
+		}
+	}
+
+	/* All packets go to the RX queue of the first, with a single wakeup of the reader */
+	const int rxq = csp_conn_get_rxq(packets[0]->id.pri);
+	const int enqueued = csp_queue_enqueue_prio_n(conn->rx_queue, packets, count, rxq, 0);
+	if (enqueued < (int) count) {
+		csp_log_error("RX queue %p full with %u items", conn->rx_queue, csp_queue_size(conn->rx_queue));
+	}
+
+	if (enqueued > 0) {
+		csp_poll_notify();
+	}
+
+	return enqueued;
+}
+
+bool csp_conn_rx_drop(csp_conn_t * conn, csp_packet_t * packet, unsigned int behind) {
+
+	if ((packet == NULL) || ((conn->codel.target == 0) && (csp_buffer_deadline(packet) == 0))) {
+		return false;
+	}
+
+	/* RDP data is already acknowledged, so only discarded by the sender (see csp_rdp_check_timeouts()) */
+	const uint32_t now = csp_get_ms();
+	if (((conn->idin.flags & CSP_FRDP) == 0) && csp_buffer_expired(packet, now)) {
+		conn->expired++;
+	} else if (conn->codel.target && csp_codel_drop(&conn->codel_state, &conn->codel, packet, now, conn->rx_queue, behind)) {
+		conn->codel_drop++;
+	} else {
+		return false;
+	}
+
+	csp_buffer_free(packet);
+
+	return true;
+
+}
+
 int csp_conn_init(void) {
 
 	arr_conn = csp_calloc(csp_conf.conn_max, sizeof(*arr_conn));
@@ -115,24 +312,29 @@ int csp_conn_init(void) {
 		return CSP_ERR_NOMEM;
 	}
 
-	for (int i = 0; i < csp_conf.conn_max; i++) {
-		csp_conn_t * conn = &arr_conn[i];
-		for (int prio = 0; prio < CSP_RX_QUEUES; prio++) {
-			conn->rx_queue[prio] = csp_queue_create(csp_conf.conn_queue_length, sizeof(csp_packet_t *));
-			if (conn->rx_queue[prio] == NULL) {
-				csp_log_error("rx_queue = csp_queue_create() failed");
-				return CSP_ERR_NOMEM;
-			}
+#if (CSP_USE_RDP)
+	for (unsigned int shard = 0; shard < csp_qfifo_shards(); shard++) {
+		csp_conn_timers_t * timers = &conn_timers[shard];
+		timers->heap = csp_calloc(csp_conf.conn_max, sizeof(*timers->heap));
+		if (timers->heap == NULL) {
+			csp_log_error("Allocation for %u connection timers failed", csp_conf.conn_max);
+			return CSP_ERR_NOMEM;
 		}
-
-#if (CSP_USE_QOS)
-		conn->rx_event = csp_queue_create(csp_conf.conn_queue_length, sizeof(int));
-		if (conn->rx_event == NULL) {
-			csp_log_error("rx_event = csp_queue_create() failed");
+		if (csp_bin_sem_create(&timers->lock) != CSP_SEMAPHORE_OK) {
+			csp_log_error("csp_bin_sem_create(&timers->lock) failed");
 			return CSP_ERR_NOMEM;
 		}
+	}
 #endif
 
+	for (int i = 0; i < csp_conf.conn_max; i++) {
+		csp_conn_t * conn = &arr_conn[i];
+		conn->rx_queue = csp_queue_create_prio(csp_conf.conn_queue_length, sizeof(csp_packet_t *), CSP_RX_QUEUES);
+		if (conn->rx_queue == NULL) {
+			csp_log_error("rx_queue = csp_queue_create_prio() failed");
+			return CSP_ERR_NOMEM;
+		}
+
 #if (CSP_USE_RDP)
 		if (csp_rdp_init(conn) != CSP_ERR_NONE) {
 			csp_log_error("csp_rdp_allocate(conn) failed");
@@ -152,18 +354,10 @@ void csp_conn_free_resources(void) {
 	for (unsigned int i = 0; i < csp_conf.conn_max; i++) {
             csp_conn_t * conn = &arr_conn[i];
 
-            for (int prio = 0; prio < CSP_RX_QUEUES; prio++) {
-                if (conn->rx_queue[prio]) {
-                    csp_queue_remove(conn->rx_queue[prio]);
-                }
+            if (conn->rx_queue) {
+                csp_queue_remove(conn->rx_queue);
             }
 
-#if (CSP_USE_QOS)
-            if (conn->rx_event) {
-                csp_queue_remove(conn->rx_event);
-            }
-#endif
-
 #if (CSP_USE_RDP)
             csp_rdp_free_resources(conn);
 #endif
@@ -180,6 +374,15 @@ void csp_conn_free_resources(void) {
 
         sport = 0;
     }
+
+#if (CSP_USE_RDP)
+    for (unsigned int shard = 0; shard < CSP_ROUTE_SHARDS_MAX; shard++) {
+        if (conn_timers[shard].heap) {
+            csp_free(conn_timers[shard].heap);
+        }
+        memset(&conn_timers[shard], 0, sizeof(conn_timers[shard]));
+    }
+#endif
 }
 
 csp_conn_t * csp_conn_find(uint32_t id, uint32_t mask) {
@@ -199,23 +402,14 @@ csp_conn_t * csp_conn_find(uint32_t id, uint32_t mask) {
 
 static int csp_conn_flush_rx_queue(csp_conn_t * conn) {
 
-	csp_packet_t * packet;
-
-	int prio;
+	void * packets[16];
+	int count;
 
-	/* Flush packet queues */
-	for (prio = 0; prio < CSP_RX_QUEUES; prio++) {
-		while (csp_queue_dequeue(conn->rx_queue[prio], &packet, 0) == CSP_QUEUE_OK)
-			if (packet != NULL)
-				csp_buffer_free(packet);
+	/* Flush packet queue, freeing packets in batches */
+	while ((count = csp_queue_dequeue_n(conn->rx_queue, packets, sizeof(packets) / sizeof(packets[0]), 0)) > 0) {
+		csp_buffer_free_n(packets, count);
 	}
 
-	/* Flush event queue */
-#if (CSP_USE_QOS)
-	int event;
-	while (csp_queue_dequeue(conn->rx_event, &event, 0) == CSP_QUEUE_OK);
-#endif
-
 	return CSP_ERR_NONE;
 
 }
@@ -245,6 +439,12 @@ csp_conn_t * csp_conn_allocate(csp_conn_type_t type) {
 		conn->idout.ext = 0;
 		conn->socket = NULL;
 		conn->timestamp = 0;
+		conn->codel.target = 0;
+		conn->codel.interval = 0;
+		csp_codel_reset(&conn->codel_state);
+		conn->codel_drop = 0;
+		conn->ttl = 0;
+		conn->expired = 0;
 		conn->type = type;
 		conn->state = CONN_OPEN;
 		csp_conn_last_given = i;
@@ -327,6 +527,7 @@ int csp_conn_close(csp_conn_t * conn, uint8_t closed_by) {
 	/* Reset RDP state */
 #if (CSP_USE_RDP)
 	if (conn->idin.flags & CSP_FRDP) {
+		csp_conn_unschedule(conn);
 		csp_rdp_flush_all(conn);
 	}
 #endif
@@ -482,6 +683,67 @@ int csp_conn_flags(csp_conn_t * conn) {
 
 }
 
+int csp_conn_set_codel(csp_conn_t * conn, const csp_codel_conf_t * conf) {
+
+	if ((conn == NULL) || (conn->state != CONN_OPEN)) {
+		return CSP_ERR_INVAL;
+	}
+
+#if (CSP_USE_RDP)
+	/* Packets in the RX queue have already been acknowledged */
+	if (conf && conf->target && (conn->idin.flags & CSP_FRDP)) {
+		return CSP_ERR_NOTSUP;
+	}
+#endif
+
+	csp_codel_reset(&conn->codel_state);
+	if (conf) {
+		conn->codel = *conf;
+	} else {
+		conn->codel.target = 0;
+		conn->codel.interval = 0;
+	}
+
+	return CSP_ERR_NONE;
+
+}
+
+uint32_t csp_conn_codel_drops(csp_conn_t * conn) {
+
+	return conn->codel_drop;
+
+}
+
+int csp_conn_set_ttl(csp_conn_t * conn, uint32_t ttl) {
+
+	if ((conn == NULL) || (conn->state != CONN_OPEN)) {
+		return CSP_ERR_INVAL;
+	}
+
+	conn->ttl = ttl;
+
+	return CSP_ERR_NONE;
+
+}
+
+uint32_t csp_conn_expired_drops(csp_conn_t * conn) {
+
+	return conn->expired;
+
+}
+
+int csp_conn_fd(csp_conn_t * conn) {
+
+	if ((conn == NULL) || (conn->state != CONN_OPEN)) {
+		return CSP_ERR_INVAL;
+	}
+
+	const int fd = csp_queue_fd(conn->rx_queue);
+
+	return (fd >= 0) ? fd : CSP_ERR_NOTSUP;
+
+}
+
 #if (CSP_DEBUG)
 void csp_conn_print_table(void) {
 
@@ -25,6 +25,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_queue.h>
 #include <csp/arch/csp_semaphore.h>
 
+#include "csp_codel.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -78,6 +80,9 @@ typedef struct {
 	uint32_t ack_timeout;
 	uint32_t ack_delay_count;
 	uint32_t ack_timestamp;
+	uint32_t rx_timestamp;		/**< Time of last received data, ACKs are repeated until the connection has been idle for conn_timeout */
+	uint32_t deadline;		/**< Next timeout (retransmission, delayed ACK, connection or CLOSE-WAIT), see csp_conn_schedule() */
+	int timer;			/**< Index in the router shard's timer heap, -1 if not scheduled */
 	csp_bin_sem_handle_t tx_wait;
 	csp_queue_handle_t tx_queue;
 	csp_queue_handle_t rx_queue;
@@ -89,24 +94,29 @@ struct csp_conn_s {
 	csp_conn_state_t state;		/* Connection state (CONN_OPEN or CONN_CLOSED) */
 	csp_id_t idin;			/* Identifier received */
 	csp_id_t idout;			/* Identifier transmitted */
-#if (CSP_USE_QOS)
-	csp_queue_handle_t rx_event;	/* Event queue for RX packets */
-#endif
-	csp_queue_handle_t rx_queue[CSP_RX_QUEUES]; /* Queue for RX packets */
+	csp_queue_handle_t rx_queue;	/* Queue for RX packets, a priority per RX queue (QoS) */
 	csp_queue_handle_t socket;	/* Socket to be "woken" when first packet is ready */
 	uint32_t timestamp;		/* Time the connection was opened */
 	uint32_t opts;			/* Connection or socket options */
+	csp_codel_conf_t codel;		/* Active queue management of the RX queue, see csp_conn_set_codel() */
+	csp_codel_t codel_state;	/* CoDel state, used by the reader */
+	uint32_t codel_drop;		/* Packets dropped by CoDel */
+	uint32_t ttl;			/* Deadline (mS from csp_send()) of packets sent without one, 0 for none, see csp_conn_set_ttl() */
+	uint32_t expired;		/* Packets discarded past their deadline (send, read and RDP retransmission) */
 #if (CSP_USE_RDP)
 	csp_rdp_t rdp;			/* RDP state */
 #endif
 };
 
 int csp_conn_enqueue_packet(csp_conn_t * conn, csp_packet_t * packet);
+int csp_conn_enqueue_packets(csp_conn_t * conn, csp_packet_t ** packets, unsigned int count); // same RX queue (priority), returns number enqueued
+bool csp_conn_rx_drop(csp_conn_t * conn, csp_packet_t * packet, unsigned int behind); // reader: drop (free) packet past its deadline or queued for too long (CoDel)
 int csp_conn_init(void);
 csp_conn_t * csp_conn_allocate(csp_conn_type_t type);
 csp_conn_t * csp_conn_find(uint32_t id, uint32_t mask);
 csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout);
-void csp_conn_check_timeouts(void);
+void csp_conn_schedule(csp_conn_t * conn, uint32_t deadline); // RDP: call csp_rdp_check_timeouts() from the router at deadline (mS), earliest deadline is kept
+uint32_t csp_conn_check_timeouts(unsigned int shard); // expired timers only, returns mS until the next deadline
 int csp_conn_get_rxq(int prio);
 int csp_conn_close(csp_conn_t * conn, uint8_t closed_by);
 
@@ -62,9 +62,11 @@ static const uint32_t crc_tab[256] = {
 		0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351 };
 
 uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
-   uint32_t crc;
+   return csp_crc32_memory_update(0, data, length);
+}
 
-   crc = 0xFFFFFFFF;
+uint32_t csp_crc32_memory_update(uint32_t crc, const uint8_t * data, uint32_t length) {
+   crc ^= 0xFFFFFFFF;
    while (length--)
 #ifdef __AVR__
 	   crc = pgm_read_dword(&crc_tab[(crc ^ *data++) & 0xFFL]) ^ (crc >> 8);
@@ -79,7 +81,7 @@ int csp_crc32_append(csp_packet_t * packet, bool include_header) {
 
 	uint32_t crc;
 
-	if ((packet->length + sizeof(crc)) > csp_buffer_data_size()) {
+	if (csp_buffer_tailroom(packet) < sizeof(crc)) {
 		return CSP_ERR_NOMEM;
 	}
 
@@ -93,8 +95,7 @@ int csp_crc32_append(csp_packet_t * packet, bool include_header) {
 	crc = csp_hton32(crc);
 
 	/* Copy checksum to packet */
-	memcpy(&packet->data[packet->length], &crc, sizeof(crc));
-	packet->length += sizeof(crc);
+	memcpy(csp_buffer_put(packet, sizeof(crc)), &crc, sizeof(crc));
 
 	return CSP_ERR_NONE;
 
@@ -123,7 +124,7 @@ int csp_crc32_verify(csp_packet_t * packet, bool include_header) {
 	}
 
 	/* Strip CRC32 */
-	packet->length -= sizeof(crc);
+	csp_buffer_trim(packet, sizeof(crc));
 	return CSP_ERR_NONE;
 
 }
@@ -25,9 +25,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 /**
  * Check for a duplicate packet
+ * Duplicates have the same id, and thereby the same router shard - so each shard keeps its own history.
  * @param packet pointer to packet
+ * @param shard router shard
  * @return false if not a duplicate, true if duplicate
  */
-bool csp_dedup_is_duplicate(csp_packet_t *packet);
+bool csp_dedup_is_duplicate(csp_packet_t *packet, unsigned int shard);
 
 #endif /* CSP_DEDUP_H_ */
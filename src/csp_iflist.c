@@ -25,6 +25,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <csp/csp_debug.h>
 
+#include "csp_qfifo.h"
+
 /* Interfaces are stored in a linked list */
 static csp_iface_t * interfaces = NULL;
 
@@ -46,6 +48,7 @@ int csp_iflist_add(csp_iface_t *ifc) {
 	/* Add interface to pool */
 	if (interfaces == NULL) {
 		/* This is the first interface to be added */
+		ifc->ingress = NULL;
 		interfaces = ifc;
 	} else {
 		/* Insert interface last if not already in pool */
@@ -57,9 +60,15 @@ int csp_iflist_add(csp_iface_t *ifc) {
 			last = i;
 		}
 
+		ifc->ingress = NULL;
 		last->next = ifc;
 	}
 
+	/* Router ingress state - if not initialized yet, it is created by csp_init() */
+	if (csp_qfifo_add_iface(ifc) != CSP_ERR_NONE) {
+		csp_log_warn("Interface %s: no memory for router ingress state, sharing the default", ifc->name);
+	}
+
 	return CSP_ERR_NONE;
 }
 
@@ -96,9 +105,11 @@ void csp_iflist_print(void) {
 		csp_bytesize(rxbuf, sizeof(rxbuf), i->rxbytes);
 		printf("%-10s tx: %05"PRIu32" rx: %05"PRIu32" txe: %05"PRIu32" rxe: %05"PRIu32"\r\n"
 		       "           drop: %05"PRIu32" autherr: %05"PRIu32 " frame: %05"PRIu32"\r\n"
+		       "           queued: %u qdrop: %05"PRIu32" codel: %05"PRIu32" expired: %05"PRIu32" weight: %u\r\n"
 		       "           txb: %"PRIu32" (%s) rxb: %"PRIu32" (%s) MTU: %u\r\n\r\n",
 		       i->name, i->tx, i->rx, i->tx_error, i->rx_error, i->drop,
-		       i->autherr, i->frame, i->txbytes, txbuf, i->rxbytes, rxbuf, i->mtu);
+		       i->autherr, i->frame, csp_qfifo_ingress_depth(i), i->ingress_drop, i->codel_drop, i->expired, (i->weight) ? i->weight : 1,
+		       i->txbytes, txbuf, i->rxbytes, rxbuf, i->mtu);
 		i = i->next;
 	}
 }
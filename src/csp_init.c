@@ -24,7 +24,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_time.h>
 #include "csp_conn.h"
 #include "csp_qfifo.h"
+#include "csp_route.h"
 #include "csp_port.h"
+#include "csp_poll.h"
 
 csp_conf_t csp_conf;
 
@@ -49,6 +51,17 @@ int csp_init(const csp_conf_t * conf) {
 		return ret;
 	}
 
+	/* Router shards are needed by the connection (RDP) timers */
+	ret = csp_qfifo_init();
+	if (ret != CSP_ERR_NONE) {
+		return ret;
+	}
+
+	ret = csp_route_init();
+	if (ret != CSP_ERR_NONE) {
+		return ret;
+	}
+
 	ret = csp_conn_init();
 	if (ret != CSP_ERR_NONE) {
 		return ret;
@@ -59,7 +72,7 @@ int csp_init(const csp_conf_t * conf) {
 		return ret;
 	}
 
-	ret = csp_qfifo_init();
+	ret = csp_poll_init();
 	if (ret != CSP_ERR_NONE) {
 		return ret;
 	}
@@ -80,6 +93,8 @@ int csp_init(const csp_conf_t * conf) {
 void csp_free_resources(void) {
 
 	csp_rtable_free();
+	csp_poll_free_resources();
+	csp_route_free_resources();
 	csp_qfifo_free_resources();
 	csp_port_free_resources();
 	csp_conn_free_resources();
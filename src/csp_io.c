@@ -122,6 +122,17 @@ csp_conn_t * csp_accept(csp_socket_t * sock, uint32_t timeout) {
 
 }
 
+int csp_socket_fd(csp_socket_t * sock) {
+
+	if ((sock == NULL) || (sock->socket == NULL)) {
+		return CSP_ERR_INVAL;
+	}
+
+	const int fd = csp_queue_fd(sock->socket);
+	return (fd >= 0) ? fd : CSP_ERR_NOTSUP;
+
+}
+
 csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 
 	csp_packet_t * packet = NULL;
@@ -137,22 +148,12 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
         }
 #endif
 
-#if (CSP_USE_QOS)
-	int event;
-	if (csp_queue_dequeue(conn->rx_event, &event, timeout) != CSP_QUEUE_OK) {
-		return NULL;
-	}
-
-	for (int prio = 0; prio < CSP_RX_QUEUES; prio++) {
-		if (csp_queue_dequeue(conn->rx_queue[prio], &packet, 0) == CSP_QUEUE_OK) {
-			break;
+	/* Highest priority first (QoS), skipping packets past their deadline or dropped by CoDel */
+	do {
+		if (csp_queue_dequeue(conn->rx_queue, &packet, timeout) != CSP_QUEUE_OK) {
+			return NULL;
 		}
-	}
-#else
-	if (csp_queue_dequeue(conn->rx_queue[0], &packet, timeout) != CSP_QUEUE_OK) {
-		return NULL;
-	}
-#endif
+	} while (csp_conn_rx_drop(conn, packet, 0));
 
 #if (CSP_USE_RDP)
 	/* Packet read could trigger ACK transmission */
@@ -165,6 +166,44 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 
 }
 
+int csp_read_n(csp_conn_t * conn, csp_packet_t ** packets, unsigned int count, uint32_t timeout) {
+
+	if ((conn == NULL) || (conn->state != CONN_OPEN) || (packets == NULL)) {
+		return 0;
+	}
+
+#if (CSP_USE_RDP)
+        // RDP: timeout can either be 0 (for no hang poll/check) or minimum the "connection timeout"
+        if (timeout && (conn->idin.flags & CSP_FRDP) && (timeout < conn->rdp.conn_timeout)) {
+            timeout = conn->rdp.conn_timeout;
+        }
+#endif
+
+	/* Highest priority first (QoS) */
+	unsigned int read = 0;
+	int n;
+	while ((read < count) && ((n = csp_queue_dequeue_n(conn->rx_queue, &packets[read], count - read, (read) ? 0 : timeout)) > 0)) {
+		/* Skip packets past their deadline or dropped by CoDel */
+		unsigned int kept = read;
+		for (unsigned int i = read; i < (read + n); i++) {
+			if (!csp_conn_rx_drop(conn, packets[i], read + n - i - 1)) {
+				packets[kept++] = packets[i];
+			}
+		}
+		read = kept;
+	}
+
+#if (CSP_USE_RDP)
+	/* Packets read could trigger ACK transmission */
+	if (read && (conn->idin.flags & CSP_FRDP) && conn->rdp.delayed_acks) {
+		csp_rdp_check_ack(conn);
+	}
+#endif
+
+	return read;
+
+}
+
 int csp_send_direct(csp_id_t idout, csp_packet_t * packet, const csp_route_t * ifroute, uint32_t timeout) {
 
 	if (packet == NULL) {
@@ -179,20 +218,64 @@ int csp_send_direct(csp_id_t idout, csp_packet_t * packet, const csp_route_t * i
 
 	csp_iface_t * ifout = ifroute->iface;
 
+	/* Don't spend bandwidth on packets past their deadline */
+	if (csp_buffer_deadline(packet) && csp_buffer_expired(packet, csp_get_ms())) {
+		csp_log_packet("OUT: expired packet discarded, %s", ifout->name);
+		ifout->drop++;
+		ifout->expired++;
+		return CSP_ERR_TIMEDOUT;
+	}
+
 	csp_log_packet("OUT: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %u VIA: %s (%u)",
                        idout.src, idout.dst, idout.dport, idout.sport, idout.pri, idout.flags, packet->length, ifout->name, (ifroute->via != CSP_NO_VIA_ADDRESS) ? ifroute->via : idout.dst);
 
+	/* Trailers (hmac, crc32, xtea) and interfaces framing in place modify the packet, so a shared packet
+	   (e.g. queued for RDP retransmission) is copied - otherwise it is sent as is. The caller's reference is released on success */
+	const bool modify = ((idout.src == csp_conf.address) && (idout.flags & (CSP_FHMAC | CSP_FCRC32 | CSP_FXTEA))) || ifout->tx_inplace;
+	csp_packet_t * const orig = packet;
+	if ((packet->id.ext != idout.ext) && (csp_buffer_refcount(packet) > 1)) {
+		packet = csp_buffer_clone(packet);
+		if (packet == NULL) {
+			goto tx_err;
+		}
+	}
+
 	/* Copy identifier to packet (before crc, xtea and hmac) */
 	packet->id.ext = idout.ext;
 
 #if (CSP_USE_PROMISC)
 	/* Loopback traffic is added to promisc queue by the router */
 	if (idout.dst != csp_get_address() && idout.src == csp_get_address()) {
-		packet->id.ext = idout.ext;
+		/* Promisc gets the packet as sent by the user, trailers are added to the private copy made below */
 		csp_promisc_add(packet);
 	}
 #endif
 
+	if (modify && (csp_buffer_refcount(packet) > 1)) {
+		csp_packet_t * copy = csp_buffer_clone(packet);
+		if (packet != orig) {
+			csp_buffer_free(packet);
+		}
+		packet = copy;
+		if (packet == NULL) {
+			goto tx_err;
+		}
+	}
+
+	/* Chained packets are linearized, unless supported all the way (no trailers and interface support) */
+	if (csp_buffer_chain_next(packet) &&
+	    ((ifout->chain_tx == 0) || ((idout.src == csp_conf.address) && (idout.flags & (CSP_FHMAC | CSP_FCRC32 | CSP_FXTEA))))) {
+		csp_packet_t * linear = csp_buffer_chain_linearize(packet);
+		if (packet != orig) {
+			csp_buffer_free(packet);
+		}
+		packet = linear;
+		if (packet == NULL) {
+			csp_log_warn("Failed to linearize chained packet");
+			goto tx_err;
+		}
+	}
+
 	/* Only encrypt packets from the current node */
 	if (idout.src == csp_conf.address) {
 		/* Append HMAC */
@@ -241,7 +324,7 @@ int csp_send_direct(csp_id_t idout, csp_packet_t * packet, const csp_route_t * i
 	}
 
 	/* Store length before passing to interface */
-	uint16_t bytes = packet->length;
+	uint16_t bytes = csp_buffer_chain_length(packet);
 	uint16_t mtu = ifout->mtu;
 
 	if (mtu > 0 && bytes > mtu)
@@ -250,11 +333,18 @@ int csp_send_direct(csp_id_t idout, csp_packet_t * packet, const csp_route_t * i
 	if ((*ifout->nexthop)(ifroute, packet) != CSP_ERR_NONE)
 		goto tx_err;
 
+	if (packet != orig) {
+		csp_buffer_free(orig);
+	}
+
 	ifout->tx++;
 	ifout->txbytes += bytes;
 	return CSP_ERR_NONE;
 
 tx_err:
+	if (packet != orig) {
+		csp_buffer_free(packet);
+	}
 	ifout->tx_error++;
 err:
 	return CSP_ERR_TX;
@@ -268,8 +358,30 @@ int csp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 		return 0;
 	}
 
+	/* Deadline of the connection, unless the packet has its own */
+	if (conn->ttl || csp_buffer_deadline(packet)) {
+		const uint32_t now = csp_get_ms();
+		if (csp_buffer_deadline(packet) == 0) {
+			const uint32_t deadline = now + conn->ttl;
+			csp_buffer_set_deadline(packet, (deadline) ? deadline : 1);
+		} else if (csp_buffer_expired(packet, now)) {
+			conn->expired++;
+			return 0;
+		}
+	}
+
 #if (CSP_USE_RDP)
 	if (conn->idout.flags & CSP_FRDP) {
+		/* RDP doesn't support chained packets */
+		if (csp_buffer_chain_next(packet)) {
+			csp_packet_t * linear = csp_buffer_chain_linearize(packet);
+			if ((linear == NULL) || !csp_send(conn, linear, timeout)) {
+				csp_buffer_free(linear);
+				return 0;
+			}
+			csp_buffer_free(packet);
+			return 1;
+		}
 		if (csp_rdp_send(conn, packet) != CSP_ERR_NONE) {
 			return 0;
 		}
@@ -290,7 +402,7 @@ int csp_send_prio(uint8_t prio, csp_conn_t * conn, csp_packet_t * packet, uint32
 int csp_transaction_persistent(csp_conn_t * conn, uint32_t timeout, void * outbuf, int outlen, void * inbuf, int inlen) {
 
 	int size = (inlen > outlen) ? inlen : outlen;
-	csp_packet_t * packet = csp_buffer_get(size);
+	csp_packet_t * packet = csp_buffer_get_prio(size, conn->idout.pri, 0);
 	if (packet == NULL)
 		return 0;
 
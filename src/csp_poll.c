@@ -0,0 +1,192 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "csp_poll.h"
+
+#include <csp/csp.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_conn.h"
+#include "transport/csp_transport.h"
+
+/* Task waiting in csp_poll() */
+typedef struct csp_poll_waiter_s {
+	csp_bin_sem_handle_t sem;
+	struct csp_poll_waiter_s * next;
+} csp_poll_waiter_t;
+
+// Waiting tasks, protected by csp_poll_lock
+static csp_poll_waiter_t * csp_poll_waiters;
+static csp_bin_sem_handle_t csp_poll_lock;
+static volatile unsigned int csp_poll_waiting;
+static bool csp_poll_initialized;
+
+int csp_poll_init(void) {
+
+	if (!csp_poll_initialized) {
+		if (csp_bin_sem_create(&csp_poll_lock) != CSP_SEMAPHORE_OK) {
+			return CSP_ERR_NOMEM;
+		}
+		csp_poll_initialized = true;
+	}
+	csp_poll_waiters = NULL;
+	csp_poll_waiting = 0;
+
+	return CSP_ERR_NONE;
+
+}
+
+void csp_poll_free_resources(void) {
+
+	if (csp_poll_initialized) {
+		csp_bin_sem_remove(&csp_poll_lock);
+		csp_poll_initialized = false;
+	}
+	csp_poll_waiters = NULL;
+	csp_poll_waiting = 0;
+
+}
+
+void csp_poll_notify(void) {
+
+	// pairs with the barrier in csp_poll(): either the waiter sees the new state, or we see the waiter
+	__sync_synchronize();
+	if (csp_poll_waiting == 0) {
+		return;
+	}
+
+	csp_bin_sem_wait(&csp_poll_lock, CSP_MAX_TIMEOUT);
+	for (csp_poll_waiter_t * waiter = csp_poll_waiters; waiter; waiter = waiter->next) {
+		csp_bin_sem_post(&waiter->sem);
+	}
+	csp_bin_sem_post(&csp_poll_lock);
+
+}
+
+static uint8_t csp_poll_conn(csp_conn_t * conn, uint8_t events) {
+
+	if (conn->state != CONN_OPEN) {
+		return CSP_POLLERR;
+	}
+
+	uint8_t revents = 0;
+	if ((events & CSP_POLLIN) && (csp_queue_size(conn->rx_queue) > 0)) {
+		revents |= CSP_POLLIN;
+	}
+
+#if (CSP_USE_RDP)
+	if (conn->idin.flags & CSP_FRDP) {
+		return revents | csp_rdp_poll(conn, events);
+	}
+#endif
+
+	return revents | (events & CSP_POLLOUT);
+
+}
+
+static uint8_t csp_poll_socket(csp_socket_t * socket, uint8_t events) {
+
+	if (socket->socket == NULL) {
+		return CSP_POLLERR;
+	}
+
+	return ((events & CSP_POLLIN) && (csp_queue_size(socket->socket) > 0)) ? CSP_POLLIN : 0;
+
+}
+
+static int csp_poll_check(csp_pollfd_t * fds, unsigned int count) {
+
+	int ready = 0;
+	for (unsigned int i = 0; i < count; ++i) {
+		csp_pollfd_t * fd = &fds[i];
+		if (fd->conn) {
+			fd->revents = csp_poll_conn(fd->conn, fd->events);
+		} else if (fd->socket) {
+			fd->revents = csp_poll_socket(fd->socket, fd->events);
+		} else {
+			fd->revents = 0;
+		}
+		if (fd->revents) {
+			++ready;
+		}
+	}
+
+	return ready;
+
+}
+
+int csp_poll(csp_pollfd_t * fds, unsigned int count, uint32_t timeout) {
+
+	if ((fds == NULL) && count) {
+		return CSP_ERR_INVAL;
+	}
+
+	int ready = csp_poll_check(fds, count);
+	if (ready || (timeout == 0)) {
+		return ready;
+	}
+
+	csp_poll_waiter_t waiter = {.next = NULL};
+	if (csp_bin_sem_create(&waiter.sem) != CSP_SEMAPHORE_OK) {
+		return CSP_ERR_NOMEM;
+	}
+	csp_bin_sem_wait(&waiter.sem, 0); // semaphore is created 'available'
+
+	csp_bin_sem_wait(&csp_poll_lock, CSP_MAX_TIMEOUT);
+	waiter.next = csp_poll_waiters;
+	csp_poll_waiters = &waiter;
+	csp_poll_waiting++;
+	csp_bin_sem_post(&csp_poll_lock);
+
+	const uint32_t start = csp_get_ms();
+	for (;;) {
+		// pairs with the barrier in csp_poll_notify()
+		__sync_synchronize();
+		ready = csp_poll_check(fds, count);
+		if (ready) {
+			break;
+		}
+		uint32_t remaining = CSP_MAX_TIMEOUT;
+		if (timeout != CSP_MAX_TIMEOUT) {
+			const uint32_t elapsed = csp_get_ms() - start;
+			if (elapsed >= timeout) {
+				break;
+			}
+			remaining = timeout - elapsed;
+		}
+		csp_bin_sem_wait(&waiter.sem, remaining);
+	}
+
+	csp_bin_sem_wait(&csp_poll_lock, CSP_MAX_TIMEOUT);
+	for (csp_poll_waiter_t ** last = &csp_poll_waiters; *last; last = &(*last)->next) {
+		if (*last == &waiter) {
+			*last = waiter.next;
+			break;
+		}
+	}
+	csp_poll_waiting--;
+	csp_bin_sem_post(&csp_poll_lock);
+	csp_bin_sem_remove(&waiter.sem);
+
+	return ready;
+
+}
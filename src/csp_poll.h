@@ -0,0 +1,47 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _SRC_CSP_POLL_H_
+#define _SRC_CSP_POLL_H_
+
+#include <csp/csp_poll.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Init poll waiter list
+ * @return CSP_ERR type
+ */
+int csp_poll_init(void);
+
+void csp_poll_free_resources(void);
+
+/**
+ * Wake up tasks waiting in csp_poll().
+ * Must be called after a connection or socket may have become ready, e.g. packet queued or RDP window opened.
+ */
+void csp_poll_notify(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
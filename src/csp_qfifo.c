@@ -20,33 +20,134 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "csp_qfifo.h"
 
+#include <csp/csp_iflist.h>
+#include <csp/csp_rtable.h>
 #include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_malloc.h>
+#include <csp/arch/csp_time.h>
 
+#include "csp_codel.h"
 #include "csp_init.h"
+#include "csp_io.h"
+#include "csp_promisc.h"
+
+/* End of a stage list */
+#define CSP_QFIFO_NONE	(~0U)
+
+/* Router input of an interface, per shard and priority (QoS) */
+typedef struct {
+	uint32_t queued;		// packets admitted and not yet routed, queued or staged (atomic)
+	unsigned int head;		// staged packets, oldest first - router only
+	unsigned int tail;
+	unsigned int staged;
+	csp_codel_t codel;		// AQM state, if enabled by the interface (csp_iface_t.codel) - router only
+} csp_qfifo_lane_t;
+
+typedef struct csp_qfifo_ingress_s {
+	csp_iface_t * iface;		// NULL for the shared ingress, used by interfaces not in the interface list
+	csp_qfifo_lane_t lane[CSP_ROUTE_SHARDS_MAX][CSP_ROUTE_FIFOS];
+	struct csp_qfifo_ingress_s * next;
+} csp_qfifo_ingress_t;
+
+/* Router queue element, tagged with the ingress the packet was admitted on */
+typedef struct {
+	csp_qfifo_t input;
+	csp_qfifo_ingress_t * ingress;	// NULL for a wake-up, see csp_qfifo_wake_up_shard()
+} csp_qfifo_entry_t;
+
+/* Packet taken from the router queue, but not yet routed */
+typedef struct {
+	csp_qfifo_t input;
+	unsigned int next;		// next staged packet of the same ingress and priority, or next free
+} csp_qfifo_stage_t;
+
+/* Deficit round robin state, per shard and priority */
+typedef struct {
+	csp_qfifo_ingress_t * current;	// ingress being served
+	unsigned int deficit;		// packets left of its quantum (weight)
+} csp_qfifo_drr_t;
+
+/* Router input of a shard - a single priority queue for all interfaces, the rest is only used by the router */
+typedef struct {
+	csp_queue_handle_t queue;
+	uint32_t admitted[CSP_ROUTE_FIFOS];	// packets admitted and not yet routed, all interfaces (atomic)
+	csp_qfifo_stage_t * stage;
+	unsigned int stage_free;
+	unsigned int stage_count;
+	unsigned int staged[CSP_ROUTE_FIFOS];
+	csp_qfifo_drr_t drr[CSP_ROUTE_FIFOS];
+} csp_qfifo_shard_t;
+
+/* Ingress list - the shared ingress first, followed by an entry per interface */
+static csp_qfifo_ingress_t qfifo_shared;
+static csp_qfifo_shard_t qfifo_shard[CSP_ROUTE_SHARDS_MAX];
+
+/* Router queue length per priority and shard */
+static unsigned int qfifo_length;
+static unsigned int qfifo_shards = 1;
+static bool qfifo_initialized;
+
+int csp_qfifo_add_iface(csp_iface_t * iface) {
+
+	if (!qfifo_initialized || iface->ingress) {
+		return CSP_ERR_NONE;
+	}
 
-static csp_queue_handle_t qfifo[CSP_ROUTE_FIFOS];
-#if (CSP_USE_QOS)
-static csp_queue_handle_t qfifo_events;
-#endif
+	csp_qfifo_ingress_t * ingress = csp_calloc(1, sizeof(*ingress));
+	if (ingress == NULL) {
+		return CSP_ERR_NOMEM;
+	}
+	ingress->iface = iface;
+
+	/* Append - the router may be traversing the list, so publish the entry with a release store */
+	csp_qfifo_ingress_t * last = &qfifo_shared;
+	while (last->next) {
+		last = last->next;
+	}
+	__atomic_store_n(&last->next, ingress, __ATOMIC_RELEASE);
+	__atomic_store_n(&iface->ingress, ingress, __ATOMIC_RELEASE);
+
+	return CSP_ERR_NONE;
+
+}
 
 int csp_qfifo_init(void) {
 
-	/* Create router fifos for each priority */
-	for (int prio = 0; prio < CSP_ROUTE_FIFOS; prio++) {
-		if (qfifo[prio] == NULL) {
-			qfifo[prio] = csp_queue_create(csp_conf.fifo_length, sizeof(csp_qfifo_t));
-			if (!qfifo[prio])
-				return CSP_ERR_NOMEM;
+	qfifo_shards = csp_conf.route_shards;
+	if (qfifo_shards == 0) {
+		qfifo_shards = 1;
+	} else if (qfifo_shards > CSP_ROUTE_SHARDS_MAX) {
+		qfifo_shards = CSP_ROUTE_SHARDS_MAX;
+	}
+
+	/* Room for fifo_length packets of a single interface, see csp_qfifo_admit() */
+	qfifo_length = 2 * csp_conf.fifo_length;
+	const unsigned int stage_length = qfifo_length * CSP_ROUTE_FIFOS;
+
+	/* Create router fifos */
+	for (unsigned int shard = 0; shard < qfifo_shards; shard++) {
+		csp_qfifo_shard_t * s = &qfifo_shard[shard];
+		s->queue = csp_queue_create_prio(qfifo_length, sizeof(csp_qfifo_entry_t), CSP_ROUTE_FIFOS);
+		s->stage = csp_calloc(stage_length, sizeof(*s->stage));
+		if ((s->queue == NULL) || (s->stage == NULL)) {
+			return CSP_ERR_NOMEM;
+		}
+		for (unsigned int i = 0; i < stage_length; i++) {
+			s->stage[i].next = ((i + 1) < stage_length) ? (i + 1) : CSP_QFIFO_NONE;
+		}
+		s->stage_free = 0;
+		for (unsigned int fifo = 0; fifo < CSP_ROUTE_FIFOS; fifo++) {
+			s->drr[fifo].current = &qfifo_shared;
 		}
 	}
+	qfifo_initialized = true;
 
-#if (CSP_USE_QOS)
-	/* Create QoS fifo notification queue */
-	qfifo_events = csp_queue_create(csp_conf.fifo_length, sizeof(int));
-	if (!qfifo_events) {
-		return CSP_ERR_NOMEM;
+	/* Interfaces already added */
+	for (csp_iface_t * iface = csp_iflist_get(); iface != NULL; iface = iface->next) {
+		if (csp_qfifo_add_iface(iface) != CSP_ERR_NONE) {
+			return CSP_ERR_NOMEM;
+		}
 	}
-#endif
 
 	return CSP_ERR_NONE;
 
@@ -54,53 +155,237 @@ int csp_qfifo_init(void) {
 
 void csp_qfifo_free_resources(void) {
 
-	for (int prio = 0; prio < CSP_ROUTE_FIFOS; prio++) {
-		if (qfifo[prio]) {
-			csp_queue_remove(qfifo[prio]);
-			qfifo[prio] = NULL;
+	csp_qfifo_ingress_t * ingress = qfifo_shared.next;
+	while (ingress) {
+		csp_qfifo_ingress_t * next = ingress->next;
+		ingress->iface->ingress = NULL;
+		csp_free(ingress);
+		ingress = next;
+	}
+	memset(&qfifo_shared, 0, sizeof(qfifo_shared));
+
+	for (unsigned int shard = 0; shard < CSP_ROUTE_SHARDS_MAX; shard++) {
+		csp_qfifo_shard_t * s = &qfifo_shard[shard];
+		if (s->queue) {
+			csp_queue_remove(s->queue);
 		}
+		csp_free(s->stage);
+		memset(s, 0, sizeof(*s));
 	}
+	qfifo_initialized = false;
+	qfifo_shards = 1;
 
-#if (CSP_USE_QOS)
-	if (qfifo_events) {
-		csp_queue_remove(qfifo_events);
-		qfifo_events = NULL;
+}
+
+unsigned int csp_qfifo_shards(void) {
+
+	return qfifo_shards;
+
+}
+
+unsigned int csp_qfifo_shard(uint32_t id) {
+
+	if (qfifo_shards == 1) {
+		return 0;
 	}
-#endif
+
+	/* Multiplicative hash of the connection tuple (src, dst, dport, sport) */
+	return (((id & CSP_ID_CONN_MASK) * 2654435761U) >> 16) % qfifo_shards;
 
 }
 
-int csp_qfifo_read(csp_qfifo_t * input) {
+static inline unsigned int csp_qfifo_fifo(const csp_packet_t * packet) {
 
 #if (CSP_USE_QOS)
-	int prio, found, event;
+	return packet->id.pri;
+#else
+	(void) packet;
+	return 0;
+#endif
 
-	/* Wait for packet in any queue */
-	if (csp_queue_dequeue(qfifo_events, &event, FIFO_TIMEOUT) != CSP_QUEUE_OK)
-		return CSP_ERR_TIMEDOUT;
+}
+
+/* Move queued packets to the stage (a single lock for up to CSP_ROUTE_BATCH_MAX packets), waiting up to timeout for the first */
+static void csp_qfifo_drain(unsigned int shard, uint32_t timeout) {
+
+	csp_qfifo_shard_t * s = &qfifo_shard[shard];
+	csp_qfifo_entry_t entries[CSP_ROUTE_BATCH_MAX];
+	const unsigned int stage_length = qfifo_length * CSP_ROUTE_FIFOS;
+
+	while (s->stage_count < stage_length) {
+
+		const unsigned int wanted = ((stage_length - s->stage_count) < CSP_ROUTE_BATCH_MAX) ? (stage_length - s->stage_count) : CSP_ROUTE_BATCH_MAX;
+		const int n = csp_queue_dequeue_n(s->queue, entries, wanted, timeout);
+		if (n <= 0) {
+			return;
+		}
+		timeout = 0;
+
+		for (int i = 0; i < n; i++) {
+			csp_qfifo_ingress_t * ingress = entries[i].ingress;
+			if (ingress == NULL) {
+				continue;
+			}
+
+			const unsigned int fifo = csp_qfifo_fifo(entries[i].input.packet);
+			csp_qfifo_lane_t * lane = &ingress->lane[shard][fifo];
+
+			const unsigned int index = s->stage_free;
+			s->stage_free = s->stage[index].next;
+			s->stage[index].input = entries[i].input;
+			s->stage[index].next = CSP_QFIFO_NONE;
+
+			if (lane->staged) {
+				s->stage[lane->tail].next = index;
+			} else {
+				lane->head = index;
+			}
+			lane->tail = index;
+			lane->staged++;
+			s->staged[fifo]++;
+			s->stage_count++;
+		}
 
-	/* Find packet with highest priority */
-	found = 0;
-	for (prio = 0; prio < CSP_ROUTE_FIFOS; prio++) {
-		if (csp_queue_dequeue(qfifo[prio], input, 0) == CSP_QUEUE_OK) {
-			found = 1;
-			break;
+		if ((unsigned int) n < wanted) {
+			return;
 		}
 	}
 
-	if (!found) {
-		csp_log_warn("Spurious wakeup: No packet found");
-		return CSP_ERR_TIMEDOUT;
+}
+
+/* Read up to count staged packets of a shard - highest priority first, deficit round robin between interfaces at the same priority */
+static unsigned int csp_qfifo_read_drr(unsigned int shard, csp_qfifo_t * input, unsigned int count) {
+
+	csp_qfifo_shard_t * s = &qfifo_shard[shard];
+	unsigned int read = 0;
+
+	for (unsigned int fifo = 0; (fifo < CSP_ROUTE_FIFOS) && (read < count); fifo++) {
+
+		csp_qfifo_drr_t * drr = &s->drr[fifo];
+
+		while ((read < count) && (s->staged[fifo] > 0)) {
+
+			csp_qfifo_ingress_t * ingress = drr->current;
+			csp_qfifo_lane_t * lane = &ingress->lane[shard][fifo];
+
+			if (lane->staged > 0) {
+
+				/* A new turn, add the quantum */
+				if (drr->deficit == 0) {
+					drr->deficit = ((ingress->iface != NULL) && (ingress->iface->weight > 1)) ? ingress->iface->weight : 1;
+				}
+
+				/* Oldest staged packet of the interface */
+				const unsigned int index = lane->head;
+				const csp_qfifo_t next = s->stage[index].input;
+				lane->head = s->stage[index].next;
+				lane->staged--;
+				s->staged[fifo]--;
+				s->stage_count--;
+				s->stage[index].next = s->stage_free;
+				s->stage_free = index;
+				drr->deficit--;
+
+				/* No longer counted against the interface, see csp_qfifo_admit() */
+				__atomic_fetch_sub(&lane->queued, 1, __ATOMIC_RELAXED);
+				__atomic_fetch_sub(&s->admitted[fifo], 1, __ATOMIC_RELAXED);
+
+				/* Packets dropped by CoDel count as served */
+				csp_iface_t * iface = ingress->iface;
+				if ((iface != NULL) && iface->codel.target &&
+				    csp_codel_drop(&lane->codel, &iface->codel, next.packet, csp_get_ms(), s->queue, lane->staged)) {
+					iface->drop++;
+					iface->codel_drop++;
+					csp_buffer_free(next.packet);
+				} else {
+					input[read++] = next;
+				}
+			}
+
+			/* Next interface, when the quantum is used (or nothing is staged) */
+			if ((drr->deficit == 0) || (lane->staged == 0)) {
+				csp_qfifo_ingress_t * following = __atomic_load_n(&ingress->next, __ATOMIC_ACQUIRE);
+				drr->current = (following != NULL) ? following : &qfifo_shared;
+				drr->deficit = 0;
+			}
+		}
 	}
-#else
-	if (csp_queue_dequeue(qfifo[0], input, FIFO_TIMEOUT) != CSP_QUEUE_OK)
+
+	return read;
+
+}
+
+int csp_qfifo_read(csp_qfifo_t * input) {
+
+	if (csp_qfifo_read_n(0, input, 1, CSP_MAX_TIMEOUT) != 1)
 		return CSP_ERR_TIMEDOUT;
-#endif
 
 	return CSP_ERR_NONE;
 
 }
 
+int csp_qfifo_read_n(unsigned int shard, csp_qfifo_t * input, unsigned int count, uint32_t timeout) {
+
+	if (shard >= qfifo_shards) {
+		return 0;
+	}
+
+	/* Stage everything queued, so all interfaces with packets take part in the round robin - only wait if nothing is staged */
+	csp_qfifo_drain(shard, (qfifo_shard[shard].stage_count == 0) ? timeout : 0);
+
+	return csp_qfifo_read_drr(shard, input, count);
+
+}
+
+/* Forward a transit packet directly to the outgoing interface (cut-through), as the router would - task context only */
+static void csp_qfifo_forward(csp_packet_t * packet, csp_iface_t * iface) {
+
+#if (CSP_USE_PROMISC)
+	csp_promisc_add(packet);
+#endif
+
+	iface->rx++;
+	iface->rxbytes += packet->length;
+
+	/* If the message resolves to the input interface, don't loop it back out */
+	const csp_route_t * ifroute = csp_rtable_find_route(packet->id.dst);
+	if ((ifroute == NULL) || ((ifroute->iface == iface) && (iface->split_horizon_off == 0))) {
+		csp_buffer_free(packet);
+		return;
+	}
+
+	if (csp_send_direct(packet->id, packet, ifroute, 0) != CSP_ERR_NONE) {
+		csp_buffer_free(packet);
+	}
+
+}
+
+/* Count a packet against its interface, unless the interface already has as many packets queued as there is free space left
+   (dynamic threshold) - an interface alone can use half the router queue (fifo_length), and a busy interface always leaves
+   room for others. */
+static bool csp_qfifo_admit(csp_qfifo_ingress_t * ingress, unsigned int shard, unsigned int fifo) {
+
+	csp_qfifo_lane_t * lane = &ingress->lane[shard][fifo];
+	uint32_t * admitted = &qfifo_shard[shard].admitted[fifo];
+
+	const uint32_t used = __atomic_load_n(admitted, __ATOMIC_RELAXED);
+	if ((used >= qfifo_length) || (__atomic_load_n(&lane->queued, __ATOMIC_RELAXED) >= (qfifo_length - used))) {
+		return false;
+	}
+
+	__atomic_fetch_add(&lane->queued, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(admitted, 1, __ATOMIC_RELAXED);
+	return true;
+
+}
+
+static void csp_qfifo_unadmit(csp_qfifo_ingress_t * ingress, unsigned int shard, unsigned int fifo) {
+
+	__atomic_fetch_sub(&ingress->lane[shard][fifo].queued, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&qfifo_shard[shard].admitted[fifo], 1, __ATOMIC_RELAXED);
+
+}
+
 void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, CSP_BASE_TYPE * pxTaskWoken) {
 
 	int result;
@@ -123,37 +408,48 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, CSP_BASE_TYPE *
 		return;
 	}
 
-	csp_qfifo_t queue_element;
-	queue_element.iface = iface;
-	queue_element.packet = packet;
+	/* Transit packets bypass the router task (cut-through) */
+	if (iface->cut_through && (pxTaskWoken == NULL) &&
+	    (packet->id.dst != csp_conf.address) && (packet->id.dst != CSP_BROADCAST_ADDR)) {
+		csp_qfifo_forward(packet, iface);
+		return;
+	}
 
-#if (CSP_USE_QOS)
-	int fifo = packet->id.pri;
-#else
-	int fifo = 0;
-#endif
+	csp_qfifo_entry_t queue_element;
+	queue_element.input.iface = iface;
+	queue_element.input.packet = packet;
+	queue_element.ingress = __atomic_load_n((csp_qfifo_ingress_t **) &iface->ingress, __ATOMIC_ACQUIRE);
+	if (queue_element.ingress == NULL) {
+		queue_element.ingress = &qfifo_shared;
+	}
 
-	if (pxTaskWoken == NULL)
-		result = csp_queue_enqueue(qfifo[fifo], &queue_element, 0);
-	else
-		result = csp_queue_enqueue_isr(qfifo[fifo], &queue_element, pxTaskWoken);
+	const unsigned int fifo = csp_qfifo_fifo(packet);
+	const unsigned int shard = csp_qfifo_shard(packet->id.ext);
 
-#if (CSP_USE_QOS)
-	static int event = 0;
+	/* Time stamp for active queue management */
+	if (iface->codel.target) {
+		csp_codel_stamp(packet, (pxTaskWoken == NULL) ? csp_get_ms() : csp_get_ms_isr());
+	}
 
-	if (result == CSP_QUEUE_OK) {
+	/* A single queue for all interfaces, each interface limited to its share */
+	if (!csp_qfifo_admit(queue_element.ingress, shard, fifo)) {
+		result = CSP_QUEUE_FULL;
+	} else {
 		if (pxTaskWoken == NULL)
-			csp_queue_enqueue(qfifo_events, &event, 0);
+			result = csp_queue_enqueue_prio(qfifo_shard[shard].queue, &queue_element, fifo, 0);
 		else
-			csp_queue_enqueue_isr(qfifo_events, &event, pxTaskWoken);
+			result = csp_queue_enqueue_prio_isr(qfifo_shard[shard].queue, &queue_element, fifo, pxTaskWoken);
+		if (result != CSP_QUEUE_OK) {
+			csp_qfifo_unadmit(queue_element.ingress, shard, fifo);
+		}
 	}
-#endif
 
 	if (result != CSP_QUEUE_OK) {
 		if (pxTaskWoken == NULL) { // Only do logging in non-ISR context
 			csp_log_warn("ERROR: Routing input FIFO is FULL. Dropping packet.");
 		}
 		iface->drop++;
+		iface->ingress_drop++;
 		if (pxTaskWoken == NULL)
 			csp_buffer_free(packet);
 		else
@@ -162,7 +458,31 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, CSP_BASE_TYPE *
 
 }
 
+unsigned int csp_qfifo_ingress_depth(const csp_iface_t * iface) {
+
+	const csp_qfifo_ingress_t * ingress = iface->ingress;
+	if (ingress == NULL) {
+		return 0;
+	}
+
+	unsigned int depth = 0;
+	for (unsigned int shard = 0; shard < qfifo_shards; shard++) {
+		for (unsigned int fifo = 0; fifo < CSP_ROUTE_FIFOS; fifo++) {
+			depth += __atomic_load_n(&ingress->lane[shard][fifo].queued, __ATOMIC_RELAXED);
+		}
+	}
+
+	return depth;
+
+}
+
 void csp_qfifo_wake_up(void) {
-	const csp_qfifo_t queue_element = {.iface = NULL, .packet = NULL};
-	csp_queue_enqueue(qfifo[0], &queue_element, 0);
+	for (unsigned int shard = 0; shard < qfifo_shards; shard++) {
+		csp_qfifo_wake_up_shard(shard);
+	}
+}
+
+void csp_qfifo_wake_up_shard(unsigned int shard) {
+	const csp_qfifo_entry_t queue_element = {.input = {.iface = NULL, .packet = NULL}, .ingress = NULL};
+	csp_queue_enqueue(qfifo_shard[shard].queue, &queue_element, 0);
 }
@@ -23,12 +23,6 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <csp/csp_interface.h>
 
-#if (CSP_USE_RDP)
-#define FIFO_TIMEOUT 100			//! If RDP is enabled, the router needs to awake some times to check timeouts
-#else
-#define FIFO_TIMEOUT CSP_MAX_TIMEOUT		//! If no RDP, the router can sleep untill data arrives
-#endif
-
 /**
  * Init FIFO/QOS queues
  * @return CSP_ERR type
@@ -43,16 +37,57 @@ typedef struct {
 } csp_qfifo_t;
 
 /**
- * Read next packet from router input queue
+ * Create router ingress state for an interface (its share of the router queue and round robin turn).
+ * Called by csp_iflist_add(), interfaces added before csp_init() are handled by csp_qfifo_init().
+ * Interfaces without ingress state share one.
+ * @param iface interface
+ * @return CSP_ERR type
+ */
+int csp_qfifo_add_iface(csp_iface_t * iface);
+
+/**
+ * Number of router input queues (shards), see csp_conf_t.route_shards
+ * @return number of shards, 1 - #CSP_ROUTE_SHARDS_MAX
+ */
+unsigned int csp_qfifo_shards(void);
+
+/**
+ * Router shard of a connection tuple
+ * Packets with the same source, destination and ports go to the same shard.
+ * @param id CSP id (packet or connection)
+ * @return shard
+ */
+unsigned int csp_qfifo_shard(uint32_t id);
+
+/**
+ * Read next packet from router input queue (first shard)
  * @param input pointer to router queue item element
  * @return CSP_ERR type
  */
 int csp_qfifo_read(csp_qfifo_t * input);
 
+/**
+ * Read up to count packets from the router input queue of a shard, highest priority first
+ * Interfaces with packets at the same priority are served in turn (deficit round robin, csp_iface_t.weight).
+ * Waits for the first packet only, a wake-up (csp_qfifo_wake_up_shard()) returns 0.
+ * @param shard router shard
+ * @param input pointer to array of count router queue item elements
+ * @param count max number of elements to read
+ * @param timeout timeout in mS to wait for the first packet
+ * @return number of elements read, 0 on timeout
+ */
+int csp_qfifo_read_n(unsigned int shard, csp_qfifo_t * input, unsigned int count, uint32_t timeout);
+
 /**
  * Wake up any task (e.g. router) waiting on messages.
  * For testing.
  */
 void csp_qfifo_wake_up(void);
 
+/**
+ * Wake up the task (router) waiting on messages for a shard, e.g. when a timeout has been scheduled.
+ * @param shard router shard
+ */
+void csp_qfifo_wake_up_shard(unsigned int shard);
+
 #endif /* CSP_QFIFO_H_ */
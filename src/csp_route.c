@@ -21,11 +21,14 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/csp.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <csp/csp_crc32.h>
 #include <csp/csp_endian.h>
 #include <csp/arch/csp_thread.h>
 #include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_time.h>
 #include <csp/crypto/csp_hmac.h>
 #include <csp/crypto/csp_xtea.h>
 
@@ -34,7 +37,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "csp_conn.h"
 #include "csp_io.h"
 #include "csp_promisc.h"
+#include "csp_poll.h"
 #include "csp_qfifo.h"
+#include "csp_route.h"
 #include "csp_dedup.h"
 #include "transport/csp_transport.h"
 
@@ -154,95 +159,78 @@ static int csp_route_security_check(uint32_t security_opts, csp_iface_t * iface,
 
 }
 
-int csp_route_work(uint32_t timeout) {
-
-	csp_qfifo_t input;
-	csp_packet_t * packet;
-	csp_conn_t * conn;
-	csp_socket_t * socket;
+/* Connection deliveries deferred to the end of a batch */
+typedef struct {
+	unsigned int shard;
+	bool locked;	// holding csp_route_local_lock[shard], until csp_route_deliver()
+	unsigned int count;
+	csp_conn_t * conn[CSP_ROUTE_BATCH_MAX];
+	csp_packet_t * packet[CSP_ROUTE_BATCH_MAX];
+} csp_route_deliveries_t;
 
-#if (CSP_USE_RDP)
-	/* Check connection timeouts (currently only for RDP) */
-	csp_conn_check_timeouts();
-#endif
+static csp_route_stats_t csp_route_stats[CSP_ROUTE_SHARDS_MAX];
 
-	/* Get next packet to route */
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE) {
-		return CSP_ERR_TIMEDOUT;
-	}
+/* Serializes local delivery per shard (connection tuple) between the router task and loopback senders, see csp_route_loopback() */
+static csp_bin_sem_handle_t csp_route_local_lock[CSP_ROUTE_SHARDS_MAX];
+static unsigned int csp_route_local_locks;
 
-	packet = input.packet;
-	if (packet == NULL) {
-		return CSP_ERR_TIMEDOUT;
-	}
+/* Take the local delivery lock of the shard, held until csp_route_deliver() - returns false on failure */
+static bool csp_route_lock_local(csp_route_deliveries_t * deliveries) {
 
-	csp_log_packet("INP: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %"PRIu16" VIA: %s",
-			packet->id.src, packet->id.dst, packet->id.dport,
-			packet->id.sport, packet->id.pri, packet->id.flags, packet->length, input.iface->name);
-
-	/* Here there be promiscuous mode */
-#if (CSP_USE_PROMISC)
-	csp_promisc_add(packet);
-#endif
-
-#if (CSP_USE_DEDUP)
-	/* Check for duplicates */
-	if (csp_dedup_is_duplicate(packet)) {
-		/* Discard packet */
-		csp_log_packet("Duplicate packet discarded");
-		input.iface->drop++;
-		csp_buffer_free(packet);
-		return CSP_ERR_NONE;
+	if (!deliveries->locked) {
+		if (csp_bin_sem_wait(&csp_route_local_lock[deliveries->shard], CSP_MAX_TIMEOUT) != CSP_SEMAPHORE_OK) {
+			return false;
+		}
+		deliveries->locked = true;
 	}
-#endif
-
-	/* Now we count the message (since its deduplicated) */
-	input.iface->rx++;
-	input.iface->rxbytes += packet->length;
 
-	/* If the message is not to me, route the message to the correct interface */
-	if ((packet->id.dst != csp_conf.address) && (packet->id.dst != CSP_BROADCAST_ADDR)) {
+	return true;
 
-		/* Find the destination interface */
-		const csp_route_t * ifroute = csp_rtable_find_route(packet->id.dst);
+}
 
-		/* If the message resolves to the input interface, don't loop it back out */
-		if ((ifroute == NULL) || ((ifroute->iface == input.iface) && (input.iface->split_horizon_off == 0))) {
-			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
-		}
+/**
+ * Deliver a packet to this node, to a socket or connection.
+ * Packets to a connection (non-RDP) are added to deliveries, and must be passed on by csp_route_deliver().
+ * @param iface incoming interface
+ * @param packet packet
+ * @param deliveries deferred connection deliveries
+ */
+static void csp_route_input_local(csp_iface_t * iface, csp_packet_t * packet, csp_route_deliveries_t * deliveries) {
 
-		/* Otherwise, actually send the message */
-		if (csp_send_direct(packet->id, packet, ifroute, 0) != CSP_ERR_NONE) {
-			csp_log_warn("Router failed to send");
-			csp_buffer_free(packet);
-		}
+	csp_conn_t * conn;
+	csp_socket_t * socket;
 
-		/* Next message, please */
-		return CSP_ERR_NONE;
+	/* Discard packets with unsupported options */
+	if (csp_route_check_options(iface, packet) != CSP_ERR_NONE) {
+		csp_buffer_free(packet);
+		return;
 	}
 
-	/* Discard packets with unsupported options */
-	if (csp_route_check_options(input.iface, packet) != CSP_ERR_NONE) {
+	/* Local delivery modifies the packet (security check, user), so it can't be shared (e.g. with promisc) */
+	csp_packet_t * local = csp_buffer_unshare(packet);
+	if (local == NULL) {
+		iface->drop++;
 		csp_buffer_free(packet);
-		return CSP_ERR_NONE;
+		return;
 	}
+	packet = local;
 
 	/* The message is to me, search for incoming socket */
 	socket = csp_port_get_socket(packet->id.dport);
 
 	/* If the socket is connection-less, deliver now */
 	if (socket && (socket->opts & CSP_SO_CONN_LESS)) {
-		if (csp_route_security_check(socket->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(socket->opts, iface, packet) < 0) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 		if (csp_queue_enqueue(socket->socket, &packet, 0) != CSP_QUEUE_OK) {
 			csp_log_error("Conn-less socket queue full");
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
-		return CSP_ERR_NONE;
+		csp_poll_notify();
+		return;
 	}
 
 	/* Search for an existing connection */
@@ -254,13 +242,13 @@ int csp_route_work(uint32_t timeout) {
 		/* Reject packet if no matching socket is found */
 		if (!socket) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(socket->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(socket->opts, iface, packet) < 0) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* New incoming connection accepted */
@@ -279,7 +267,7 @@ int csp_route_work(uint32_t timeout) {
 		if (!conn) {
 			csp_log_error("No more connections available");
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* Store the socket queue and options */
@@ -290,9 +278,9 @@ int csp_route_work(uint32_t timeout) {
 	} else {
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(conn->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(conn->opts, iface, packet) < 0) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 	}
@@ -304,20 +292,276 @@ int csp_route_work(uint32_t timeout) {
 		if (close_connection) {
 			csp_close(conn);
 		}
-		return CSP_ERR_NONE;
+		return;
 	}
 #endif
 
-	/* Pass packet to UDP module */
-	csp_udp_new_packet(conn, packet);
+	/* Pass packet to UDP module - at the end of the batch, together with other packets to the connection */
+	deliveries->conn[deliveries->count] = conn;
+	deliveries->packet[deliveries->count] = packet;
+	deliveries->count++;
+
+}
+
+/**
+ * Route a single packet from the router input queue.
+ * Packets to a connection (non-RDP) are added to deliveries, and must be passed on by csp_route_deliver().
+ * @param shard router shard
+ * @param iface incoming interface
+ * @param packet packet
+ * @param deliveries deferred connection deliveries
+ */
+static void csp_route_input(unsigned int shard, csp_iface_t * iface, csp_packet_t * packet, csp_route_deliveries_t * deliveries) {
+
+	csp_log_packet("INP: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %"PRIu16" VIA: %s",
+			packet->id.src, packet->id.dst, packet->id.dport,
+			packet->id.sport, packet->id.pri, packet->id.flags, packet->length, iface->name);
+
+	/* Discard packets past their deadline, before spending any more time on them */
+	if (csp_buffer_deadline(packet) && csp_buffer_expired(packet, csp_get_ms())) {
+		csp_log_packet("Expired packet discarded");
+		iface->drop++;
+		iface->expired++;
+		csp_buffer_free(packet);
+		return;
+	}
+
+	/* Here there be promiscuous mode */
+#if (CSP_USE_PROMISC)
+	csp_promisc_add(packet);
+#endif
+
+#if (CSP_USE_DEDUP)
+	/* Check for duplicates */
+	if (csp_dedup_is_duplicate(packet, shard)) {
+		/* Discard packet */
+		csp_log_packet("Duplicate packet discarded");
+		iface->drop++;
+		csp_buffer_free(packet);
+		return;
+	}
+#endif
+
+	/* Now we count the message (since its deduplicated) */
+	iface->rx++;
+	iface->rxbytes += packet->length;
+
+	/* If the message is not to me, route the message to the correct interface */
+	if ((packet->id.dst != csp_conf.address) && (packet->id.dst != CSP_BROADCAST_ADDR)) {
+
+		/* Find the destination interface */
+		const csp_route_t * ifroute = csp_rtable_find_route(packet->id.dst);
+
+		/* If the message resolves to the input interface, don't loop it back out */
+		if ((ifroute == NULL) || ((ifroute->iface == iface) && (iface->split_horizon_off == 0))) {
+			csp_buffer_free(packet);
+			return;
+		}
+
+		/* Otherwise, actually send the message */
+		if (csp_send_direct(packet->id, packet, ifroute, 0) != CSP_ERR_NONE) {
+			csp_log_warn("Router failed to send");
+			csp_buffer_free(packet);
+		}
+
+		/* Next message, please */
+		return;
+	}
+
+	/* Senders on the loopback interface may deliver to the same connections, see csp_route_loopback() */
+	if (!csp_route_lock_local(deliveries)) {
+		iface->drop++;
+		csp_buffer_free(packet);
+		return;
+	}
+
+	csp_route_input_local(iface, packet, deliveries);
+
+}
+
+/**
+ * Pass deferred deliveries to the UDP module, enqueueing packets to the same connection (and priority) in one go.
+ * Releases the local delivery lock, if taken.
+ * @param deliveries deferred connection deliveries
+ */
+static void csp_route_deliver(csp_route_deliveries_t * deliveries) {
+
+	csp_packet_t * packets[CSP_ROUTE_BATCH_MAX];
+
+	for (unsigned int i = 0; i < deliveries->count; i++) {
+		csp_conn_t * conn = deliveries->conn[i];
+		if (conn == NULL) {
+			continue;
+		}
+
+		/* Collect packets to the connection in arrival order */
+		const int rxq = csp_conn_get_rxq(deliveries->packet[i]->id.pri);
+		unsigned int count = 0;
+		for (unsigned int j = i; j < deliveries->count; j++) {
+			if ((deliveries->conn[j] == conn) && (csp_conn_get_rxq(deliveries->packet[j]->id.pri) == rxq)) {
+				packets[count++] = deliveries->packet[j];
+				deliveries->conn[j] = NULL;
+			}
+		}
+
+		/* Connection may have been closed by an earlier packet in the batch */
+		if (conn->state != CONN_OPEN) {
+			csp_buffer_free_n((void **) packets, count);
+			continue;
+		}
+
+		csp_udp_new_packets(conn, packets, count);
+	}
+
+	deliveries->count = 0;
+
+	if (deliveries->locked) {
+		csp_bin_sem_post(&csp_route_local_lock[deliveries->shard]);
+		deliveries->locked = false;
+	}
+
+}
+
+void csp_route_loopback(csp_iface_t * iface, csp_packet_t * packet) {
+
+	csp_route_deliveries_t deliveries;
+
+	csp_log_packet("INP: S %u, D %u, Dp %u, Sp %u, Pr %u, Fl 0x%02X, Sz %"PRIu16" VIA: %s",
+			packet->id.src, packet->id.dst, packet->id.dport,
+			packet->id.sport, packet->id.pri, packet->id.flags, packet->length, iface->name);
+
+	/* Discard packets past their deadline */
+	if (csp_buffer_deadline(packet) && csp_buffer_expired(packet, csp_get_ms())) {
+		csp_log_packet("Expired packet discarded");
+		iface->drop++;
+		iface->expired++;
+		csp_buffer_free(packet);
+		return;
+	}
+
+#if (CSP_USE_PROMISC)
+	csp_promisc_add(packet);
+#endif
+
+	/* No dedup - the history is owned by the router shard, and loopback doesn't duplicate packets */
+	iface->rx++;
+	iface->rxbytes += packet->length;
+
+	/* Other senders, and the router task of the shard, may race on creating and accepting the connection */
+	deliveries.shard = csp_qfifo_shard(packet->id.ext);
+	deliveries.locked = false;
+	deliveries.count = 0;
+	if (!csp_route_lock_local(&deliveries)) {
+		iface->drop++;
+		csp_buffer_free(packet);
+		return;
+	}
+
+	csp_route_input_local(iface, packet, &deliveries);
+	csp_route_deliver(&deliveries);
+
+}
+
+int csp_route_init(void) {
+
+	for (; csp_route_local_locks < CSP_ROUTE_SHARDS_MAX; csp_route_local_locks++) {
+		if (csp_bin_sem_create(&csp_route_local_lock[csp_route_local_locks]) != CSP_SEMAPHORE_OK) {
+			csp_log_error("csp_bin_sem_create(&csp_route_local_lock) failed");
+			return CSP_ERR_NOMEM;
+		}
+	}
+
 	return CSP_ERR_NONE;
+
+}
+
+void csp_route_free_resources(void) {
+
+	for (unsigned int shard = 0; shard < csp_route_local_locks; shard++) {
+		csp_bin_sem_remove(&csp_route_local_lock[shard]);
+	}
+	memset(csp_route_local_lock, 0, sizeof(csp_route_local_lock));
+	csp_route_local_locks = 0;
+
+}
+
+int csp_route_work(uint32_t timeout) {
+
+	return csp_route_work_shard(0, timeout);
+
+}
+
+int csp_route_work_shard(unsigned int shard, uint32_t timeout) {
+
+	csp_qfifo_t input[CSP_ROUTE_BATCH_MAX];
+	csp_route_deliveries_t deliveries;
+
+	if (shard >= csp_qfifo_shards()) {
+		return CSP_ERR_INVAL;
+	}
+
+	/* Expire connection timeouts (currently only for RDP), and wait no longer than the next one */
+#if (CSP_USE_RDP)
+	const uint32_t next_timeout = csp_conn_check_timeouts(shard);
+	if (next_timeout < timeout) {
+		timeout = next_timeout;
+	}
+#endif
+
+	/* Get next packets to route, highest priority first */
+	unsigned int batch = csp_conf.route_batch;
+	if (batch == 0) {
+		batch = 1;
+	} else if (batch > CSP_ROUTE_BATCH_MAX) {
+		batch = CSP_ROUTE_BATCH_MAX;
+	}
+	const int count = csp_qfifo_read_n(shard, input, batch, timeout);
+	if (count <= 0) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	deliveries.shard = shard;
+	deliveries.locked = false;
+	deliveries.count = 0;
+
+	for (int i = 0; i < count; i++) {
+		csp_route_input(shard, input[i].iface, input[i].packet, &deliveries);
+	}
+
+	csp_route_deliver(&deliveries);
+
+	/* Stats are only updated by the shard's own task */
+	csp_route_stats_t * stats = &csp_route_stats[shard];
+	stats->wakeups++;
+	stats->packets += count;
+	if ((uint32_t) count > stats->max_batch) {
+		stats->max_batch = count;
+	}
+
+	return CSP_ERR_NONE;
+
+}
+
+void csp_route_get_stats(csp_route_stats_t * stats) {
+
+	memset(stats, 0, sizeof(*stats));
+	for (unsigned int shard = 0; shard < CSP_ROUTE_SHARDS_MAX; shard++) {
+		stats->wakeups += csp_route_stats[shard].wakeups;
+		stats->packets += csp_route_stats[shard].packets;
+		if (csp_route_stats[shard].max_batch > stats->max_batch) {
+			stats->max_batch = csp_route_stats[shard].max_batch;
+		}
+	}
+
 }
 
 static CSP_DEFINE_TASK(csp_task_router) {
 
+	const unsigned int shard = (uintptr_t) param;
+
 	/* Here there be routing */
 	while (1) {
-		csp_route_work(FIFO_TIMEOUT);
+		csp_route_work_shard(shard, CSP_MAX_TIMEOUT);
 	}
 
 	return CSP_TASK_RETURN;
@@ -326,10 +570,13 @@ static CSP_DEFINE_TASK(csp_task_router) {
 
 int csp_route_start_task(unsigned int task_stack_size, unsigned int task_priority) {
 
-	int ret = csp_thread_create(csp_task_router, "RTE", task_stack_size, NULL, task_priority, NULL);
-	if (ret != 0) {
-		csp_log_error("Failed to start router task, error: %d", ret);
-		return ret;
+	/* A router task per shard */
+	for (unsigned int shard = 0; shard < csp_qfifo_shards(); shard++) {
+		int ret = csp_thread_create(csp_task_router, "RTE", task_stack_size, (void *) (uintptr_t) shard, task_priority, NULL);
+		if (ret != 0) {
+			csp_log_error("Failed to start router task, error: %d", ret);
+			return ret;
+		}
 	}
 
 	return CSP_ERR_NONE;
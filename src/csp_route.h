@@ -0,0 +1,55 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CSP_ROUTE_H_
+#define CSP_ROUTE_H_
+
+#include <csp/csp_interface.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialize router
+ * @return #CSP_ERR_NONE on success, otherwise an error code.
+ */
+int csp_route_init(void);
+
+/**
+ * Free router resources
+ */
+void csp_route_free_resources(void);
+
+/**
+ * Deliver a packet to this node directly in the calling task, bypassing the router queues and task.
+ * Used by the loopback interface, see #csp_iface_s.cut_through - packets are checked (deadline, options, security)
+ * and delivered to the socket or connection as by the router, but not deduplicated.
+ * RDP packets must go through the router, as the connection state and timers are owned by the router shard.
+ * Delivery is serialized with the router task of the shard (and other senders), so a connection is only created once.
+ * @param iface incoming interface
+ * @param packet packet to this node, is always consumed
+ */
+void csp_route_loopback(csp_iface_t * iface, csp_packet_t * packet);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CSP_ROUTE_H_ */
@@ -213,8 +213,33 @@ static int csp_cmp_handler(csp_conn_t * conn, csp_packet_t * packet) {
 	return ret;
 }
 
+/* Replies are built in the request packet, ensure it can hold the largest reply (the request may be in a small buffer size class) */
+static csp_packet_t * csp_service_reply_buffer(csp_packet_t * packet) {
+
+	size_t size = sizeof(struct csp_cmp_message);
+	if (size > csp_buffer_data_size()) {
+		size = csp_buffer_data_size();
+	}
+	if (csp_buffer_packet_data_size(packet) >= size) {
+		return packet;
+	}
+
+	csp_packet_t * reply = csp_buffer_get(size);
+	if (reply) {
+		memcpy(reply, packet, CSP_BUFFER_PACKET_OVERHEAD + packet->length);
+	}
+	csp_buffer_free(packet);
+	return reply;
+
+}
+
 void csp_service_handler(csp_conn_t * conn, csp_packet_t * packet) {
 
+	packet = csp_service_reply_buffer(packet);
+	if (packet == NULL) {
+		return;
+	}
+
 	switch (csp_conn_dport(conn)) {
 
 	case CSP_CMP:
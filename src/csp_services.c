@@ -153,7 +153,7 @@ void csp_ps(uint8_t node, uint32_t timeout) {
 		}
 
 		/* We have a reply, ensure data is 0 (zero) termianted */
-		const unsigned int length = (packet->length < csp_buffer_data_size()) ? packet->length : (csp_buffer_data_size() - 1);
+		const unsigned int length = (packet->length < csp_buffer_packet_data_size(packet)) ? packet->length : (csp_buffer_packet_data_size(packet) - 1);
 		packet->data[length] = 0;
 		printf("%s", packet->data);
 
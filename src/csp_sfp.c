@@ -32,6 +32,8 @@ typedef struct __attribute__((__packed__)) {
 	uint32_t totalsize;
 } sfp_header_t;
 
+CSP_STATIC_ASSERT(sizeof(sfp_header_t) == CSP_SFP_HEADER_LENGTH, sfp_header_length);
+
 /**
  * SFP Headers:
  * The following functions are helper functions that handles the extra SFP
@@ -39,9 +41,7 @@ typedef struct __attribute__((__packed__)) {
  */
 static inline sfp_header_t * csp_sfp_header_add(csp_packet_t * packet) {
 
-	sfp_header_t * header = (sfp_header_t *) &packet->data[packet->length];
-	packet->length += sizeof(*header);
-	return header;
+	return csp_buffer_put(packet, sizeof(sfp_header_t));
 }
 
 static inline sfp_header_t * csp_sfp_header_remove(csp_packet_t * packet) {
@@ -49,12 +49,10 @@ static inline sfp_header_t * csp_sfp_header_remove(csp_packet_t * packet) {
 	if ((packet->id.flags & CSP_FFRAG) == 0) {
 		return NULL;
 	}
-	sfp_header_t * header;
-	if (packet->length < sizeof(*header)) {
+	sfp_header_t * header = csp_buffer_trim(packet, sizeof(*header));
+	if (header == NULL) {
 		return NULL;
 	}
-        header = (sfp_header_t *) &packet->data[packet->length - sizeof(*header)];
-	packet->length -= sizeof(*header);
 
 	header->offset = csp_ntoh32(header->offset);
 	header->totalsize = csp_ntoh32(header->totalsize);
@@ -76,8 +74,8 @@ int csp_sfp_send_own_memcpy(csp_conn_t * conn, const void * data, unsigned int t
 
 		sfp_header_t * sfp_header;
 
-		/* Allocate packet */
-		csp_packet_t * packet = csp_buffer_get(mtu + sizeof(*sfp_header));
+		/* Allocate packet, waiting for buffers (backpressure) */
+		csp_packet_t * packet = csp_buffer_get_prio(mtu + sizeof(*sfp_header), conn->idout.pri, timeout);
 		if (packet == NULL) {
 			return CSP_ERR_NOMEM;
 		}
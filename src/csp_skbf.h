@@ -0,0 +1,81 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef CSP_SKBF_H_
+#define CSP_SKBF_H_
+
+/**
+ * Packet metadata used internally by the stack.
+ * It is kept in the buffer header (not in the packet), so it is safe to set on packets shared by reference (see
+ * csp_buffer_ref()) - all references see the same value.
+ */
+
+#include <csp/csp_types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Set the time a packet was queued, for active queue management (CoDel).
+ * @param packet packet
+ * @param now current time (mS)
+ */
+void csp_skbf_set_queued(void * packet, uint32_t now);
+
+/**
+ * Time a packet was queued, see csp_skbf_set_queued().
+ * @param packet packet
+ * @return time (mS)
+ */
+uint32_t csp_skbf_queued(const void * packet);
+
+/**
+ * Set the time a packet was (last) sent, for RDP retransmission.
+ * @param packet packet
+ * @param now current time (mS)
+ */
+void csp_skbf_set_sent(void * packet, uint32_t now);
+
+/**
+ * Time a packet was sent, see csp_skbf_set_sent().
+ * @param packet packet
+ * @return time (mS)
+ */
+uint32_t csp_skbf_sent(const void * packet);
+
+/**
+ * Set the end of the RDP EACK quarantine period, during which an EACK does not trigger another retransmission.
+ * @param packet packet
+ * @param until end of quarantine (mS)
+ */
+void csp_skbf_set_quarantine(void * packet, uint32_t until);
+
+/**
+ * End of the RDP EACK quarantine period, see csp_skbf_set_quarantine().
+ * @param packet packet
+ * @return time (mS)
+ */
+uint32_t csp_skbf_quarantine(const void * packet);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CSP_SKBF_H_ */
@@ -85,14 +85,31 @@ int csp_can_rx(csp_iface_t *iface, uint32_t id, const uint8_t *data, uint8_t dlc
 			break;
 		}
 
+		/* Read CSP length (of data) */
+		uint16_t length;
+		memcpy(&length, data + sizeof(csp_id_t), sizeof(length));
+		length = csp_ntoh16(length);
+
+		/* Check length against max */
+		if ((length > MAX_CAN_DATA_SIZE) || (length > csp_buffer_data_size())) {
+			iface->rx_error++;
+			csp_can_pbuf_free(buf, task_woken);
+			break;
+		}
+
 		/* Check for incomplete frame */
 		if (buf->packet != NULL) {
-			/* Reuse the buffer */
+			/* Reuse the buffer, if big enough */
 			//csp_log_warn("Incomplete frame");
 			iface->frame++;
-		} else {
+			if (csp_buffer_packet_data_size(buf->packet) < length) {
+				task_woken ? csp_buffer_free_isr(buf->packet) : csp_buffer_free(buf->packet);
+				buf->packet = NULL;
+			}
+		}
+		if (buf->packet == NULL) {
 			/* Get free buffer for frame */
-			buf->packet = task_woken ? csp_buffer_get_isr(0) : csp_buffer_get(0); // CSP only supports one size
+			buf->packet = task_woken ? csp_buffer_get_isr(length) : csp_buffer_get(length);
 			if (buf->packet == NULL) {
 				//csp_log_error("Failed to get buffer for CSP_BEGIN packet");
 				iface->frame++;
@@ -105,16 +122,8 @@ int csp_can_rx(csp_iface_t *iface, uint32_t id, const uint8_t *data, uint8_t dlc
 		memcpy(&(buf->packet->id), data, sizeof(buf->packet->id));
 		buf->packet->id.ext = csp_ntoh32(buf->packet->id.ext);
 
-		/* Copy CSP length (of data) */
-		memcpy(&(buf->packet->length), data + sizeof(csp_id_t), sizeof(buf->packet->length));
-		buf->packet->length = csp_ntoh16(buf->packet->length);
-
-		/* Check length against max */
-		if ((buf->packet->length > MAX_CAN_DATA_SIZE) || (buf->packet->length > csp_buffer_data_size())) {
-			iface->rx_error++;
-			csp_can_pbuf_free(buf, task_woken);
-			break;
-		}
+		/* Set CSP length (of data) */
+		buf->packet->length = length;
 
 		/* Reset RX count */
 		buf->rx_count = 0;
@@ -184,8 +193,11 @@ int csp_can_tx(const csp_route_t * ifroute, csp_packet_t *packet)
 	/* Get an unique CFP id - this should be locked to prevent access from multiple tasks */
 	const uint32_t ident = ifdata->cfp_frame_id++;
 
+	/* Total length, the packet may be chained */
+	const uint16_t length = csp_buffer_chain_length(packet);
+
 	/* Check protocol's max length - limit is 1 (first) frame + as many frames that can be specified in 'remain' */
-        if (packet->length > MAX_CAN_DATA_SIZE) {
+        if (length > MAX_CAN_DATA_SIZE) {
 		return CSP_ERR_TX;
         }
 
@@ -197,20 +209,20 @@ int csp_can_tx(const csp_route_t * ifroute, csp_packet_t *packet)
                        CFP_MAKE_DST(dest) |
                        CFP_MAKE_ID(ident) |
                        CFP_MAKE_TYPE(CFP_BEGIN) |
-                       CFP_MAKE_REMAIN((packet->length + CFP_OVERHEAD - 1) / MAX_BYTES_IN_CAN_FRAME));
+                       CFP_MAKE_REMAIN((length + CFP_OVERHEAD - 1) / MAX_BYTES_IN_CAN_FRAME));
 
 	/* Calculate first frame data bytes */
 	const uint8_t avail = MAX_BYTES_IN_CAN_FRAME - CFP_OVERHEAD;
-	uint8_t bytes = (packet->length <= avail) ? packet->length : avail;
+	uint8_t bytes = (length <= avail) ? length : avail;
 
 	/* Copy CSP headers and data */
 	const uint32_t csp_id_be = csp_hton32(packet->id.ext);
-	const uint16_t csp_length_be = csp_hton16(packet->length);
+	const uint16_t csp_length_be = csp_hton16(length);
 
 	uint8_t frame_buf[MAX_BYTES_IN_CAN_FRAME];
 	memcpy(frame_buf, &csp_id_be, sizeof(csp_id_be));
 	memcpy(frame_buf + sizeof(csp_id_be), &csp_length_be, sizeof(csp_length_be));
-	memcpy(frame_buf + CFP_OVERHEAD, packet->data, bytes);
+	csp_buffer_chain_copy(packet, 0, frame_buf + CFP_OVERHEAD, bytes);
 
 	/* Increment tx counter */
 	uint16_t tx_count = bytes;
@@ -225,22 +237,25 @@ int csp_can_tx(const csp_route_t * ifroute, csp_packet_t *packet)
 	}
 
 	/* Send next frames if not complete */
-	while (tx_count < packet->length) {
+	while (tx_count < length) {
 		/* Calculate frame data bytes */
-		bytes = (packet->length - tx_count >= MAX_BYTES_IN_CAN_FRAME) ? MAX_BYTES_IN_CAN_FRAME : packet->length - tx_count;
+		bytes = (length - tx_count >= MAX_BYTES_IN_CAN_FRAME) ? MAX_BYTES_IN_CAN_FRAME : length - tx_count;
 
 		/* Prepare identifier */
 		id = (CFP_MAKE_SRC(packet->id.src) |
                       CFP_MAKE_DST(dest) |
                       CFP_MAKE_ID(ident) |
                       CFP_MAKE_TYPE(CFP_MORE) |
-                      CFP_MAKE_REMAIN((packet->length - tx_count - bytes + MAX_BYTES_IN_CAN_FRAME - 1) / MAX_BYTES_IN_CAN_FRAME));
+                      CFP_MAKE_REMAIN((length - tx_count - bytes + MAX_BYTES_IN_CAN_FRAME - 1) / MAX_BYTES_IN_CAN_FRAME));
+
+		/* Gather frame data, which may span segments of a chained packet */
+		csp_buffer_chain_copy(packet, tx_count, frame_buf, bytes);
 
 		/* Increment tx counter */
 		tx_count += bytes;
 
 		/* Send frame */
-		if ((tx_func)(iface->driver_data, id, packet->data + tx_count - bytes, bytes) != CSP_ERR_NONE) {
+		if ((tx_func)(iface->driver_data, id, frame_buf, bytes) != CSP_ERR_NONE) {
 			//csp_log_warn("Failed to send CAN frame in Tx callback");
 			iface->tx_error++;
 			return CSP_ERR_DRIVER;
@@ -270,6 +285,7 @@ int csp_can_add_interface(csp_iface_t * iface) {
         ifdata->cfp_frame_id = 0;
 
 	iface->nexthop = csp_can_tx;
+	iface->chain_tx = 1;
 
 	return csp_iflist_add(iface);
 }
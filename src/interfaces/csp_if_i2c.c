@@ -75,7 +75,7 @@ void csp_i2c_rx(csp_iface_t * iface, csp_i2c_frame_t * frame, void * pxTaskWoken
 	/* Strip the CSP header off the length field before converting to CSP packet */
 	frame->len -= sizeof(csp_id_t);
 
-	if (frame->len > csp_buffer_data_size()) { // consistency check, should never happen
+	if (frame->len > csp_buffer_packet_data_size(frame)) { // consistency check, should never happen
 		iface->rx_error++;
 		(pxTaskWoken != NULL) ? csp_buffer_free_isr(frame) : csp_buffer_free(frame);
 		return;
@@ -107,6 +107,7 @@ int csp_i2c_add_interface(csp_iface_t * iface) {
 	}
 
         iface->nexthop = csp_i2c_tx;
+        iface->tx_inplace = 1; // frame is written on top of the packet
 
 	return csp_iflist_add(iface);
 }
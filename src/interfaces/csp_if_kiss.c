@@ -31,40 +31,49 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define TFESC 		0xDD
 #define TNC_DATA	0x00
 
+static void csp_kiss_tx_escaped(csp_kiss_interface_data_t * ifdata, void * driver, const uint8_t * data, size_t length) {
+
+        const unsigned char esc_end[] = {FESC, TFEND};
+        const unsigned char esc_esc[] = {FESC, TFESC};
+	for (; length; --length, ++data) {
+		if (*data == FEND) {
+                    ifdata->tx_func(driver, esc_end, sizeof(esc_end));
+                    continue;
+		}
+                if (*data == FESC) {
+                    ifdata->tx_func(driver, esc_esc, sizeof(esc_esc));
+                    continue;
+		}
+		ifdata->tx_func(driver, data, 1);
+	}
+}
+
 int csp_kiss_tx(const csp_route_t * ifroute, csp_packet_t * packet) {
 
 	csp_kiss_interface_data_t * ifdata = ifroute->iface->interface_data;
 	void * driver = ifroute->iface->driver_data;
 
-	/* Add CRC32 checksum - the MTU setting ensures there are space */
-	csp_crc32_append(packet, false);
+	/* Calculate CRC32 checksum (data only), the packet may be chained */
+	uint32_t crc = 0;
+	for (const csp_packet_t * segment = packet; segment; segment = csp_buffer_chain_next(segment)) {
+		crc = csp_crc32_memory_update(crc, segment->data, segment->length);
+	}
+	crc = csp_hton32(crc);
 
 	/* Lock */
 	if (csp_mutex_lock(&ifdata->lock, 1000) != CSP_MUTEX_OK) {
             return CSP_ERR_TIMEDOUT;
         }
 
-	/* Save the outgoing id in the buffer */
-	packet->id.ext = csp_hton32(packet->id.ext);
-	packet->length += sizeof(packet->id.ext);
-
-	/* Transmit data */
+	/* Transmit id, data and CRC32 */
+	const uint32_t id = csp_hton32(packet->id.ext);
         const unsigned char start[] = {FEND, TNC_DATA};
-        const unsigned char esc_end[] = {FESC, TFEND};
-        const unsigned char esc_esc[] = {FESC, TFESC};
-        const unsigned char * data = (unsigned char *) &packet->id.ext;
         ifdata->tx_func(driver, start, sizeof(start));
-	for (unsigned int i = 0; i < packet->length; i++, ++data) {
-		if (*data == FEND) {
-                    ifdata->tx_func(driver, esc_end, sizeof(esc_end));
-                    continue;
-		}
-                if (*data == FESC) {
-                    ifdata->tx_func(driver, esc_esc, sizeof(esc_esc));
-                    continue;
-		}
-		ifdata->tx_func(driver, data, 1);
+	csp_kiss_tx_escaped(ifdata, driver, (const uint8_t *) &id, sizeof(id));
+	for (const csp_packet_t * segment = packet; segment; segment = csp_buffer_chain_next(segment)) {
+		csp_kiss_tx_escaped(ifdata, driver, segment->data, segment->length);
 	}
+	csp_kiss_tx_escaped(ifdata, driver, (const uint8_t *) &crc, sizeof(crc));
         const unsigned char stop[] = {FEND};
         ifdata->tx_func(driver, stop, sizeof(stop));
 
@@ -108,7 +117,7 @@ void csp_kiss_rx(csp_iface_t * iface, const uint8_t * buf, size_t len, void * px
 
 			/* Try to allocate new buffer */
 			if (ifdata->rx_packet == NULL) {
-				ifdata->rx_packet = pxTaskWoken ? csp_buffer_get_isr(0) : csp_buffer_get(0); // CSP only supports one size
+				ifdata->rx_packet = pxTaskWoken ? csp_buffer_get_isr(csp_buffer_data_size()) : csp_buffer_get(csp_buffer_data_size()); // length is unknown until end of frame
 			}
 
 			/* If no more memory, skip frame */
@@ -240,6 +249,7 @@ int csp_kiss_add_interface(csp_iface_t * iface) {
         }
 
 	iface->nexthop = csp_kiss_tx;
+	iface->chain_tx = 1;
 
 	return csp_iflist_add(iface);
 }
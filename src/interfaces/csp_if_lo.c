@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/interfaces/csp_if_lo.h>
 
 #include "../csp_init.h"
+#include "../csp_route.h"
 
 /**
  * Loopback interface transmit function
@@ -39,6 +40,12 @@ static int csp_lo_tx(const csp_route_t * ifroute, csp_packet_t * packet) {
 		return CSP_ERR_NONE;
 	}
 
+	/* Deliver directly in the sender's context - except RDP, which is handled by the router shard of the connection */
+	if (csp_if_lo.cut_through && !(packet->id.flags & CSP_FRDP)) {
+		csp_route_loopback(&csp_if_lo, packet);
+		return CSP_ERR_NONE;
+	}
+
 	/* Send back into CSP, notice calling from task so last argument must be NULL! */
 	csp_qfifo_write(packet, &csp_if_lo, NULL);
 
@@ -55,12 +55,33 @@ int csp_zmqhub_tx(const csp_route_t * route, csp_packet_t * packet) {
 
 	const uint8_t dest = (route->via != CSP_NO_VIA_ADDRESS) ? route->via : packet->id.dst;
 
-	uint16_t length = packet->length;
-	uint8_t * destptr = ((uint8_t *) &packet->id) - sizeof(dest);
-	memcpy(destptr, &dest, sizeof(dest));
-	csp_bin_sem_wait(&drv->tx_wait, 1000); /* Using ZMQ in thread safe manner*/
-	int result = zmq_send(drv->publisher, destptr, length + sizeof(packet->id) + sizeof(dest), 0);
-	csp_bin_sem_post(&drv->tx_wait); /* Release tx semaphore */
+	int result;
+	const uint16_t length = packet->length;
+	uint8_t * destptr = (csp_buffer_chain_next(packet) == NULL) ? csp_buffer_push(packet, sizeof(dest)) : NULL;
+	if (destptr) {
+		/* Destination pushed in front of the id, send it all as one frame */
+		memcpy(destptr, &dest, sizeof(dest));
+		csp_bin_sem_wait(&drv->tx_wait, 1000); /* Using ZMQ in thread safe manner*/
+		result = zmq_send(drv->publisher, destptr, length + sizeof(packet->id) + sizeof(dest), 0);
+		csp_bin_sem_post(&drv->tx_wait); /* Release tx semaphore */
+	} else {
+		/* Chained or shared packet (e.g. queued for RDP retransmission), gather segments directly into the ZMQ message */
+		const size_t chain_length = csp_buffer_chain_length(packet);
+		zmq_msg_t msg;
+		result = zmq_msg_init_size(&msg, sizeof(dest) + sizeof(packet->id) + chain_length);
+		if (result == 0) {
+			uint8_t * msgptr = zmq_msg_data(&msg);
+			memcpy(msgptr, &dest, sizeof(dest));
+			memcpy(msgptr + sizeof(dest), &packet->id, sizeof(packet->id));
+			csp_buffer_chain_copy(packet, 0, msgptr + sizeof(dest) + sizeof(packet->id), chain_length);
+			csp_bin_sem_wait(&drv->tx_wait, 1000); /* Using ZMQ in thread safe manner*/
+			result = zmq_msg_send(&msg, drv->publisher, 0);
+			csp_bin_sem_post(&drv->tx_wait); /* Release tx semaphore */
+			if (result < 0) {
+				zmq_msg_close(&msg);
+			}
+		}
+	}
 	if (result < 0) {
 		csp_log_error("ZMQ send error: %u %s\r\n", result, zmq_strerror(zmq_errno()));
 	}
@@ -188,6 +209,7 @@ int csp_zmqhub_init_w_name_endpoints_rxfilter(const char * ifname,
 	drv->iface.name = drv->name;
 	drv->iface.driver_data = drv;
 	drv->iface.nexthop = csp_zmqhub_tx;
+	drv->iface.chain_tx = 1;
 	drv->iface.mtu = CSP_ZMQ_MTU; // there is actually no 'max' MTU on ZMQ, but assuming the other end is based on the same code
 
 	drv->context = zmq_ctx_new();
@@ -42,6 +42,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "../csp_conn.h"
 #include "../csp_io.h"
 #include "../csp_init.h"
+#include "../csp_poll.h"
+#include "../csp_skbf.h"
 
 #define RDP_SYN	0x01
 #define RDP_ACK 0x02
@@ -60,21 +62,6 @@ static uint32_t csp_rdp_ack_delay_count = 4 / 2;
 /* Used for queue calls */
 static CSP_BASE_TYPE pdTrue = 1;
 
-/* RDP header - on top of csp_packet_t */
-typedef struct {
-	uint32_t quarantine;	// EACK quarantine period (-> csp_packet_t.padding)
-	uint32_t timestamp;	// Time the message was sent (-> csp_packet_t.padding)
-	uint8_t padding[CSP_PADDING_BYTES - (2 * sizeof(uint32_t))];
-	uint16_t length;	// Overlay length member in csp_packet_t
-	csp_id_t id;		// Overlay id member in csp_packet_t
-	uint8_t data[];		// Overlay data member in csp_packet_t
-} rdp_packet_t;
-
-// Ensure certain fields in the rdp_packet_t matches the fields in the csp_packet_t
-CSP_STATIC_ASSERT(offsetof(rdp_packet_t, length) == offsetof(csp_packet_t, length), length_field_misaligned);
-CSP_STATIC_ASSERT(offsetof(rdp_packet_t, id) == offsetof(csp_packet_t, id), id_field_misaligned);
-CSP_STATIC_ASSERT(offsetof(rdp_packet_t, data) == offsetof(csp_packet_t, data), data_field_misaligned);
-
 typedef struct __attribute__((__packed__)) {
 	union __attribute__((__packed__)) {
 		uint8_t flags;
@@ -98,6 +85,8 @@ typedef struct __attribute__((__packed__)) {
 	uint16_t ack_nr;
 } rdp_header_t;
 
+CSP_STATIC_ASSERT(sizeof(rdp_header_t) == CSP_RDP_HEADER_LENGTH, rdp_header_length);
+
 static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool send_rst);
 
 /**
@@ -106,20 +95,16 @@ static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool sen
  * information that needs to be appended to all data packets.
  */
 static rdp_header_t * csp_rdp_header_add(csp_packet_t * packet) {
-	rdp_header_t * header;
-	if ((packet->length + sizeof(*header)) > csp_buffer_data_size()) {
+	rdp_header_t * header = csp_buffer_put(packet, sizeof(*header));
+	if (header == NULL) {
 		return NULL;
 	}
-	header = (rdp_header_t *) &packet->data[packet->length];
-	packet->length += sizeof(*header);
 	memset(header, 0, sizeof(*header));
 	return header;
 }
 
 static rdp_header_t * csp_rdp_header_remove(csp_packet_t * packet) {
-	rdp_header_t * header = (rdp_header_t *) &packet->data[packet->length - sizeof(*header)];
-	packet->length -= sizeof(*header);
-	return header;
+	return csp_buffer_trim(packet, sizeof(rdp_header_t));
 }
 
 static rdp_header_t * csp_rdp_header_ref(csp_packet_t * packet) {
@@ -159,6 +144,11 @@ static inline int csp_rdp_time_after(uint32_t time, uint32_t cmp) {
 	return csp_rdp_time_before(cmp, time);
 }
 
+/* Schedule csp_rdp_check_timeouts() for when time is after timestamp + timeout */
+static inline void csp_rdp_schedule(csp_conn_t * conn, uint32_t timestamp, uint32_t timeout) {
+	csp_conn_schedule(conn, timestamp + timeout + 1);
+}
+
 /**
  * CONTROL MESSAGES
  * The following function is used to send empty messages,
@@ -168,7 +158,7 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 
 	/* Generate message */
 	if (!packet) {
-		packet = csp_buffer_get(20);
+		packet = csp_buffer_get_prio(20, CSP_PRIO_CRITICAL, 0); // control messages use buffers reserved for critical traffic
 		if (!packet)
 			return CSP_ERR_NOMEM;
 		packet->length = 0;
@@ -188,19 +178,26 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 	header->syn = (flags & RDP_SYN) ? 1 : 0;
 	header->rst = (flags & RDP_RST) ? 1 : 0;
 
-	/* Send copy to tx_queue, before sending packet to IF */
+	/* Send control messages with high priority */
+	csp_id_t idout = conn->idout;
+	idout.pri = conn->idout.pri < CSP_PRIO_HIGH ? conn->idout.pri : CSP_PRIO_HIGH;
+
+	/* Identifier is set before sharing the packet, so it can be sent (and retransmitted) without a copy */
+	packet->id.ext = idout.ext;
+
+	/* Send reference to tx_queue, before sending packet to IF */
 	if (flags & RDP_SYN) {
-		rdp_packet_t * rdp_packet = csp_buffer_clone(packet);
+		csp_packet_t * rdp_packet = csp_buffer_ref(packet);
 		if (rdp_packet == NULL) return CSP_ERR_NOMEM;
-		rdp_packet->timestamp = csp_get_ms();
+		const uint32_t sent = csp_get_ms();
+		csp_skbf_set_sent(rdp_packet, sent);
+		csp_skbf_set_quarantine(rdp_packet, 0);
 		if (csp_queue_enqueue(conn->rdp.tx_queue, &rdp_packet, 0) != CSP_QUEUE_OK)
 			csp_buffer_free(rdp_packet);
+		else
+			csp_rdp_schedule(conn, sent, conn->rdp.packet_timeout);
 	}
 
-	/* Send control messages with high priority */
-	csp_id_t idout = conn->idout;
-	idout.pri = conn->idout.pri < CSP_PRIO_HIGH ? conn->idout.pri : CSP_PRIO_HIGH;
-
 	csp_log_protocol("RDP %p: Send CMP S %u: syn %u, ack %u, eack %u, rst %u, seq_nr %5u, ack_nr %5u, packet_len %u (%u)",
                          conn, conn->rdp.state, header->syn, header->ack, header->eak,
                          header->rst, csp_ntoh16(header->seq_nr), csp_ntoh16(header->ack_nr),
@@ -230,7 +227,7 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 static int csp_rdp_send_eack(csp_conn_t * conn) {
 
 	/* Allocate message */
-	csp_packet_t * packet_eack = csp_buffer_get(100);
+	csp_packet_t * packet_eack = csp_buffer_get_prio(100, CSP_PRIO_CRITICAL, 0);
 	if (packet_eack == NULL) return CSP_ERR_NOMEM;
 	packet_eack->length = 0;
 
@@ -268,7 +265,7 @@ static int csp_rdp_send_eack(csp_conn_t * conn) {
 static int csp_rdp_send_syn(csp_conn_t * conn) {
 
 	/* Allocate message */
-	csp_packet_t * packet = csp_buffer_get(100);
+	csp_packet_t * packet = csp_buffer_get_prio(100, CSP_PRIO_CRITICAL, 0);
 	if (packet == NULL) return CSP_ERR_NOMEM;
 
 	/* Generate contents */
@@ -338,7 +335,7 @@ static inline bool csp_rdp_seq_in_rx_queue(csp_conn_t * conn, uint16_t seq_nr) {
 
 	/* Loop through RX queue */
 	int i, count;
-	rdp_packet_t * packet;
+	csp_packet_t * packet;
 	count = csp_queue_size(conn->rdp.rx_queue);
 	for (i = 0; i < count; i++) {
 
@@ -349,7 +346,7 @@ static inline bool csp_rdp_seq_in_rx_queue(csp_conn_t * conn, uint16_t seq_nr) {
 
 		csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
 
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
+		rdp_header_t * header = csp_rdp_header_ref(packet);
 		csp_log_protocol("RDP %p: RX Queue exists matching Element, seq %u", conn, header->seq_nr);
 
 		/* If the matching packet was found, deliver */
@@ -376,7 +373,7 @@ static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 
 	/* Loop through TX queue */
 	int i, j, count;
-	rdp_packet_t * packet;
+	csp_packet_t * packet;
 	count = csp_queue_size(conn->rdp.tx_queue);
 	for (i = 0; i < count; i++) {
 
@@ -385,8 +382,8 @@ static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 			break;
 		}
 
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
-		csp_log_protocol("RDP %p: EACK compare element, time %"PRIu32", seq %u", conn, packet->timestamp, csp_ntoh16(header->seq_nr));
+		rdp_header_t * header = csp_rdp_header_ref(packet);
+		csp_log_protocol("RDP %p: EACK compare element, time %"PRIu32", seq %u", conn, csp_skbf_sent(packet), csp_ntoh16(header->seq_nr));
 
 		/* Look for this element in EACKs */
 		int match = 0;
@@ -397,9 +394,11 @@ static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 			/* Enable this if you want EACK's to trigger retransmission */
 			if (csp_ntoh16(eack_packet->data16[j]) > csp_ntoh16(header->seq_nr)) {
 				uint32_t time_now = csp_get_ms();
-				if (csp_rdp_time_after(time_now, packet->quarantine)) {
-					packet->timestamp = time_now - conn->rdp.packet_timeout - 1;
-					packet->quarantine = time_now +	conn->rdp.packet_timeout / 2;
+				if (csp_rdp_time_after(time_now, csp_skbf_quarantine(packet))) {
+					const uint32_t sent = time_now - conn->rdp.packet_timeout - 1;
+					csp_skbf_set_sent(packet, sent);
+					csp_skbf_set_quarantine(packet, time_now + conn->rdp.packet_timeout / 2);
+					csp_rdp_schedule(conn, sent, conn->rdp.packet_timeout);
 				}
 			}
 		}
@@ -417,6 +416,32 @@ static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 
 }
 
+static void csp_rdp_flush_acked(csp_conn_t * conn) {
+
+	/* Loop through TX queue */
+	int i, count;
+	csp_packet_t * packet;
+	count = csp_queue_size(conn->rdp.tx_queue);
+	for (i = 0; i < count; i++) {
+
+		if (csp_queue_dequeue_isr(conn->rdp.tx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
+			csp_log_error("RDP %p: Cannot dequeue from tx_queue in flush ACK", conn);
+			break;
+		}
+
+		/* Free acknowledged elements, otherwise put back on tx queue */
+		rdp_header_t * header = csp_rdp_header_ref(packet);
+		if (csp_rdp_seq_before(csp_ntoh16(header->seq_nr), conn->rdp.snd_una)) {
+			csp_log_protocol("RDP %p: TX Element %u acked", conn, csp_ntoh16(header->seq_nr));
+			csp_buffer_free(packet);
+		} else {
+			csp_queue_enqueue_isr(conn->rdp.tx_queue, &packet, &pdTrue);
+		}
+
+	}
+
+}
+
 static inline bool csp_rdp_should_ack(csp_conn_t * conn) {
 
 	/* If delayed ACKs are not used, always ACK */
@@ -444,43 +469,57 @@ void csp_rdp_flush_all(csp_conn_t * conn) {
 		return;
 	}
 
-	rdp_packet_t * packet;
+	csp_packet_t * packet;
+	void * packets[16];
+	unsigned int count = 0;
 
 	/* Empty TX queue */
 	while (csp_queue_dequeue_isr(conn->rdp.tx_queue, &packet, &pdTrue) == CSP_QUEUE_OK) {
 		if (packet != NULL) {
-			csp_log_protocol("RDP %p: Flush TX Element, time %"PRIu32", seq %u", conn, packet->timestamp, csp_ntoh16(csp_rdp_header_ref((csp_packet_t *) packet)->seq_nr));
-			csp_buffer_free(packet);
+			csp_log_protocol("RDP %p: Flush TX Element, time %"PRIu32", seq %u", conn, csp_skbf_sent(packet), csp_ntoh16(csp_rdp_header_ref(packet)->seq_nr));
+			packets[count++] = packet;
+			if (count == (sizeof(packets) / sizeof(packets[0]))) {
+				csp_buffer_free_n(packets, count);
+				count = 0;
+			}
 		}
 	}
 
 	/* Empty RX queue */
 	while (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) == CSP_QUEUE_OK) {
 		if (packet != NULL) {
-			csp_log_protocol("RDP %p: Flush RX Element, time %"PRIu32", seq %u", conn, packet->timestamp, csp_ntoh16(csp_rdp_header_ref((csp_packet_t *) packet)->seq_nr));
-			csp_buffer_free(packet);
+			csp_log_protocol("RDP %p: Flush RX Element, time %"PRIu32", seq %u", conn, csp_skbf_sent(packet), csp_ntoh16(csp_rdp_header_ref(packet)->seq_nr));
+			packets[count++] = packet;
+			if (count == (sizeof(packets) / sizeof(packets[0]))) {
+				csp_buffer_free_n(packets, count);
+				count = 0;
+			}
 		}
 	}
 
+	/* Free packets in batches */
+	csp_buffer_free_n(packets, count);
+
 }
 
 
 int csp_rdp_check_ack(csp_conn_t * conn) {
 
-	/* Check all RX queues for spare capacity */
-	int avail = 1;
-	for (int prio = 0; prio < CSP_RX_QUEUES; prio++) {
-		if (csp_conf.conn_queue_length - csp_queue_size(conn->rx_queue[prio]) <= 2 * (int32_t)conn->rdp.window_size) {
-			avail = 0;
-			break;
-		}
-	}
+	/* Check RX queue for spare capacity - counting packets of all priorities */
+	const int avail = (csp_conf.conn_queue_length - csp_queue_size(conn->rx_queue) > 2 * (int32_t)conn->rdp.window_size);
 
 	/* If more space available, only send after ack timeout or immediately if delay_acks is zero */
 	if (avail && csp_rdp_should_ack(conn)) {
 		csp_rdp_send_cmp(conn, NULL, RDP_ACK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
 	}
 
+	/* Delayed (or repeated, in case it was lost) ACK is sent at ack timeout, until the connection has been idle for
+	 * conn timeout. If the RX buffer is full, the next csp_read() checks again */
+	if (avail && conn->rdp.delayed_acks &&
+	    ((conn->rdp.rcv_cur != conn->rdp.rcv_lsa) || csp_rdp_time_before(csp_get_ms(), conn->rdp.rx_timestamp + conn->rdp.conn_timeout))) {
+		csp_rdp_schedule(conn, conn->rdp.ack_timestamp, conn->rdp.ack_timeout);
+	}
+
 	return CSP_ERR_NONE;
 
 }
@@ -494,11 +533,32 @@ static inline bool csp_rdp_is_conn_ready_for_tx(csp_conn_t * conn)
 	return true;
 }
 
+/* Wake up user task waiting to transmit, in csp_rdp_send() or csp_poll() */
+static inline void csp_rdp_wake_tx(csp_conn_t * conn)
+{
+	csp_bin_sem_post(&conn->rdp.tx_wait);
+	csp_poll_notify();
+}
+
+uint8_t csp_rdp_poll(csp_conn_t * conn, uint8_t events) {
+
+	if ((conn->rdp.state == RDP_CLOSE_WAIT) || (conn->rdp.state == RDP_CLOSED)) {
+		return CSP_POLLHUP;
+	}
+
+	if ((events & CSP_POLLOUT) && (conn->rdp.state == RDP_OPEN) && csp_rdp_is_conn_ready_for_tx(conn)) {
+		return CSP_POLLOUT;
+	}
+
+	return 0;
+
+}
+
 /**
- * This function must be called with regular intervals for the
- * RDP protocol to work as expected. This takes care of closing
- * stale connections and retransmitting traffic. A good place to
- * call this function is from the CSP router task.
+ * This function is called by the router task, when a timeout scheduled
+ * by csp_rdp_schedule() has expired. This takes care of closing stale
+ * connections, retransmitting traffic and delayed ACKs - and schedules
+ * the next timeout, if anything is still pending.
  */
 void csp_rdp_check_timeouts(csp_conn_t * conn) {
 
@@ -515,6 +575,7 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 			csp_conn_close(conn, CSP_RDP_CLOSED_BY_USERSPACE | CSP_RDP_CLOSED_BY_PROTOCOL | CSP_RDP_CLOSED_BY_TIMEOUT);
 			return;
 		}
+		csp_rdp_schedule(conn, conn->timestamp, conn->rdp.conn_timeout);
 	}
 
 	/**
@@ -524,6 +585,8 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 	if (conn->rdp.state == RDP_CLOSE_WAIT) {
 		if (csp_rdp_time_after(time_now, conn->timestamp + conn->rdp.conn_timeout)) {
 			csp_conn_close(conn, CSP_RDP_CLOSED_BY_PROTOCOL | CSP_RDP_CLOSED_BY_TIMEOUT);
+		} else if ((conn->rdp.closed_by & CSP_RDP_CLOSED_BY_TIMEOUT) == 0) {
+			csp_rdp_schedule(conn, conn->timestamp, conn->rdp.conn_timeout);
 		}
 		return;
 	}
@@ -532,47 +595,70 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 	 * MESSAGE TIMEOUT:
 	 * Check each outgoing message for TX timeout
 	 */
+	bool tx_pending = false;
+	uint32_t tx_oldest = 0;
 	int count = csp_queue_size(conn->rdp.tx_queue);
 	for (int i = 0; i < count; i++) {
 
-		rdp_packet_t * packet;
+		csp_packet_t * packet;
 		if ((csp_queue_dequeue_isr(conn->rdp.tx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) || packet == NULL) {
 			csp_log_warn("RDP %p: Cannot dequeue from tx_queue in check timeout", conn);
 			break;
 		}
 
 		/* Get header */
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
+		rdp_header_t * header = csp_rdp_header_ref(packet);
 
 		/* If acked, do not retransmit */
 		if (csp_rdp_seq_before(csp_ntoh16(header->seq_nr), conn->rdp.snd_una)) {
-			csp_log_protocol("RDP %p: TX Element Free, time %"PRIu32", seq %u, una %u", conn, packet->timestamp, csp_ntoh16(header->seq_nr), conn->rdp.snd_una);
+			csp_log_protocol("RDP %p: TX Element Free, time %"PRIu32", seq %u, una %u", conn, csp_skbf_sent(packet), csp_ntoh16(header->seq_nr), conn->rdp.snd_una);
 			csp_buffer_free(packet);
 			continue;
 		}
 
 		/* Check timestamp and retransmit if needed */
-		if (csp_rdp_time_after(time_now, packet->timestamp + conn->rdp.packet_timeout)) {
+		if (csp_rdp_time_after(time_now, csp_skbf_sent(packet) + conn->rdp.packet_timeout)) {
+
+			/* Data past its deadline is not retransmitted - and as the stream cannot skip it, the connection is reset */
+			if (csp_buffer_expired(packet, time_now)) {
+				csp_log_warn("RDP %p: Packet seq %u expired before acknowledged, reset", conn, csp_ntoh16(header->seq_nr));
+				conn->expired++;
+				csp_queue_enqueue_isr(conn->rdp.tx_queue, &packet, &pdTrue);
+				csp_conn_close(conn, CSP_RDP_CLOSED_BY_PROTOCOL);
+				return;
+			}
+
 			csp_log_protocol("RDP %p: TX Element timed out, retransmitting seq %u", conn, csp_ntoh16(header->seq_nr));
 
 			/* Update to latest outgoing ACK */
 			header->ack_nr = csp_hton16(conn->rdp.rcv_cur);
 
-			/* Send copy to tx_queue */
-			packet->timestamp = csp_get_ms();
-			csp_packet_t * new_packet = csp_buffer_clone(packet);
-			if (csp_send_direct(conn->idout, new_packet, csp_rtable_find_route(conn->idout.dst), 0) != CSP_ERR_NONE) {
+			/* Send reference, tx_queue keeps its reference */
+			csp_skbf_set_sent(packet, csp_get_ms());
+			csp_packet_t * new_packet = csp_buffer_ref(packet);
+			if (csp_send_direct(new_packet->id, new_packet, csp_rtable_find_route(new_packet->id.dst), 0) != CSP_ERR_NONE) {
 				csp_log_warn("RDP %p: Retransmission failed", conn);
 				csp_buffer_free(new_packet);
 			}
 
 		}
 
+		/* Next retransmission is due for the oldest unacknowledged element */
+		const uint32_t sent = csp_skbf_sent(packet);
+		if (!tx_pending || csp_rdp_time_before(sent, tx_oldest)) {
+			tx_oldest = sent;
+			tx_pending = true;
+		}
+
 		/* Requeue the TX element */
 		csp_queue_enqueue_isr(conn->rdp.tx_queue, &packet, &pdTrue);
 
 	}
 
+	if (tx_pending) {
+		csp_rdp_schedule(conn, tx_oldest, conn->rdp.packet_timeout);
+	}
+
 	if (conn->rdp.state == RDP_OPEN) {
 
 		/* Check if we have unacknowledged segments */
@@ -583,7 +669,7 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		/* Wake user task if additional Tx can be done */
 		if (csp_rdp_is_conn_ready_for_tx(conn)) {
 			csp_log_protocol("RDP %p: Wake Tx task (check timeouts)", conn);
-			csp_bin_sem_post(&conn->rdp.tx_wait);
+			csp_rdp_wake_tx(conn);
 		}
 	}
 }
@@ -684,6 +770,11 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		/* Connection accepted */
 		conn->rdp.state = RDP_SYN_RCVD;
 
+		/* Close the connection, if it is not opened (and accepted) in time */
+		if (conn->socket != NULL) {
+			csp_rdp_schedule(conn, conn->timestamp, conn->rdp.conn_timeout);
+		}
+
 		/* Send SYN/ACK */
 		csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_SYN, conn->rdp.snd_iss, conn->rdp.rcv_irs);
 
@@ -714,7 +805,7 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 			/* Wake TX task */
 			csp_log_protocol("RDP %p: Wake Tx task (ack)", conn);
-			csp_bin_sem_post(&conn->rdp.tx_wait);
+			csp_rdp_wake_tx(conn);
 
 			goto discard_open;
 		}
@@ -727,7 +818,7 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		if (rx_header->ack) {
 			csp_log_error("RDP %p: Half-open connection found, send RST and wake Tx task", conn);
 			csp_rdp_send_cmp(conn, NULL, RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
-			csp_bin_sem_post(&conn->rdp.tx_wait);
+			csp_rdp_wake_tx(conn);
 
 			goto discard_open;
 		}
@@ -804,12 +895,22 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				 * and remember that the connection handle has been passed to userspace
 				 * by setting the socket = NULL */
 				conn->socket = NULL;
+				csp_poll_notify();
 			}
 
 		}
 
-		/* Store current ack'ed sequence number */
+		/* Store current ack'ed sequence number, and release acknowledged TX elements */
+		const bool acked = csp_rdp_seq_after(rx_header->ack_nr + 1, conn->rdp.snd_una);
 		conn->rdp.snd_una = rx_header->ack_nr + 1;
+		if (acked) {
+			csp_rdp_flush_acked(conn);
+		}
+
+		/* The transmit window may have opened - wake user task, instead of waiting for a timeout */
+		if (csp_rdp_is_conn_ready_for_tx(conn)) {
+			csp_rdp_wake_tx(conn);
+		}
 
 		/* We have an EACK */
 		if (rx_header->eak) {
@@ -822,6 +923,8 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		if (packet->length <= sizeof(rdp_header_t))
 			goto discard_open;
 
+		conn->rdp.rx_timestamp = csp_get_ms();
+
 		/* If message is not in sequence, send EACK and store packet */
 		if (rx_header->seq_nr != (uint16_t)(conn->rdp.rcv_cur + 1)) {
 			if (csp_rdp_rx_queue_add(conn, packet, rx_header->seq_nr) != CSP_QUEUE_OK) {
@@ -844,8 +947,8 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 		conn->rdp.rcv_cur = seq_nr;
 
 		/* Only ACK the message if there is room for a full window in the RX buffer.
-		 * Unacknowledged segments are ACKed by csp_rdp_check_timeouts when the buffer is
-		 * no longer full. */
+		 * Unacknowledged segments are ACKed by csp_read() when the buffer is no longer
+		 * full, or by csp_rdp_check_timeouts() at ack timeout. */
 		csp_rdp_check_ack(conn);
 
 		/* Flush RX queue */
@@ -985,6 +1088,13 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 		return CSP_ERR_RESET;
 	}
 
+	/* Expired while waiting for the window */
+	if (csp_buffer_expired(packet, csp_get_ms())) {
+		csp_log_protocol("RDP %p: Packet expired before sending seq %u", conn, conn->rdp.snd_nxt);
+		conn->expired++;
+		return CSP_ERR_TIMEDOUT;
+	}
+
 	/* Add RDP header */
 	rdp_header_t * tx_header = csp_rdp_header_add(packet);
 	if (tx_header == NULL) {
@@ -995,20 +1105,25 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 	tx_header->seq_nr = csp_hton16(conn->rdp.snd_nxt);
 	tx_header->ack = 1;
 
-	/* Send copy to tx_queue */
-	rdp_packet_t * rdp_packet = csp_buffer_clone(packet);
+	/* Identifier is set before sharing the packet, so it can be sent (and retransmitted) without a copy */
+	packet->id.ext = conn->idout.ext;
+
+	/* Send reference to tx_queue */
+	csp_packet_t * rdp_packet = csp_buffer_ref(packet);
 	if (rdp_packet == NULL) {
 		csp_log_error("RDP %p: Failed to allocate packet buffer", conn);
 		return CSP_ERR_NOMEM;
 	}
 
-	rdp_packet->timestamp = csp_get_ms();
-	rdp_packet->quarantine = 0;
+	const uint32_t sent = csp_get_ms();
+	csp_skbf_set_sent(rdp_packet, sent);
+	csp_skbf_set_quarantine(rdp_packet, 0);
 	if (csp_queue_enqueue(conn->rdp.tx_queue, &rdp_packet, 0) != CSP_QUEUE_OK) {
 		csp_log_error("RDP %p: No more space in RDP retransmit queue", conn);
 		csp_buffer_free(rdp_packet);
 		return CSP_ERR_NOBUFS;
 	}
+	csp_rdp_schedule(conn, sent, conn->rdp.packet_timeout);
 
 	csp_log_protocol("RDP %p: Sending  in S %u: syn %u, ack %u, eack %u, "
 				"rst %u, seq_nr %5u, ack_nr %5u, packet_len %u (%u)",
@@ -1029,6 +1144,7 @@ int csp_rdp_init(csp_conn_t * conn) {
 	conn->rdp.state = RDP_CLOSED;
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout = csp_rdp_packet_timeout;
+	conn->rdp.timer = -1;
 
 	/* Create a binary semaphore to wait on for tasks */
 	if (csp_bin_sem_create(&conn->rdp.tx_wait) != CSP_SEMAPHORE_OK) {
@@ -1088,10 +1204,14 @@ static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool sen
 			csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
 		}
 		csp_log_protocol("RDP %p: csp_rdp_close(0x%x)%s -> CLOSE_WAIT", conn, closed_by, send_rst ? ", sent RST" : "");
-		csp_bin_sem_post(&conn->rdp.tx_wait); // wake up any pendng Tx
+		csp_rdp_wake_tx(conn); // wake up any pendng Tx
 	}
 
 	if (conn->rdp.closed_by != CSP_RDP_CLOSED_BY_ALL) {
+		/* Close at CLOSE-WAIT timeout */
+		if ((conn->rdp.closed_by & CSP_RDP_CLOSED_BY_TIMEOUT) == 0) {
+			csp_rdp_schedule(conn, conn->timestamp, conn->rdp.conn_timeout);
+		}
 		csp_log_protocol("RDP %p: csp_rdp_close(0x%x), waiting for:%s%s%s",
 			conn, closed_by,
 			(conn->rdp.closed_by & CSP_RDP_CLOSED_BY_USERSPACE) ? "" : " userspace",
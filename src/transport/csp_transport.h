@@ -27,8 +27,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 extern "C" {
 #endif
 
+/** Number of bytes of the RDP header, appended to the data of each RDP packet */
+#define CSP_RDP_HEADER_LENGTH	5
+
 /** ARRIVING SEGMENT */
 void csp_udp_new_packet(csp_conn_t * conn, csp_packet_t * packet);
+void csp_udp_new_packets(csp_conn_t * conn, csp_packet_t ** packets, unsigned int count);
 bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet);
 
 /** RDP: USER REQUESTS */
@@ -41,6 +45,7 @@ int csp_rdp_check_ack(csp_conn_t * conn);
 void csp_rdp_check_timeouts(csp_conn_t * conn);
 void csp_rdp_flush_all(csp_conn_t * conn);
 void csp_rdp_free_resources(csp_conn_t * conn);
+uint8_t csp_rdp_poll(csp_conn_t * conn, uint8_t events);
 
 #ifdef __cplusplus
 }
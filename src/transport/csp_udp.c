@@ -24,14 +24,25 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_queue.h>
 
 #include "../csp_conn.h"
+#include "../csp_poll.h"
 
 void csp_udp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
+	csp_udp_new_packets(conn, &packet, 1);
+
+}
+
+void csp_udp_new_packets(csp_conn_t * conn, csp_packet_t ** packets, unsigned int count) {
+
 	/* Enqueue */
-	if (csp_conn_enqueue_packet(conn, packet) < 0) {
+	const int enqueued = csp_conn_enqueue_packets(conn, packets, count);
+	if (enqueued < (int) count) {
 		csp_log_error("Connection buffer queue full!");
-		csp_buffer_free(packet);
-		return;
+		const unsigned int first = (enqueued > 0) ? enqueued : 0;
+		csp_buffer_free_n((void **) &packets[first], count - first);
+		if (enqueued <= 0) {
+			return;
+		}
 	}
 
 	/* Try to queue up the new connection pointer */
@@ -44,6 +55,7 @@ void csp_udp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 		/* Ensure that this connection will not be posted to this socket again */
 		conn->socket = NULL;
+		csp_poll_notify();
 	}
 
 }